@@ -0,0 +1,272 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "parallel.h"
+#include "path_template.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Replaces every component of a path with a keyed hash while keeping its shape, so paths can leave
+the machine in telemetry and still be grouped by directory, depth and file type.
+
+	util::utf8::path_anonymizer anon({key0, key1}); // keep the key secret and stable
+	std::string out;
+	anon.append(out, "C:\\Users\\me\\report.pdf"); // C:\41f2..\9c0e..\77ab...pdf
+
+	auto hidden = util::utf8::anonymize_paths(anon, paths.data(), paths.size()); // see path_template.h
+
+Components are those of components(): each one becomes the first digits hex characters of its
+SipHash-2-4 under the key, so equal names give equal hashes anywhere in any path, and without the
+key they cannot be guessed even from a list of likely names. Separators are kept as they are, as
+are "." and "..", the filename's extension and the kind of root: a drive letter is kept, a UNC
+server name is hashed behind its \\, and a device prefix (\\?\) is kept together with a drive or
+UNC right after it. An alternate data stream is hashed separately after its ':'.
+
+The size of a result depends only on the shape of the path, so it is known without hashing.
+Paths that share a parent directory can share the work for it through an anonymize_memo, batches
+use one per thread.
+*/
+namespace util {
+	namespace utf8 {
+		/* the anonymized forms of recently seen parent directories, not thread safe */
+		class anonymize_memo {
+		public:
+			static constexpr size_t ways = 2;
+
+			/* slots is rounded up to a power of two, a parent's hash picks a set of 2 of them */
+			explicit anonymize_memo(const size_t slots = 1024)
+							: entries(std::bit_ceil(std::max<size_t>(slots, ways))), last(entries.size() / ways),
+							  mask(entries.size() / ways - 1)
+			{
+			}
+
+		private:
+			friend class path_anonymizer;
+
+			struct entry {
+				uint64_t    tag = 0;
+				std::string parent;
+				std::string anonymized;
+			};
+
+			/* the entry holding parent, or the one to refill with it (its parent cleared) */
+			entry& slot(const std::string_view parent)
+			{
+				// the whole parent, siblings of a deep tree differ anywhere (/users/<id>/cache/)
+				const uint64_t h   = hash::bytes(parent.data(), parent.size());
+				const size_t   set = static_cast<size_t>(h & mask);
+				for (size_t i = 0; i < ways; i++) {
+					entry& e = entries[set * ways + i];
+					if (e.tag == h && e.parent == parent) {
+						last[set] = static_cast<uint8_t>(i);
+						return e;
+					}
+				}
+				// the way not used last is replaced
+				const auto victim = static_cast<uint8_t>((last[set] + 1) % ways);
+				entry&     e      = entries[set * ways + victim];
+				last[set]         = victim;
+				e.tag             = h;
+				e.parent.clear();
+				return e;
+			}
+
+			std::vector<entry>   entries;
+			std::vector<uint8_t> last; // way of each set used last
+			uint64_t             mask = 0;
+		};
+
+		class path_anonymizer {
+		public:
+			/* digits is the number of hex characters written per component, 1 to 16 */
+			explicit path_anonymizer(const hash::sip_key key, const unsigned digits = 16)
+							: key(key), digits(std::clamp(digits, 1u, 16u))
+			{
+			}
+
+			/* the size of the result for path */
+			size_t size(const std::string_view path) const
+			{
+				size_t ret = 0;
+				visit(path, [&](const std::string_view text, bool hashed) { ret += hashed ? digits : text.size(); });
+				return ret;
+			}
+
+			/* writes the result for path to out if it fits in capacity, returns its size either way */
+			size_t anonymize(char* const out, const size_t capacity, const std::string_view path,
+							anonymize_memo* const memo = nullptr) const
+			{
+				const size_t n = size(path);
+				if (n <= capacity) {
+					write(out, path, memo);
+				}
+				return n;
+			}
+
+			/* appends the result for path to out */
+			void append(std::string& out, const std::string_view path, anonymize_memo* const memo = nullptr) const
+			{
+				const size_t start = out.size();
+				out.resize(start + size(path));
+				write(out.data() + start, path, memo);
+			}
+
+		private:
+			friend formatted_paths anonymize_paths(const path_anonymizer& anonymizer,
+							const std::string_view* const paths, const size_t count, const unsigned threads);
+
+			/*
+			calls fn(text, hashed) for the pieces of path in order, hashed pieces are replaced with their hash and the
+			others copied. the pieces of the parent directory come first and end at the filename
+			*/
+			template<typename Fn> void visit(const std::string_view path, Fn&& fn) const
+			{
+				const char* const data = path.data();
+				const char* const tail = data + path.size();
+				const char* const name = find_filename(data, tail);
+				visit_parent(data, name, tail, fn);
+				visit_filename(name, tail, fn);
+			}
+
+			template<typename Fn>
+			void visit_parent(const char* const data, const char* const name, const char* const tail, Fn&& fn) const
+			{
+				const char* const root_name_end = std::min(find_root_name_end(data, tail), name);
+				const size_t      root_size     = static_cast<size_t>(root_name_end - data);
+				bool              after_device  = false;
+				if (root_size == 3 && (data[2] == '?' || data[2] == '.' || data[1] == '?')) {
+					after_device = true; // \\?\, \\.\ or \??\, what follows may be a drive or UNC
+					fn(std::string_view(data, root_size), false);
+				} else if (root_size > 2) {
+					fn(std::string_view(data, 2), false); // \\server
+					fn(std::string_view(data + 2, root_size - 2), true);
+				} else {
+					fn(std::string_view(data, root_size), false);
+				}
+
+				// components() one run of separators and one component at a time, the separators are kept
+				for (const char* p = root_name_end; p != name;) {
+					const char* first = p;
+					while (first != name && is_slash(*first)) {
+						++first;
+					}
+					const char* last = first;
+					while (last != name && !is_slash(*last)) {
+						++last;
+					}
+					const auto c = std::string_view(first, static_cast<size_t>(last - first));
+					fn(std::string_view(p, static_cast<size_t>(first - p)), false);
+					if (!c.empty()) {
+						fn(c, !kept(c, after_device));
+						after_device = false;
+					}
+					p = last;
+				}
+			}
+
+			template<typename Fn> void visit_filename(const char* const name, const char* const tail, Fn&& fn) const
+			{
+				const auto filename = std::string_view(name, static_cast<size_t>(tail - name));
+				if (filename.empty() || kept(filename, false)) {
+					fn(filename, false);
+					return;
+				}
+				// the name is hashed whole and the extension kept after it, a stream is hashed on its own
+				const char* const ads = std::find(name, tail, ':');
+				const char* const ext = find_extension(name, ads);
+				fn(std::string_view(name, static_cast<size_t>(ads - name)), true);
+				fn(std::string_view(ext, static_cast<size_t>(ads - ext)), false);
+				if (ads != tail) {
+					fn(std::string_view(ads, 1), false);
+					fn(std::string_view(ads + 1, static_cast<size_t>(tail - ads - 1)), ads + 1 != tail);
+				}
+			}
+
+			static bool kept(const std::string_view c, const bool after_device)
+			{
+				if (c == "." || c == "..") {
+					return true;
+				}
+				if (!after_device) {
+					return false;
+				}
+				const bool unc = c.size() == 3 && fold_letter(c[0]) == 'u' && fold_letter(c[1]) == 'n' &&
+								 fold_letter(c[2]) == 'c';
+				return unc || (c.size() == 2 && is_drive_prefix(c.data()));
+			}
+
+			char* write_pieces(char* out, const std::string_view text, const bool hashed) const
+			{
+				if (hashed) {
+					// the top digits nibbles of the hash
+					constexpr char hex[] = "0123456789abcdef";
+					const uint64_t h     = hash::siphash(key, text.data(), text.size());
+					for (unsigned i = 0; i < digits; i++) {
+						*out++ = hex[(h >> (60 - 4 * i)) & 15];
+					}
+				} else if (!text.empty()) {
+					std::memcpy(out, text.data(), text.size());
+					out += text.size();
+				}
+				return out;
+			}
+
+			char* write(char* out, const std::string_view path, anonymize_memo* const memo) const
+			{
+				const char* const data   = path.data();
+				const char* const tail   = data + path.size();
+				const char* const name   = find_filename(data, tail);
+				const auto        parent = std::string_view(data, static_cast<size_t>(name - data));
+				const auto        put    = [&](const std::string_view text, bool hashed) {
+					out = write_pieces(out, text, hashed);
+				};
+
+				if (memo && !parent.empty()) {
+					auto& e = memo->slot(parent);
+					if (e.parent != parent) {
+						char* const first = out;
+						visit_parent(data, name, tail, put);
+						e.parent.assign(parent);
+						e.anonymized.assign(first, static_cast<size_t>(out - first));
+					} else {
+						std::memcpy(out, e.anonymized.data(), e.anonymized.size());
+						out += e.anonymized.size();
+					}
+				} else {
+					visit_parent(data, name, tail, put);
+				}
+				visit_filename(name, tail, put);
+				return out;
+			}
+
+			hash::sip_key key;
+			unsigned      digits;
+		};
+
+		/*
+		anonymizes paths[0, count) into one buffer. every result is sized in a first pass and written in place in a
+		second, both split over threads (0 for one per hardware thread) with a memo each
+		*/
+		inline formatted_paths anonymize_paths(const path_anonymizer& anonymizer, const std::string_view* const paths,
+						const size_t count, const unsigned threads = 0)
+		{
+			const unsigned n = parallel::batch_threads(count, threads);
+
+			formatted_paths             ret;
+			std::vector<anonymize_memo> memos(n);
+			parallel::concatenate(
+							count, n, ret.buffer, ret.offsets,
+							[&](unsigned, size_t i) { return anonymizer.size(paths[i]); },
+							[&](unsigned t, size_t i, char* out) { anonymizer.write(out, paths[i], &memos[t]); });
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
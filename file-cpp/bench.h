@@ -0,0 +1,345 @@
+﻿#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+Small benchmark harness used by the file-cpp driver.
+
+Every (function, corpus) pair is timed as a number of repeated samples. Each sample runs
+the function over the whole corpus and records nanoseconds per item, the summary keeps the
+median and the median absolute deviation (MAD) which are both robust against the odd
+sample that got preempted.
+
+Results can be written to a json baseline and a later run compared against it:
+
+	util::bench::compare_options opts = {};
+	opts.threshold = 0.05; // 5% slower is a regression...
+	opts.sigmas    = 3.0;  // ...if it is also outside of the noise
+	auto report    = util::bench::compare(baseline, current, opts);
+	return report.regressed ? 1 : 0;
+*/
+namespace util {
+	namespace bench {
+		struct stats {
+			double median  = 0.0; // nanoseconds per item
+			double mad     = 0.0; // median absolute deviation of the samples, in nanoseconds per item
+			size_t samples = 0;
+		};
+
+		struct result {
+			std::string function;
+			std::string corpus;
+			size_t      items = 0;
+			stats       ns_per_item;
+		};
+
+		/* median of values, reorders the input */
+		inline double median(std::vector<double>& values)
+		{
+			if (values.empty()) {
+				return 0.0;
+			}
+			const auto mid = values.begin() + (values.size() / 2);
+			std::nth_element(values.begin(), mid, values.end());
+			if (values.size() & 1) {
+				return *mid;
+			}
+			// even count, average with the largest value of the lower half
+			const auto lower = *std::max_element(values.begin(), mid);
+			return (lower + *mid) * 0.5;
+		}
+
+		inline stats summarize(std::vector<double> values)
+		{
+			stats ret   = {};
+			ret.samples = values.size();
+			ret.median  = median(values);
+			for (auto& v : values) {
+				v = std::fabs(v - ret.median);
+			}
+			ret.mad = median(values);
+			return ret;
+		}
+
+		/* prevents the optimizer from discarding work whose result is otherwise unused */
+		template<typename T> inline void do_not_optimize(const T& value)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			asm volatile("" : : "r,m"(value) : "memory");
+#else
+			static volatile T sink;
+			sink = value;
+#endif
+		}
+
+		/*
+		times fn() which should process items elements per call, fn is called once to warm up
+		and then samples times
+		*/
+		template<typename Fn> inline stats measure(Fn&& fn, size_t items, size_t samples)
+		{
+			using clock = std::chrono::steady_clock;
+			do_not_optimize(fn());
+
+			std::vector<double> values;
+			values.reserve(samples);
+			for (size_t i = 0; i < samples; i++) {
+				const auto start = clock::now();
+				do_not_optimize(fn());
+				const auto stop = clock::now();
+				const auto ns   = std::chrono::duration<double, std::nano>(stop - start).count();
+				values.push_back(ns / static_cast<double>(items ? items : 1));
+			}
+			return summarize(std::move(values));
+		}
+
+		namespace detail {
+			inline void append_escaped(std::string& out, std::string_view value)
+			{
+				out.push_back('"');
+				for (const char c : value) {
+					if (c == '"' || c == '\\') {
+						out.push_back('\\');
+					}
+					out.push_back(c);
+				}
+				out.push_back('"');
+			}
+
+			inline void append_number(std::string& out, double value)
+			{
+				char buf[32];
+				const int len = std::snprintf(buf, sizeof(buf), "%.4f", value);
+				out.append(buf, len > 0 ? static_cast<size_t>(len) : 0);
+			}
+
+			/* just enough of a json reader to load what to_json() writes */
+			struct json_reader {
+				std::string_view text;
+				size_t           pos = 0;
+
+				void skip_ws()
+				{
+					while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' ||
+									text[pos] == '\r')) {
+						pos++;
+					}
+				}
+
+				bool consume(char c)
+				{
+					skip_ws();
+					if (pos < text.size() && text[pos] == c) {
+						pos++;
+						return true;
+					}
+					return false;
+				}
+
+				bool read_string(std::string& out)
+				{
+					out.clear();
+					if (!consume('"')) {
+						return false;
+					}
+					while (pos < text.size() && text[pos] != '"') {
+						if (text[pos] == '\\' && pos + 1 < text.size()) {
+							pos++;
+						}
+						out.push_back(text[pos++]);
+					}
+					return consume('"');
+				}
+
+				bool read_number(double& out)
+				{
+					skip_ws();
+					const size_t start = pos;
+					while (pos < text.size() && (std::string_view("+-.0123456789eE").find(text[pos]) !=
+									std::string_view::npos)) {
+						pos++;
+					}
+					if (start == pos) {
+						return false;
+					}
+					out = std::strtod(std::string(text.substr(start, pos - start)).c_str(), nullptr);
+					return true;
+				}
+			};
+		} // namespace detail
+
+		inline std::string to_json(const std::vector<result>& results)
+		{
+			std::string out = "{\n\t\"results\": [";
+			for (size_t i = 0; i < results.size(); i++) {
+				const auto& r = results[i];
+				out += i ? ",\n\t\t{" : "\n\t\t{";
+				out += "\"function\": ";
+				detail::append_escaped(out, r.function);
+				out += ", \"corpus\": ";
+				detail::append_escaped(out, r.corpus);
+				out += ", \"items\": " + std::to_string(r.items);
+				out += ", \"samples\": " + std::to_string(r.ns_per_item.samples);
+				out += ", \"median_ns\": ";
+				detail::append_number(out, r.ns_per_item.median);
+				out += ", \"mad_ns\": ";
+				detail::append_number(out, r.ns_per_item.mad);
+				out += "}";
+			}
+			out += "\n\t]\n}\n";
+			return out;
+		}
+
+		/* parses the output of to_json(), returns false on malformed input */
+		inline bool from_json(std::string_view text, std::vector<result>& results)
+		{
+			detail::json_reader in = {text};
+			std::string         key;
+			if (!in.consume('{') || !in.read_string(key) || key != "results" || !in.consume(':') ||
+							!in.consume('[')) {
+				return false;
+			}
+
+			results.clear();
+			if (in.consume(']')) {
+				return in.consume('}');
+			}
+			do {
+				if (!in.consume('{')) {
+					return false;
+				}
+				result r = {};
+				do {
+					if (!in.read_string(key) || !in.consume(':')) {
+						return false;
+					}
+					if (key == "function" || key == "corpus") {
+						if (!in.read_string(key == "function" ? r.function : r.corpus)) {
+							return false;
+						}
+						continue;
+					}
+					double value = 0.0;
+					if (!in.read_number(value)) {
+						return false;
+					}
+					if (key == "items") {
+						r.items = static_cast<size_t>(value);
+					} else if (key == "samples") {
+						r.ns_per_item.samples = static_cast<size_t>(value);
+					} else if (key == "median_ns") {
+						r.ns_per_item.median = value;
+					} else if (key == "mad_ns") {
+						r.ns_per_item.mad = value;
+					}
+				} while (in.consume(','));
+				if (!in.consume('}')) {
+					return false;
+				}
+				results.push_back(std::move(r));
+			} while (in.consume(','));
+			return in.consume(']') && in.consume('}');
+		}
+
+		struct compare_options {
+			double threshold = 0.05; // relative slowdown of the median before anything is flagged
+			double sigmas    = 3.0;  // the slowdown must also exceed this many (scaled) MADs of noise
+		};
+
+		struct comparison {
+			std::string function; // empty for a per-corpus summary
+			std::string corpus;   // empty for a per-function summary
+			double      baseline  = 0.0;
+			double      current   = 0.0;
+			double      ratio     = 1.0; // current / baseline
+			bool        regressed = false;
+		};
+
+		struct report {
+			std::vector<comparison> cases;
+			std::vector<comparison> functions; // geometric mean of the ratios of each function over all corpora
+			std::vector<comparison> corpora;   // geometric mean of the ratios of each corpus over all functions
+			std::vector<std::string> missing;  // "function/corpus" in the baseline but not in the current run
+			bool regressed = false;
+		};
+
+		/*
+		a case regresses when its median is more than threshold slower than the baseline and the
+		difference is larger than sigmas combined standard deviations, estimated from the MAD
+		(1.4826 * MAD for normally distributed noise). Summaries regress when the geometric mean
+		of their ratios is above 1 + threshold and most of their cases are slower beyond the noise.
+		*/
+		inline report compare(const std::vector<result>& baseline, const std::vector<result>& current,
+						const compare_options& opts = {})
+		{
+			constexpr double mad_to_sigma = 1.4826;
+			report           ret          = {};
+
+			struct group {
+				std::string name;
+				double      log_sum = 0.0;
+				size_t      count   = 0;
+				size_t      slower  = 0; // cases slower than the noise, regardless of threshold
+			};
+			std::vector<group> functions;
+			std::vector<group> corpora;
+			const auto         add_to = [](std::vector<group>& groups, const std::string& name, double ratio,
+							bool slower) {
+				auto it = std::find_if(groups.begin(), groups.end(), [&](const group& g) { return g.name == name; });
+				if (it == groups.end()) {
+					it = groups.insert(groups.end(), group{name});
+				}
+				it->log_sum += std::log(ratio);
+				it->count++;
+				it->slower += slower;
+			};
+
+			for (const auto& base : baseline) {
+				const auto it = std::find_if(current.begin(), current.end(), [&](const result& r) {
+					return r.function == base.function && r.corpus == base.corpus;
+				});
+				if (it == current.end()) {
+					ret.missing.push_back(base.function + "/" + base.corpus);
+					continue;
+				}
+
+				comparison c = {base.function, base.corpus, base.ns_per_item.median, it->ns_per_item.median};
+				if (c.baseline <= 0.0 || c.current <= 0.0) {
+					continue;
+				}
+				c.ratio            = c.current / c.baseline;
+				const double noise = mad_to_sigma * std::sqrt(base.ns_per_item.mad * base.ns_per_item.mad +
+								it->ns_per_item.mad * it->ns_per_item.mad);
+				const bool slower = (c.current - c.baseline) > opts.sigmas * noise;
+				c.regressed       = slower && c.ratio > 1.0 + opts.threshold;
+				ret.regressed |= c.regressed;
+				add_to(functions, c.function, c.ratio, slower);
+				add_to(corpora, c.corpus, c.ratio, slower);
+				ret.cases.push_back(std::move(c));
+			}
+
+			const auto summarize_groups = [&](const std::vector<group>& groups, std::vector<comparison>& out,
+							bool by_function) {
+				for (const auto& g : groups) {
+					comparison c = {};
+					(by_function ? c.function : c.corpus) = g.name;
+					c.ratio                                = std::exp(g.log_sum / static_cast<double>(g.count));
+					c.regressed = c.ratio > 1.0 + opts.threshold && g.slower * 2 > g.count;
+					ret.regressed |= c.regressed;
+					out.push_back(std::move(c));
+				}
+			};
+			summarize_groups(functions, ret.functions, true);
+			summarize_groups(corpora, ret.corpora, false);
+			return ret;
+		}
+	} // namespace bench
+} // namespace util
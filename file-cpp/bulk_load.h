@@ -0,0 +1,734 @@
+﻿#pragma once
+
+#include "file.h"
+#include "trace.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<linux/fiemap.h>)
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define FILE_CPP_IO_URING_ENABLED 1
+#endif
+#endif
+#endif
+
+/*
+Reads the contents of many files, such as the inputs of a build or an indexer, in the order the
+disk holds them rather than the order they were listed in.
+
+	util::utf8::bulk_load_options options;
+	options.in_flight = 64;
+	auto stats = util::utf8::load_files(paths.data(), paths.size(), [&](const util::utf8::loaded_file& file) {
+		if (!file.error)
+			index(paths[file.index], file.contents);
+	}, options);
+
+Paths are grouped by parent_path() so each directory is opened once and its files are opened and
+stat()ed relative to it. Within a directory files are read in inode order, or by the physical
+offset of their first extent (FIEMAP) with physical_order, and directories in the order of their
+first file; where neither is known the listed order is kept.
+
+On Linux reads go through an io_uring, driven with the raw system calls, with up to in_flight
+files read at once. Where io_uring is missing or refused (older kernels, seccomp filters) and on
+other systems files are read one at a time with the same ordering.
+
+fn is called once per path, from the calling thread, with the file's contents in a buffer of a
+small pool that is reused once fn returns. contents hold the size stat() saw when the file was
+planned, less if it shrank since, and at most max_bytes of it. error is an errno (GetLastError() on
+Windows) when the file could not be read, contents are empty then.
+*/
+namespace util {
+	namespace utf8 {
+		struct loaded_file {
+			size_t           index = 0; // into the paths given to load_files
+			std::string_view contents;  // valid until fn returns
+			int              error = 0;
+		};
+
+		struct bulk_load_options {
+			unsigned in_flight      = 32;    // files read at once, also the number of pooled buffers
+			bool     physical_order = false; // order by FIEMAP physical offset, opens every file once more
+			bool     use_io_uring   = true;
+			uint64_t max_bytes      = UINT64_MAX; // read at most the first max_bytes of each file
+		};
+
+		struct bulk_load_stats {
+			size_t   loaded   = 0;
+			size_t   failed   = 0;
+			uint64_t bytes    = 0;
+			bool     io_uring = false; // whether the reads went through an io_uring, until it failed if it did
+		};
+
+		namespace detail {
+			struct bulk_plan_entry {
+				size_t   index = 0;
+				uint64_t key   = 0; // inode or physical offset, the read order within a directory
+				uint64_t size  = 0;
+				uint32_t group = 0; // the directory, into bulk_plan::parents
+				int      error = 0;
+			};
+
+			struct bulk_plan {
+				std::vector<std::string_view> parents;
+				std::vector<bulk_plan_entry>  entries; // in read order, files of a directory together
+			};
+
+			/* the directory part of path and the name to open relative to it */
+			inline std::pair<std::string_view, std::string_view> split_parent(const std::string_view path)
+			{
+				const char* const data = path.data();
+				const char* const tail = data + path.size();
+				const char* const name = find_filename(data, tail);
+				const char*       end  = name;
+				const char* const root = find_relative_path(data, tail);
+				while (end != root && is_slash(end[-1])) {
+					--end;
+				}
+				return {std::string_view(data, static_cast<size_t>(end - data)),
+								std::string_view(name, static_cast<size_t>(tail - name))};
+			}
+
+#if defined(_WIN32)
+			inline int open_directory(const std::string_view)
+			{
+				return -1;
+			}
+
+			inline void close_directory(const int)
+			{
+			}
+#else
+			/* a descriptor to open names in parent relative to, AT_FDCWD for "" */
+			inline int open_directory(const std::string_view parent)
+			{
+				if (parent.empty()) {
+					return AT_FDCWD;
+				}
+				const std::string z(parent);
+				return ::open(z.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			}
+
+			inline void close_directory(const int fd)
+			{
+				if (fd >= 0) {
+					::close(fd);
+				}
+			}
+#endif
+
+#if defined(FILE_CPP_IO_URING_ENABLED)
+			/* physical offset of the first extent of the file at fd, false if the filesystem cannot tell */
+			inline bool first_extent(const int fd, uint64_t& out)
+			{
+				alignas(alignof(struct fiemap)) char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+				auto* const map      = reinterpret_cast<struct fiemap*>(buffer);
+				map->fm_start        = 0;
+				map->fm_length       = ~uint64_t{0};
+				map->fm_extent_count = 1;
+				if (::ioctl(fd, FS_IOC_FIEMAP, map) != 0 || map->fm_mapped_extents == 0) {
+					return false;
+				}
+				out = map->fm_extents[0].fe_physical;
+				return true;
+			}
+#endif
+
+			/* groups paths by directory, stats every file and sorts them into read order */
+			inline bulk_plan plan_bulk_load(const std::string_view* const paths, const size_t count,
+							const bool physical_order, const uint64_t max_bytes)
+			{
+				bulk_plan ret;
+				ret.entries.resize(count);
+				std::vector<std::string_view> names(count);
+				for (size_t i = 0; i < count; i++) {
+					const auto [parent, name] = split_parent(paths[i]);
+					ret.entries[i].index      = i;
+					names[i]                  = name;
+					ret.parents.push_back(parent);
+				}
+				// one group per distinct parent, in the order of their first file for now
+				std::vector<uint32_t> by_parent(count);
+				for (size_t i = 0; i < count; i++) {
+					by_parent[i] = static_cast<uint32_t>(i);
+				}
+				std::stable_sort(by_parent.begin(), by_parent.end(),
+								[&](uint32_t a, uint32_t b) { return ret.parents[a] < ret.parents[b]; });
+				std::vector<std::string_view> groups;
+				for (size_t i = 0; i < count; i++) {
+					const auto parent = ret.parents[by_parent[i]];
+					if (groups.empty() || groups.back() != parent) {
+						groups.push_back(parent);
+					}
+					ret.entries[by_parent[i]].group = static_cast<uint32_t>(groups.size() - 1);
+				}
+
+				FILE_CPP_PROBE2(bulk_stat_begin, count, groups.size());
+#if defined(_WIN32)
+				(void)physical_order;
+				for (auto& e : ret.entries) {
+					const std::string         z(paths[e.index]);
+					WIN32_FILE_ATTRIBUTE_DATA data = {};
+					if (!GetFileAttributesExA(z.c_str(), GetFileExInfoStandard, &data)) {
+						e.error = static_cast<int>(GetLastError());
+					} else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+						e.error = ERROR_DIRECTORY;
+					} else {
+						e.size = std::min((uint64_t{data.nFileSizeHigh} << 32) | data.nFileSizeLow, max_bytes);
+					}
+					e.key = e.index; // no inode without opening the file
+				}
+#else
+				std::string z;
+				for (size_t first = 0; first < count;) {
+					size_t last = first;
+					while (last != count && ret.entries[by_parent[last]].group == ret.entries[by_parent[first]].group) {
+						++last;
+					}
+					const int dir       = open_directory(ret.parents[by_parent[first]]);
+					const int dir_error = dir == -1 ? errno : 0;
+					for (size_t i = first; i < last; i++) {
+						auto& e = ret.entries[by_parent[i]];
+						z.assign(names[e.index]);
+						struct stat st = {};
+						if (dir == -1) {
+							e.error = dir_error;
+						} else if (::fstatat(dir, z.c_str(), &st, 0) != 0) {
+							e.error = errno;
+						} else if (S_ISDIR(st.st_mode)) {
+							e.error = EISDIR;
+						} else {
+							e.size = std::min(static_cast<uint64_t>(st.st_size), max_bytes);
+							e.key  = static_cast<uint64_t>(st.st_ino);
+#if defined(FILE_CPP_IO_URING_ENABLED)
+							if (physical_order) {
+								const int fd = ::openat(dir, z.c_str(), O_RDONLY | O_CLOEXEC);
+								if (fd != -1) {
+									first_extent(fd, e.key);
+									::close(fd);
+								}
+							}
+#else
+							(void)physical_order;
+#endif
+						}
+					}
+					close_directory(dir);
+					first = last;
+				}
+#endif
+				FILE_CPP_PROBE2(bulk_stat_end, count, groups.size());
+				ret.parents = std::move(groups);
+
+				// files of a directory by key, directories by the smallest key among their files
+				std::vector<uint64_t> group_key(ret.parents.size(), ~uint64_t{0});
+				for (const auto& e : ret.entries) {
+					group_key[e.group] = std::min(group_key[e.group], e.key);
+				}
+				std::sort(ret.entries.begin(), ret.entries.end(), [&](const auto& a, const auto& b) {
+					if (a.group != b.group) {
+						const uint64_t ka = group_key[a.group];
+						const uint64_t kb = group_key[b.group];
+						return ka != kb ? ka < kb : a.group < b.group;
+					}
+					return a.key != b.key ? a.key < b.key : a.index < b.index;
+				});
+				return ret;
+			}
+
+			/* the buffers handed to fn, each grows to the largest file it has held */
+			class buffer_pool {
+			public:
+				explicit buffer_pool(const size_t count) : buffers(count)
+				{
+					free.reserve(count);
+					for (size_t i = count; i-- > 0;) {
+						free.push_back(static_cast<uint32_t>(i));
+					}
+				}
+
+				bool empty() const
+				{
+					return free.empty();
+				}
+
+				uint32_t take(const uint64_t size)
+				{
+					const uint32_t i = free.back();
+					free.pop_back();
+					if (buffers[i].size() < size) {
+						buffers[i].resize(static_cast<size_t>(size));
+					}
+					return i;
+				}
+
+				void give_back(const uint32_t i)
+				{
+					free.push_back(i);
+				}
+
+				/* gives i back with new memory, the old memory is kept unused until the pool is destroyed */
+				void abandon(const uint32_t i)
+				{
+					abandoned.push_back(std::move(buffers[i]));
+					buffers[i] = {};
+					free.push_back(i);
+				}
+
+				char* data(const uint32_t i)
+				{
+					return buffers[i].data();
+				}
+
+			private:
+				std::vector<std::vector<char>> buffers;
+				std::vector<uint32_t>          free;
+				std::vector<std::vector<char>> abandoned; // may still be written by reads of a dead ring
+			};
+
+#if defined(FILE_CPP_IO_URING_ENABLED)
+			/* the parts of an io_uring that reading files needs, without liburing */
+			class io_ring {
+			public:
+				explicit io_ring(const unsigned entries)
+				{
+					io_uring_params params = {};
+					fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+					if (fd < 0) {
+						fd = -1;
+						return;
+					}
+					sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+					cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+					if (params.features & IORING_FEAT_SINGLE_MMAP) {
+						sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+					}
+					sq_ring = ::mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+									IORING_OFF_SQ_RING);
+					cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+									  ? sq_ring
+									  : ::mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+														fd, IORING_OFF_CQ_RING);
+					sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+					sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE,
+									MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+					if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+						close();
+						return;
+					}
+					char* const sq = static_cast<char*>(sq_ring);
+					char* const cq = static_cast<char*>(cq_ring);
+					sq_tail        = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+					sq_mask        = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+					sq_array       = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+					cq_head        = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+					cq_tail        = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+					cq_mask        = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+					cqes           = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+				}
+
+				io_ring(const io_ring&)            = delete;
+				io_ring& operator=(const io_ring&) = delete;
+
+				~io_ring()
+				{
+					close();
+				}
+
+				explicit operator bool() const
+				{
+					return fd != -1;
+				}
+
+				/* queues a read of one iovec, submitted by the next wait() */
+				void read(const int file, const iovec* const iov, const uint64_t offset, const uint64_t user_data)
+				{
+					const unsigned tail = *sq_tail;
+					const unsigned i    = tail & sq_mask;
+					io_uring_sqe&  sqe  = sqes[i];
+					std::memset(&sqe, 0, sizeof(sqe));
+					sqe.opcode    = IORING_OP_READV; // rather than IORING_OP_READ, which needs 5.6
+					sqe.fd        = file;
+					sqe.addr      = reinterpret_cast<uint64_t>(iov);
+					sqe.len       = 1;
+					sqe.off       = offset;
+					sqe.user_data = user_data;
+					sq_array[i]   = i;
+					std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+					queued++;
+				}
+
+				/* submits what is queued and waits for at least one completion, false if the ring failed */
+				bool wait()
+				{
+					for (;;) {
+						const long r = ::syscall(__NR_io_uring_enter, fd, queued, 1, IORING_ENTER_GETEVENTS,
+										nullptr, 0);
+						if (r >= 0) {
+							queued -= static_cast<unsigned>(r);
+							return true;
+						}
+						if (errno != EINTR) {
+							return false;
+						}
+					}
+				}
+
+				/* calls fn(user_data, res) for every completion */
+				template<typename Fn> void reap(Fn&& fn)
+				{
+					unsigned       head = *cq_head;
+					const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+					for (; head != tail; head++) {
+						const io_uring_cqe& cqe = cqes[head & cq_mask];
+						fn(cqe.user_data, cqe.res);
+					}
+					std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+				}
+
+				/* unmaps and closes the ring, reads still in flight are cancelled by the kernel */
+				void close()
+				{
+					if (sqes && sqes != MAP_FAILED) {
+						::munmap(sqes, sqe_bytes);
+					}
+					if (cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+						::munmap(cq_ring, cq_bytes);
+					}
+					if (sq_ring && sq_ring != MAP_FAILED) {
+						::munmap(sq_ring, sq_bytes);
+					}
+					if (fd != -1) {
+						::close(fd);
+					}
+					sqes    = nullptr;
+					cq_ring = nullptr;
+					sq_ring = nullptr;
+					fd      = -1;
+				}
+
+			private:
+				int           fd        = -1;
+				void*         sq_ring   = nullptr;
+				void*         cq_ring   = nullptr;
+				io_uring_sqe* sqes      = nullptr;
+				size_t        sq_bytes  = 0;
+				size_t        cq_bytes  = 0;
+				size_t        sqe_bytes = 0;
+				unsigned*     sq_tail   = nullptr;
+				unsigned*     sq_array  = nullptr;
+				unsigned      sq_mask   = 0;
+				unsigned*     cq_head   = nullptr;
+				unsigned*     cq_tail   = nullptr;
+				unsigned      cq_mask   = 0;
+				io_uring_cqe* cqes      = nullptr;
+				unsigned      queued    = 0;
+			};
+#endif
+
+			/* walks the plan's directories in order, keeping the current one open */
+			class directory_cursor {
+			public:
+				explicit directory_cursor(const bulk_plan& plan) : plan(plan)
+				{
+				}
+
+				directory_cursor(const directory_cursor&)            = delete;
+				directory_cursor& operator=(const directory_cursor&) = delete;
+
+				~directory_cursor()
+				{
+					close_directory(fd);
+				}
+
+				int get(const uint32_t group)
+				{
+					if (group != current) {
+						close_directory(fd);
+						fd      = open_directory(plan.parents[group]);
+						current = group;
+					}
+					return fd;
+				}
+
+			private:
+				const bulk_plan& plan;
+				uint32_t         current = ~uint32_t{0};
+				int              fd      = -1;
+			};
+
+			/* reads one planned file with plain reads */
+			template<typename Fn>
+			void load_one(const std::string_view* const paths, const bulk_plan_entry& e,
+							[[maybe_unused]] directory_cursor& dirs, buffer_pool& pool, bulk_load_stats& stats, Fn& fn)
+			{
+				loaded_file file;
+				file.index = e.index;
+				file.error = e.error;
+				if (file.error || e.size == 0) {
+					stats.failed += file.error != 0;
+					stats.loaded += file.error == 0;
+					fn(file);
+					return;
+				}
+				const uint32_t b    = pool.take(e.size);
+				char* const    out  = pool.data(b);
+				uint64_t       done = 0;
+#if defined(_WIN32)
+				const std::string z(paths[e.index]);
+				const HANDLE      h = CreateFileA(z.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+								nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+				if (h == INVALID_HANDLE_VALUE) {
+					file.error = static_cast<int>(GetLastError());
+				} else {
+					while (done < e.size) {
+						DWORD      got  = 0;
+						const auto want = static_cast<DWORD>(std::min<uint64_t>(e.size - done, 1u << 30));
+						if (!ReadFile(h, out + done, want, &got, nullptr)) {
+							file.error = static_cast<int>(GetLastError());
+							break;
+						}
+						if (got == 0) {
+							break;
+						}
+						done += got;
+					}
+					CloseHandle(h);
+				}
+#else
+				const int         dir = dirs.get(e.group);
+				const std::string z(split_parent(paths[e.index]).second);
+				const int         fd  = dir == -1 ? -1 : ::openat(dir, z.c_str(), O_RDONLY | O_CLOEXEC);
+				if (fd == -1) {
+					file.error = errno;
+				} else {
+					while (done < e.size) {
+						const ssize_t got = ::pread(fd, out + done, static_cast<size_t>(e.size - done),
+										static_cast<off_t>(done));
+						if (got < 0 && errno == EINTR) {
+							continue;
+						}
+						if (got < 0) {
+							file.error = errno;
+							break;
+						}
+						if (got == 0) {
+							break;
+						}
+						done += static_cast<uint64_t>(got);
+					}
+					::close(fd);
+				}
+#endif
+				if (!file.error) {
+					file.contents = std::string_view(out, static_cast<size_t>(done));
+					stats.bytes += done;
+					stats.loaded++;
+				} else {
+					stats.failed++;
+				}
+				fn(file);
+				pool.give_back(b);
+			}
+
+			/* reads the planned files from entry first on one at a time */
+			template<typename Fn>
+			void load_sequential(const std::string_view* const paths, const bulk_plan& plan, const size_t first,
+							buffer_pool& pool, bulk_load_stats& stats, Fn& fn)
+			{
+				directory_cursor dirs(plan);
+				for (size_t i = first; i < plan.entries.size(); i++) {
+					load_one(paths, plan.entries[i], dirs, pool, stats, fn);
+				}
+			}
+
+#if defined(FILE_CPP_IO_URING_ENABLED)
+			/*
+			reads the planned files through ring, in_flight at a time. files are opened in plan order when a buffer
+			is free, a short read is continued from where it stopped. false if the ring failed before reading
+			anything, nothing has been delivered then. if it fails later, the files not delivered yet are read
+			one at a time
+			*/
+			template<typename Fn>
+			bool load_io_uring(const std::string_view* const paths, const bulk_plan& plan, buffer_pool& pool,
+							io_ring& ring, const unsigned in_flight, bulk_load_stats& stats, Fn& fn)
+			{
+				struct read_slot {
+					size_t   entry  = 0; // into plan.entries
+					int      fd     = -1;
+					uint32_t buffer = 0;
+					uint64_t done   = 0;
+					iovec    iov    = {};
+				};
+				std::vector<read_slot> slots(in_flight);
+				std::vector<uint32_t>  idle;
+				for (unsigned i = in_flight; i-- > 0;) {
+					idle.push_back(i);
+				}
+				directory_cursor dirs(plan);
+				std::string      z;
+				size_t           next      = 0;
+				bool             delivered = false;
+
+				const auto finish = [&](read_slot& s, const int error) {
+					const auto& e = plan.entries[s.entry];
+					loaded_file file;
+					file.index = e.index;
+					file.error = error;
+					if (!error) {
+						file.contents = std::string_view(pool.data(s.buffer), static_cast<size_t>(s.done));
+						stats.bytes += s.done;
+						stats.loaded++;
+					} else {
+						stats.failed++;
+					}
+					::close(s.fd);
+					delivered = true;
+					fn(file);
+					pool.give_back(s.buffer);
+					idle.push_back(static_cast<uint32_t>(&s - slots.data()));
+				};
+				const auto queue = [&](read_slot& s) {
+					const auto& e = plan.entries[s.entry];
+					s.iov.iov_base = pool.data(s.buffer) + s.done;
+					s.iov.iov_len  = static_cast<size_t>(e.size - s.done);
+					ring.read(s.fd, &s.iov, s.done, static_cast<uint64_t>(&s - slots.data()));
+				};
+
+				while (next != plan.entries.size() || idle.size() != slots.size()) {
+					// open files until every slot is busy, failures and empty files need no read
+					while (next != plan.entries.size() && !idle.empty()) {
+						const auto& e = plan.entries[next];
+						loaded_file file;
+						file.index = e.index;
+						file.error = e.error;
+						int fd     = -1;
+						if (!file.error) {
+							const int dir = dirs.get(e.group);
+							z.assign(split_parent(paths[e.index]).second);
+							fd = dir == -1 ? -1 : ::openat(dir, z.c_str(), O_RDONLY | O_CLOEXEC);
+							if (fd == -1) {
+								file.error = errno;
+							}
+						}
+						if (file.error || e.size == 0) {
+							if (fd != -1) {
+								::close(fd);
+							}
+							stats.failed += file.error != 0;
+							stats.loaded += file.error == 0;
+							delivered = true;
+							fn(file);
+							next++;
+							continue;
+						}
+						read_slot& s = slots[idle.back()];
+						idle.pop_back();
+						s.entry  = next++;
+						s.fd     = fd;
+						s.buffer = pool.take(e.size);
+						s.done   = 0;
+						queue(s);
+					}
+					if (idle.size() == slots.size()) {
+						continue;
+					}
+					if (!ring.wait()) {
+						// the kernel may still be reading into the busy buffers: tear the ring down before touching
+						// them and keep their memory out of reach of the reads that follow
+						ring.close();
+						if (!delivered) {
+							// nothing was read yet, close what is open and let the caller read another way
+							for (size_t i = 0; i < slots.size(); i++) {
+								if (std::find(idle.begin(), idle.end(), static_cast<uint32_t>(i)) == idle.end()) {
+									::close(slots[i].fd);
+									pool.abandon(slots[i].buffer);
+								}
+							}
+							return false;
+						}
+						// read the busy files and the rest the plain way
+						directory_cursor rest(plan);
+						for (size_t i = 0; i < slots.size(); i++) {
+							if (std::find(idle.begin(), idle.end(), static_cast<uint32_t>(i)) == idle.end()) {
+								::close(slots[i].fd);
+								pool.abandon(slots[i].buffer);
+								load_one(paths, plan.entries[slots[i].entry], rest, pool, stats, fn);
+							}
+						}
+						load_sequential(paths, plan, next, pool, stats, fn);
+						return true;
+					}
+					ring.reap([&](const uint64_t user_data, const int res) {
+						read_slot&  s = slots[static_cast<size_t>(user_data)];
+						const auto& e = plan.entries[s.entry];
+						if (res == -EINTR || res == -EAGAIN) {
+							queue(s);
+						} else if (res < 0) {
+							finish(s, -res);
+						} else if (res == 0 || (s.done += static_cast<uint64_t>(res)) >= e.size) {
+							finish(s, 0); // at the end, or the file shrank
+						} else {
+							queue(s);
+						}
+					});
+				}
+				return true;
+			}
+#endif
+		} // namespace detail
+
+		/*
+		reads paths[0, count) and calls fn(const loaded_file&) for each, in read order rather than listed order,
+		see the top of this file
+		*/
+		template<typename Fn>
+		bulk_load_stats load_files(const std::string_view* const paths, const size_t count, Fn&& fn,
+						const bulk_load_options& options = {})
+		{
+			bulk_load_stats     stats;
+			const unsigned      in_flight = std::clamp(options.in_flight, 1u, 4096u);
+			const auto          plan =
+							detail::plan_bulk_load(paths, count, options.physical_order, options.max_bytes);
+			detail::buffer_pool pool(in_flight);
+#if defined(FILE_CPP_IO_URING_ENABLED)
+			if (options.use_io_uring && count > 1) {
+				detail::io_ring ring(in_flight);
+				if (ring && detail::load_io_uring(paths, plan, pool, ring, in_flight, stats, fn)) {
+					stats.io_uring = true;
+					return stats;
+				}
+			}
+#endif
+			detail::load_sequential(paths, plan, 0, pool, stats, fn);
+			return stats;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,292 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "parallel.h"
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+/*
+Finds paths that are distinct on a case sensitive filesystem but name the same file on a case
+insensitive one with either separator, eg: "src/Main.cpp", "src/main.cpp" and "src\main.cpp".
+
+Paths are compared ascii case folded (fold_letter) with '\\' and '/' equal, runs of separators
+collapsed and trailing separators ignored. Identical strings are duplicates, not collisions.
+
+Every path is hashed once into a (parent, filename) key pair, the keys are partitioned by the
+parent hash so the children of a directory all land in the same bucket, and only siblings with
+equal keys are compared. Buckets are sorted and scanned in parallel. Apart from one fixed size
+record per path no memory is allocated per path.
+
+	auto report = util::utf8::find_case_collisions(paths.data(), paths.size());
+	for (size_t g = 0; g < report.size(); g++)
+		for (const auto index : report.group(g))
+			std::cout << paths[index] << '\n';
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			/* reads a path as its case folded, separator canonical characters */
+			struct folded_cursor {
+				const char* it;
+				const char* last;
+				const char* root_name_end;
+
+				folded_cursor(const std::string_view path)
+								: it(path.data()), last(path.data() + path.size()),
+								  root_name_end(find_root_name_end(it, last))
+				{
+				}
+
+				int next()
+				{
+					// next canonical character, -1 at the end
+					if (it == last) {
+						return -1;
+					}
+					const char c = *it;
+					if (!is_slash(c)) {
+						++it;
+						return (uint8_t)fold_letter(c);
+					}
+					if (it < root_name_end) { // slashes within root-name are significant
+						++it;
+						return '/';
+					}
+					const auto run = it;
+					it             = std::find_if_not(it, last, is_slash);
+					if (it == last && run != root_name_end) { // trailing separators, but not root-directory
+						return -1;
+					}
+					return '/';
+				}
+			};
+
+			inline bool folded_equal(const std::string_view lhs, const std::string_view rhs)
+			{
+				folded_cursor a = {lhs};
+				folded_cursor b = {rhs};
+				for (;;) {
+					const int ca = a.next();
+					if (ca != b.next()) {
+						return false;
+					}
+					if (ca < 0) {
+						return true;
+					}
+				}
+			}
+
+			struct collision_record {
+				uint64_t parent; // folded hash of everything before the last separator
+				uint64_t name;   // folded hash of the last component
+				uint32_t index;
+
+				bool operator<(const collision_record& other) const
+				{
+					if (parent != other.parent) {
+						return parent < other.parent;
+					}
+					if (name != other.name) {
+						return name < other.name;
+					}
+					return index < other.index;
+				}
+			};
+
+			inline collision_record collision_key(const std::string_view path, uint32_t index)
+			{
+				folded_cursor cursor = {path};
+				uint64_t      h      = hash::fnv_offset; // of the whole path so far
+				uint64_t      parent = hash::fnv_offset;
+				uint64_t      name   = hash::fnv_offset;
+				for (int c; (c = cursor.next()) >= 0;) {
+					if (c == '/') {
+						parent = h;
+						name   = hash::fnv_offset;
+					} else {
+						name = hash::fnv_byte(name, static_cast<char>(c));
+					}
+					h = hash::fnv_byte(h, static_cast<char>(c));
+				}
+				return {hash::mix(parent), name, index};
+			}
+		} // namespace detail
+
+		struct collision_options {
+			unsigned threads = 0; // 0 for one per hardware thread
+		};
+
+		struct collision_report {
+			struct range {
+				const uint32_t* first;
+				const uint32_t* last;
+
+				const uint32_t* begin() const
+				{
+					return first;
+				}
+
+				const uint32_t* end() const
+				{
+					return last;
+				}
+
+				size_t size() const
+				{
+					return static_cast<size_t>(last - first);
+				}
+			};
+
+			std::vector<uint32_t> indices; // input indices of every colliding path, grouped
+			std::vector<uint32_t> offsets; // group g is indices[offsets[g], offsets[g + 1])
+
+			size_t size() const
+			{
+				return offsets.empty() ? 0 : offsets.size() - 1;
+			}
+
+			range group(size_t g) const
+			{
+				return {indices.data() + offsets[g], indices.data() + offsets[g + 1]};
+			}
+		};
+
+		inline collision_report find_case_collisions(const std::string_view* const paths, const size_t count,
+						const collision_options opts = {})
+		{
+			// group the paths in [paths, paths + count) which collide when case and separators are ignored, groups
+			// are ordered by their smallest index and hold ascending indices
+			constexpr unsigned bucket_bits = 8;
+			constexpr size_t   buckets     = size_t{1} << bucket_bits;
+			// small inputs are not worth the threads
+			const unsigned threads = std::min(parallel::resolve_threads(opts.threads),
+							static_cast<unsigned>(std::min<size_t>(count / 4096 + 1, 1024)));
+
+			std::vector<detail::collision_record> keys(count);
+			std::vector<detail::collision_record> sorted(count);
+			std::vector<size_t>                   histogram(threads * buckets, 0);
+			const auto bucket_of = [](const detail::collision_record& r) { return r.parent >> (64 - bucket_bits); };
+
+			// hash and count, then scatter into buckets keyed by the parent hash
+			parallel::run(threads, [&](unsigned t) {
+				const auto chunk = parallel::split(count, threads, t);
+				auto       hist  = &histogram[t * buckets];
+				for (size_t i = chunk.first; i < chunk.last; i++) {
+					keys[i] = detail::collision_key(paths[i], static_cast<uint32_t>(i));
+					hist[bucket_of(keys[i])]++;
+				}
+			});
+
+			std::vector<size_t> bucket_start(buckets + 1, 0);
+			size_t              offset = 0;
+			for (size_t b = 0; b < buckets; b++) {
+				bucket_start[b] = offset;
+				for (unsigned t = 0; t < threads; t++) {
+					const auto n               = histogram[t * buckets + b];
+					histogram[t * buckets + b] = offset;
+					offset += n;
+				}
+			}
+			bucket_start[buckets] = offset;
+
+			parallel::run(threads, [&](unsigned t) {
+				const auto chunk = parallel::split(count, threads, t);
+				auto       next  = &histogram[t * buckets];
+				for (size_t i = chunk.first; i < chunk.last; i++) {
+					sorted[next[bucket_of(keys[i])]++] = keys[i];
+				}
+			});
+			keys.clear();
+			keys.shrink_to_fit();
+
+			// sort every bucket and compare the runs of equal keys
+			struct found {
+				std::vector<uint32_t> indices;
+				std::vector<uint32_t> sizes;
+			};
+			std::vector<found>  results(threads);
+			std::atomic<size_t> next_bucket = {0};
+			parallel::run(threads, [&](unsigned t) {
+				auto&                 out = results[t];
+				std::vector<uint32_t> run;
+				std::vector<uint8_t>  assigned;
+				for (size_t b; (b = next_bucket.fetch_add(1, std::memory_order_relaxed)) < buckets;) {
+					const auto first = sorted.begin() + static_cast<std::ptrdiff_t>(bucket_start[b]);
+					const auto last  = sorted.begin() + static_cast<std::ptrdiff_t>(bucket_start[b + 1]);
+					std::sort(first, last);
+					for (auto it = first; it != last;) {
+						auto run_end = it + 1;
+						while (run_end != last && run_end->parent == it->parent && run_end->name == it->name) {
+							++run_end;
+						}
+						if (run_end - it > 1) {
+							// split the run into classes of folded equal paths, equal keys are almost always equal
+							// paths but hashes can collide
+							run.clear();
+							for (auto r = it; r != run_end; ++r) {
+								run.push_back(r->index);
+							}
+							assigned.assign(run.size(), 0);
+							for (size_t i = 0; i < run.size(); i++) {
+								if (assigned[i]) {
+									continue;
+								}
+								const auto group_start = out.indices.size();
+								bool       distinct    = false;
+								out.indices.push_back(run[i]);
+								for (size_t j = i + 1; j < run.size(); j++) {
+									if (!assigned[j] && detail::folded_equal(paths[run[i]], paths[run[j]])) {
+										assigned[j] = 1;
+										distinct |= paths[run[i]] != paths[run[j]];
+										out.indices.push_back(run[j]);
+									}
+								}
+								if (distinct) {
+									out.sizes.push_back(static_cast<uint32_t>(out.indices.size() - group_start));
+								} else {
+									out.indices.resize(group_start); // only exact duplicates
+								}
+							}
+						}
+						it = run_end;
+					}
+				}
+			});
+
+			// merge, ordering the groups by their first index so the report is deterministic
+			struct group_ref {
+				const uint32_t* first;
+				uint32_t        size;
+			};
+			std::vector<group_ref> groups;
+			for (const auto& r : results) {
+				const uint32_t* it = r.indices.data();
+				for (const auto size : r.sizes) {
+					groups.push_back({it, size});
+					it += size;
+				}
+			}
+			std::sort(groups.begin(), groups.end(),
+							[](const group_ref& a, const group_ref& b) { return *a.first < *b.first; });
+
+			collision_report ret = {};
+			ret.offsets.reserve(groups.size() + 1);
+			ret.offsets.push_back(0);
+			for (const auto& g : groups) {
+				ret.indices.insert(ret.indices.end(), g.first, g.first + g.size);
+				ret.offsets.push_back(static_cast<uint32_t>(ret.indices.size()));
+			}
+			return ret;
+		}
+
+		inline collision_report find_case_collisions(
+						const std::vector<std::string_view>& paths, const collision_options opts = {})
+		{
+			return find_case_collisions(paths.data(), paths.size(), opts);
+		}
+	} // namespace utf8
+} // namespace util
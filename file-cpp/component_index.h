@@ -0,0 +1,620 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "simd.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <cstdint>
+#include <cstring>
+
+/*
+Inverted index from path components to the ids of the paths containing them, answering
+"which paths go through node_modules" without scanning every path.
+
+	util::utf8::component_index index = util::utf8::component_index::build(paths.data(), paths.size());
+	util::write_file_atomic("paths.idx", index.serialize());
+
+	util::mapped_file file("paths.idx");
+	util::utf8::component_index_view view(file.view());
+	for (const auto id : view.all_of({"node_modules", ".git"}))
+		std::cout << paths[id] << '\n';
+
+Path ids are the order paths were added in. Every component of relative_path (see components())
+is indexed, directories and filenames alike, compared exactly (case sensitive).
+
+While building, each component's ids are appended as varint deltas so the index stays about as
+small as its final form. serialize() repacks them into blocks of 128 deltas bit packed at the
+width of the largest one, laid out so four lanes decode at once with SSE2, followed by a varint
+tail for the remainder. Every block records its last id, so intersections skip whole blocks
+without decoding them.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			constexpr char     component_index_magic[8] = {'F', 'C', 'O', 'M', 'P', 'I', 'X', '1'};
+			constexpr uint32_t posting_block            = 128;
+
+			struct component_index_header {
+				char     magic[8];
+				uint32_t path_count;
+				uint32_t term_count;
+				uint64_t names_size; // padded to a multiple of 16
+				uint64_t data_size;
+			};
+
+			struct component_index_term {
+				uint64_t data_offset; // into the data section, a multiple of 16
+				uint32_t name_offset;
+				uint32_t name_size;
+				uint32_t count;       // number of ids
+				uint32_t block_count; // full blocks, the remaining count % 128 ids are varints
+			};
+
+			struct posting_block_header {
+				uint32_t base; // the id before the block, 0 for the first one
+				uint32_t last; // the last id in the block
+				uint32_t bits; // width of the packed deltas, followed by bits * 16 bytes of them
+				uint32_t reserved;
+			};
+
+			inline void put_varint(std::string& out, uint32_t v)
+			{
+				while (v >= 0x80) {
+					out.push_back(static_cast<char>(v | 0x80));
+					v >>= 7;
+				}
+				out.push_back(static_cast<char>(v));
+			}
+
+			inline uint32_t get_varint(const char*& p, const char* const end)
+			{
+				// stops at end, a truncated varint reads as what was there
+				uint32_t ret   = 0;
+				unsigned shift = 0;
+				while (p != end) {
+					const auto c = static_cast<uint8_t>(*p++);
+					ret |= static_cast<uint32_t>(c & 0x7f) << shift;
+					if (!(c & 0x80) || (shift += 7) > 28) {
+						break;
+					}
+				}
+				return ret;
+			}
+
+			inline uint32_t bit_width(uint32_t v)
+			{
+				uint32_t ret = 0;
+				for (; v; v >>= 1) {
+					ret++;
+				}
+				return ret;
+			}
+
+			/*
+			packs 128 deltas at bits each. delta i goes to lane i % 4, each lane is its own little endian
+			bit stream and word w of lane l is stored at 32 bit word w * 4 + l, so one 16 byte load holds
+			the next word of all four lanes
+			*/
+			inline void pack_block(const uint32_t* const deltas, uint32_t bits, std::string& out)
+			{
+				std::vector<uint32_t> words(size_t{bits} * 4, 0);
+				for (uint32_t lane = 0; lane < 4; lane++) {
+					uint32_t pos = 0;
+					for (uint32_t k = 0; k < posting_block / 4; k++, pos += bits) {
+						const uint32_t v    = deltas[k * 4 + lane];
+						const uint32_t word = pos / 32;
+						const uint32_t off  = pos % 32;
+						words[word * 4 + lane] |= v << off;
+						if (off + bits > 32) {
+							words[(word + 1) * 4 + lane] |= v >> (32 - off);
+						}
+					}
+				}
+				for (const auto w : words) {
+					char bytes[4];
+					std::memcpy(bytes, &w, sizeof(w));
+					out.append(bytes, sizeof(bytes));
+				}
+			}
+
+			/* decodes a block packed by pack_block into 128 ids starting after base */
+			inline void unpack_block(const char* in, uint32_t bits, uint32_t base, uint32_t* const out)
+			{
+#if defined(FILE_CPP_SSE2)
+				const __m128i mask    = _mm_set1_epi32(bits == 32 ? -1 : static_cast<int>((1u << bits) - 1));
+				__m128i       running = _mm_set1_epi32(static_cast<int>(base));
+				__m128i       word    = simd::load(in);
+				uint32_t      shift   = 0;
+				for (uint32_t k = 0; k < posting_block / 4; k++) {
+					__m128i v = _mm_srl_epi32(word, _mm_cvtsi32_si128(static_cast<int>(shift)));
+					if (shift + bits >= 32) {
+						const bool straddles = shift + bits > 32;
+						if (k + 1 < posting_block / 4 || straddles) {
+							in += 16;
+							word = simd::load(in);
+						}
+						if (straddles) {
+							v = _mm_or_si128(v, _mm_sll_epi32(word, _mm_cvtsi32_si128(static_cast<int>(32 - shift))));
+						}
+						shift = shift + bits - 32;
+					} else {
+						shift += bits;
+					}
+					// prefix sum of the four deltas, carried over from the previous four
+					v       = _mm_and_si128(v, mask);
+					v       = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+					v       = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+					v       = _mm_add_epi32(v, running);
+					running = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + k * 4), v);
+				}
+#else
+				const uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+				for (uint32_t lane = 0; lane < 4; lane++) {
+					uint32_t pos = 0;
+					for (uint32_t k = 0; k < posting_block / 4; k++, pos += bits) {
+						const uint32_t word = pos / 32;
+						const uint32_t off  = pos % 32;
+						uint32_t       lo   = 0;
+						std::memcpy(&lo, in + (word * 4 + lane) * 4, sizeof(lo));
+						uint32_t v = lo >> off;
+						if (off + bits > 32) {
+							uint32_t hi = 0;
+							std::memcpy(&hi, in + ((word + 1) * 4 + lane) * 4, sizeof(hi));
+							v |= hi << (32 - off);
+						}
+						out[k * 4 + lane] = v & mask;
+					}
+				}
+				for (uint32_t i = 0; i < posting_block; i++) {
+					base += out[i];
+					out[i] = base;
+				}
+#endif
+			}
+		} // namespace detail
+
+		/* walks the ids of one component in ascending order */
+		class posting_cursor {
+		public:
+			posting_cursor() = default;
+
+			posting_cursor(const char* const data, const char* const data_end, uint32_t count, uint32_t blocks)
+							: p(data), end(data_end), total(count), blocks_left(blocks),
+							  tail_left(count - blocks * detail::posting_block)
+			{
+				load_next();
+			}
+
+			bool done() const
+			{
+				return pos >= loaded;
+			}
+
+			uint32_t value() const
+			{
+				return buffer[pos];
+			}
+
+			/* number of ids in the whole list */
+			uint32_t size() const
+			{
+				return total;
+			}
+
+			void next()
+			{
+				if (++pos == loaded) {
+					load_next();
+				}
+			}
+
+			/* moves to the first id >= target, returns false if there is none */
+			bool seek(uint32_t target)
+			{
+				if (done()) {
+					return false;
+				}
+				if (buffer[loaded - 1] < target) {
+					// skip the blocks ending before target without decoding them
+					detail::posting_block_header header = {};
+					while (read_header(header) && header.last < target) {
+						p += sizeof(header) + size_t{header.bits} * 16;
+						last = header.last;
+						blocks_left--;
+					}
+					load_next();
+				}
+				while (!done()) {
+					pos = static_cast<uint32_t>(std::lower_bound(buffer + pos, buffer + loaded, target) - buffer);
+					if (pos < loaded) {
+						return true;
+					}
+					load_next();
+				}
+				return false;
+			}
+
+		private:
+			bool read_header(detail::posting_block_header& header)
+			{
+				// peeks at the next block, a block overrunning the data ends the list
+				if (!blocks_left) {
+					return false;
+				}
+				const auto left = static_cast<size_t>(end - p);
+				if (left >= sizeof(header)) {
+					std::memcpy(&header, p, sizeof(header));
+					if (header.bits <= 32 && left - sizeof(header) >= size_t{header.bits} * 16) {
+						return true;
+					}
+				}
+				blocks_left = 0;
+				tail_left   = 0;
+				return false;
+			}
+
+			void load_next()
+			{
+				pos    = 0;
+				loaded = 0;
+				detail::posting_block_header header = {};
+				if (read_header(header)) {
+					detail::unpack_block(p + sizeof(header), header.bits, header.base, buffer);
+					p += sizeof(header) + size_t{header.bits} * 16;
+					last   = header.last;
+					loaded = detail::posting_block;
+					blocks_left--;
+				} else if (tail_left) {
+					for (; loaded < tail_left; loaded++) {
+						last += detail::get_varint(p, end);
+						buffer[loaded] = last;
+					}
+					tail_left = 0;
+				}
+			}
+
+			const char* p           = nullptr;
+			const char* end         = nullptr;
+			uint32_t    total       = 0;
+			uint32_t    blocks_left = 0;
+			uint32_t    tail_left   = 0;
+			uint32_t    last        = 0; // last id decoded, the base of the tail
+			uint32_t    pos         = 0;
+			uint32_t    loaded      = 0;
+			uint32_t    buffer[detail::posting_block];
+		};
+
+		class component_index {
+		public:
+			/* indexes paths[0, count) as ids 0 to count - 1 */
+			static component_index build(const std::string_view* const paths, const size_t count)
+			{
+				component_index ret;
+				for (size_t i = 0; i < count; i++) {
+					ret.add(paths[i]);
+				}
+				return ret;
+			}
+
+			/* indexes path under the next id and returns it */
+			uint32_t add(const std::string_view path)
+			{
+				const auto id = paths++;
+				for (const auto name : components(path)) {
+					auto& t = terms[intern(name)];
+					if (t.count && t.last == id) { // repeated within the path
+						continue;
+					}
+					detail::put_varint(t.deltas, t.count ? id - t.last : id);
+					t.last = id;
+					t.count++;
+				}
+				return id;
+			}
+
+			size_t path_count() const
+			{
+				return paths;
+			}
+
+			size_t term_count() const
+			{
+				return terms.size();
+			}
+
+			/* the on-disk form, readable in place by component_index_view */
+			std::string serialize() const
+			{
+				std::vector<uint32_t> order(terms.size());
+				for (uint32_t i = 0; i < order.size(); i++) {
+					order[i] = i;
+				}
+				std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return name_of(a) < name_of(b); });
+
+				std::vector<detail::component_index_term> table(terms.size());
+				std::string                               sorted_names;
+				std::string                               data;
+				std::vector<uint32_t>                     deltas;
+				for (size_t i = 0; i < order.size(); i++) {
+					const auto& t    = terms[order[i]];
+					auto&       disk = table[i];
+					disk.name_offset = static_cast<uint32_t>(sorted_names.size());
+					disk.name_size   = t.name_size;
+					disk.count       = t.count;
+					disk.block_count = t.count / detail::posting_block;
+					disk.data_offset = data.size();
+					sorted_names.append(name_of(order[i]));
+
+					deltas.resize(t.count);
+					const char* p = t.deltas.data();
+					for (auto& d : deltas) {
+						d = detail::get_varint(p, t.deltas.data() + t.deltas.size());
+					}
+
+					uint32_t base = 0;
+					for (uint32_t b = 0; b < disk.block_count; b++) {
+						const auto first = deltas.data() + size_t{b} * detail::posting_block;
+						uint32_t   max   = 0;
+						uint32_t   last  = base;
+						for (uint32_t k = 0; k < detail::posting_block; k++) {
+							max = std::max(max, first[k]);
+							last += first[k];
+						}
+						const detail::posting_block_header header = {
+										base, last, std::max<uint32_t>(detail::bit_width(max), 1), 0};
+						data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+						detail::pack_block(first, header.bits, data);
+						base = last;
+					}
+					for (size_t k = size_t{disk.block_count} * detail::posting_block; k < deltas.size(); k++) {
+						detail::put_varint(data, deltas[k]);
+					}
+					data.resize((data.size() + 15) & ~size_t{15});
+				}
+				sorted_names.resize((sorted_names.size() + 15) & ~size_t{15});
+
+				detail::component_index_header header = {};
+				std::memcpy(header.magic, detail::component_index_magic, sizeof(header.magic));
+				header.path_count = paths;
+				header.term_count = static_cast<uint32_t>(terms.size());
+				header.names_size = sorted_names.size();
+				header.data_size  = data.size();
+
+				std::string ret;
+				ret.reserve(sizeof(header) + table.size() * sizeof(table[0]) + sorted_names.size() + data.size());
+				ret.append(reinterpret_cast<const char*>(&header), sizeof(header));
+				ret.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(table[0]));
+				ret.append(sorted_names);
+				ret.append(data);
+				return ret;
+			}
+
+		private:
+			struct term {
+				uint64_t    hash        = 0;
+				uint32_t    name_offset = 0;
+				uint32_t    name_size   = 0;
+				uint32_t    count       = 0;
+				uint32_t    last        = 0;
+				std::string deltas; // varint deltas of the ids, the first one from 0
+			};
+
+			std::string_view name_of(uint32_t t) const
+			{
+				return std::string_view(names.data() + terms[t].name_offset, terms[t].name_size);
+			}
+
+			uint32_t intern(const std::string_view name)
+			{
+				const auto h    = hash::fnv_range(hash::fnv_offset, name.data(), name.data() + name.size());
+				const auto mask = slots.size() - 1;
+				auto       i    = static_cast<size_t>(hash::mix(h)) & mask;
+				for (; slots[i]; i = (i + 1) & mask) {
+					const auto t = slots[i] - 1;
+					if (terms[t].hash == h && name_of(t) == name) {
+						return t;
+					}
+				}
+
+				terms.emplace_back();
+				terms.back().hash        = h;
+				terms.back().name_offset = static_cast<uint32_t>(names.size());
+				terms.back().name_size   = static_cast<uint32_t>(name.size());
+				names.append(name);
+				const auto t = static_cast<uint32_t>(terms.size() - 1);
+				if (terms.size() * 2 > slots.size()) {
+					slots.assign(slots.size() * 2, 0);
+					for (uint32_t j = 0; j < terms.size(); j++) {
+						auto k = static_cast<size_t>(hash::mix(terms[j].hash)) & (slots.size() - 1);
+						while (slots[k]) {
+							k = (k + 1) & (slots.size() - 1);
+						}
+						slots[k] = j + 1;
+					}
+				} else {
+					slots[i] = t + 1;
+				}
+				return t;
+			}
+
+			std::vector<term>     terms;
+			std::string           names;
+			std::vector<uint32_t> slots = std::vector<uint32_t>(16, 0); // term index + 1, 0 is empty
+			uint32_t              paths = 0;
+		};
+
+		/* read only view of a serialized component_index, eg: from a mapped_file */
+		class component_index_view {
+		public:
+			explicit component_index_view(const std::string_view image)
+			{
+				detail::component_index_header header = {};
+				if (image.size() < sizeof(header)) {
+					return;
+				}
+				std::memcpy(&header, image.data(), sizeof(header));
+				const size_t table_size = size_t{header.term_count} * sizeof(detail::component_index_term);
+				if (std::memcmp(header.magic, detail::component_index_magic, sizeof(header.magic)) != 0 ||
+								image.size() != sizeof(header) + table_size + header.names_size + header.data_size) {
+					return;
+				}
+				const auto table = reinterpret_cast<const detail::component_index_term*>(image.data() + sizeof(header));
+				for (uint32_t i = 0; i < header.term_count; i++) {
+					const auto& t      = table[i];
+					const auto  blocks = uint64_t{t.block_count} * detail::posting_block;
+					if (t.count < blocks || t.count - blocks >= detail::posting_block ||
+									uint64_t{t.name_offset} + t.name_size > header.names_size ||
+									t.data_offset > header.data_size) {
+						return;
+					}
+					// a block takes at least 32 bytes and a varint at least one
+					if (uint64_t{t.block_count} * 32 + (t.count - blocks) > header.data_size - t.data_offset) {
+						return;
+					}
+				}
+				terms    = table;
+				names    = image.data() + sizeof(header) + table_size;
+				data     = names + header.names_size;
+				data_end = data + header.data_size;
+				count    = header.term_count;
+				paths    = header.path_count;
+			}
+
+			bool valid() const
+			{
+				return terms != nullptr;
+			}
+
+			size_t path_count() const
+			{
+				return paths;
+			}
+
+			size_t term_count() const
+			{
+				return count;
+			}
+
+			/* ids of the paths with a component equal to name, a cursor that is already done if there are none */
+			posting_cursor find(const std::string_view name) const
+			{
+				uint32_t first = 0;
+				uint32_t last  = count;
+				while (first < last) {
+					const auto mid = first + (last - first) / 2;
+					const auto c   = name_of(mid).compare(name);
+					if (c == 0) {
+						const auto& t = terms[mid];
+						return posting_cursor(data + t.data_offset, data_end, t.count, t.block_count);
+					}
+					if (c < 0) {
+						first = mid + 1;
+					} else {
+						last = mid;
+					}
+				}
+				return {};
+			}
+
+			/* ids of the paths containing every one of names, ascending */
+			std::vector<uint32_t> all_of(const std::string_view* const names_first, const size_t names_count) const
+			{
+				std::vector<uint32_t> ret;
+				if (!names_count) {
+					return ret;
+				}
+				std::vector<posting_cursor> cursors;
+				cursors.reserve(names_count);
+				for (size_t i = 0; i < names_count; i++) {
+					cursors.push_back(find(names_first[i]));
+					if (cursors.back().done()) {
+						return ret;
+					}
+				}
+				// drive the intersection from the shortest list, the others only seek
+				std::sort(cursors.begin(), cursors.end(),
+								[](const posting_cursor& a, const posting_cursor& b) { return a.size() < b.size(); });
+
+				auto& lead = cursors[0];
+				while (!lead.done()) {
+					const auto id     = lead.value();
+					uint32_t   target = id;
+					for (size_t i = 1; i < cursors.size() && target == id; i++) {
+						if (!cursors[i].seek(id)) {
+							return ret;
+						}
+						target = cursors[i].value();
+					}
+					if (target == id) {
+						ret.push_back(id);
+						lead.next();
+					} else {
+						lead.seek(target);
+					}
+				}
+				return ret;
+			}
+
+			std::vector<uint32_t> all_of(const std::initializer_list<std::string_view> names_list) const
+			{
+				return all_of(names_list.begin(), names_list.size());
+			}
+
+			/* ids of the paths containing any of names, ascending */
+			std::vector<uint32_t> any_of(const std::string_view* const names_first, const size_t names_count) const
+			{
+				std::vector<uint32_t>       ret;
+				std::vector<posting_cursor> cursors;
+				cursors.reserve(names_count);
+				for (size_t i = 0; i < names_count; i++) {
+					cursors.push_back(find(names_first[i]));
+					if (cursors.back().done()) {
+						cursors.pop_back();
+					}
+				}
+				while (!cursors.empty()) {
+					uint32_t id = cursors[0].value();
+					for (const auto& c : cursors) {
+						id = std::min(id, c.value());
+					}
+					ret.push_back(id);
+					for (size_t i = 0; i < cursors.size();) {
+						if (cursors[i].value() == id) {
+							cursors[i].next();
+						}
+						if (cursors[i].done()) {
+							cursors[i] = cursors.back();
+							cursors.pop_back();
+						} else {
+							i++;
+						}
+					}
+				}
+				return ret;
+			}
+
+			std::vector<uint32_t> any_of(const std::initializer_list<std::string_view> names_list) const
+			{
+				return any_of(names_list.begin(), names_list.size());
+			}
+
+		private:
+			std::string_view name_of(uint32_t t) const
+			{
+				return std::string_view(names + terms[t].name_offset, terms[t].name_size);
+			}
+
+			const detail::component_index_term* terms    = nullptr;
+			const char*                         names    = nullptr;
+			const char*                         data     = nullptr;
+			const char*                         data_end = nullptr;
+			uint32_t                            count    = 0;
+			uint32_t                            paths    = 0;
+		};
+	} // namespace utf8
+} // namespace util
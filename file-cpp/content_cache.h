@@ -0,0 +1,455 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "mount_table.h"
+#include "trace.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+/*
+Cache of file contents keyed by path, for servers that keep reading the same files. Small files
+are read into buffers, larger ones are memory mapped, all under one byte budget.
+
+	util::utf8::content_cache cache({.capacity = 512 << 20});
+	if (auto file = cache.get("/srv/www/index.html"))
+		send(file->view());
+
+Paths are keyed by their canonical form (see mount_table.h): '\\' and '/' are equal and runs of
+separators count as one, so "/srv//www/a" and "/srv/www/a" share an entry. "." and ".." are not
+resolved. The canonical form is hashed in place, a lookup does not allocate.
+
+Entries remember the device, inode, size and mtime they were loaded with. A hit younger than
+revalidate_after is returned without touching the filesystem at all, an older one is stat()ed and
+reloaded if any of those changed. Keys are spread over independently locked shards, hits only take
+a shared lock, and each shard evicts with CLOCK: entries start unreferenced and a hit marks them, so
+files read once are evicted before files that are read again.
+
+Handles keep their contents alive (and mapped) after eviction until the last one is released.
+*/
+namespace util {
+	namespace utf8 {
+		struct file_identity {
+			uint64_t device   = 0;
+			uint64_t inode    = 0;
+			uint64_t size     = 0;
+			int64_t  mtime_ns = 0;
+
+			bool operator==(const file_identity& other) const
+			{
+				return device == other.device && inode == other.inode && size == other.size &&
+								mtime_ns == other.mtime_ns;
+			}
+
+			bool operator!=(const file_identity& other) const
+			{
+				return !(*this == other);
+			}
+		};
+
+		/* identity of the regular file at path, false if it does not exist or is not a regular file */
+		inline bool stat_identity(const char* const path, file_identity& out)
+		{
+#if defined(_WIN32)
+			WIN32_FILE_ATTRIBUTE_DATA data = {};
+			if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) ||
+							(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				return false;
+			}
+			// no inode without opening the file, size and the write time have to do
+			const uint64_t ticks = (uint64_t{data.ftLastWriteTime.dwHighDateTime} << 32) |
+							data.ftLastWriteTime.dwLowDateTime;
+			out.device   = 0;
+			out.inode    = 0;
+			out.size     = (uint64_t{data.nFileSizeHigh} << 32) | data.nFileSizeLow;
+			out.mtime_ns = static_cast<int64_t>(ticks * 100);
+			return true;
+#else
+			struct stat st = {};
+			if (::stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+				return false;
+			}
+			out.device = static_cast<uint64_t>(st.st_dev);
+			out.inode  = static_cast<uint64_t>(st.st_ino);
+			out.size   = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+			out.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+			out.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+			return true;
+#endif
+		}
+
+		/* the contents of one file as loaded by content_cache */
+		class cached_content {
+		public:
+			std::string_view view() const
+			{
+				return mapping ? mapping.view() : std::string_view(buffer);
+			}
+
+			size_t size() const
+			{
+				return view().size();
+			}
+
+			bool mapped() const
+			{
+				return static_cast<bool>(mapping);
+			}
+
+			const file_identity& identity() const
+			{
+				return id;
+			}
+
+		private:
+			friend class content_cache;
+
+			file_identity id;
+			mapped_file   mapping;
+			std::string   buffer;
+		};
+
+		using content_handle = std::shared_ptr<const cached_content>;
+
+		struct content_cache_options {
+			size_t                    capacity         = size_t{256} << 20; // bytes of contents and keys
+			unsigned                  shards           = 16;                // rounded up to a power of two
+			size_t                    map_threshold    = size_t{64} << 10;  // files at least this big are mapped
+			std::chrono::milliseconds revalidate_after = std::chrono::milliseconds(1000);
+		};
+
+		struct content_cache_stats {
+			uint64_t hits          = 0; // served without a syscall
+			uint64_t revalidations = 0; // stat()ed and still current
+			uint64_t misses        = 0; // loaded (or reloaded) from disk
+			uint64_t evictions     = 0;
+			size_t   bytes         = 0;
+			size_t   entries       = 0;
+		};
+
+		class content_cache {
+		public:
+			explicit content_cache(const content_cache_options opts = {}) : options(opts)
+			{
+				unsigned count = 1;
+				while (count < opts.shards && count < 1024) {
+					count *= 2;
+				}
+				shards.reset(new shard[count]);
+				shard_count    = count;
+				shard_capacity = opts.capacity / count;
+			}
+
+			content_cache(const content_cache&) = delete;
+			content_cache& operator=(const content_cache&) = delete;
+
+			/* contents of the file at path, loading it on a miss. nullptr if it cannot be read */
+			content_handle get(const std::string_view path)
+			{
+				const auto first = path.data();
+				const auto last  = first + path.size();
+				const auto h     = key_hash(first, last);
+				auto&      s     = shard_of(h);
+				const auto now   = std::chrono::steady_clock::now().time_since_epoch().count();
+
+				content_handle stale;
+				{
+					std::shared_lock<std::shared_mutex> lock(s.mutex);
+					if (const auto e = s.find(h, first, last)) {
+						if (now - e->checked.load(std::memory_order_relaxed) < revalidate_ticks()) {
+							e->referenced.store(1, std::memory_order_relaxed);
+							s.hits.fetch_add(1, std::memory_order_relaxed);
+							FILE_CPP_PROBE2(cache_hit, first, path.size());
+							return e->content;
+						}
+						stale = e->content;
+					}
+				}
+
+				uint32_t    depth = 0;
+				std::string key   = detail::canonical_prefix(path, depth);
+				if (key.empty()) {
+					return nullptr;
+				}
+				if (stale) {
+					file_identity id;
+					if (stat_identity(key.c_str(), id) && id == stale->identity()) {
+						std::shared_lock<std::shared_mutex> lock(s.mutex);
+						if (const auto e = s.find(h, first, last); e && e->content == stale) {
+							e->checked.store(now, std::memory_order_relaxed);
+							e->referenced.store(1, std::memory_order_relaxed);
+						}
+						s.revalidations.fetch_add(1, std::memory_order_relaxed);
+						FILE_CPP_PROBE2(cache_revalidate, first, path.size());
+						return stale;
+					}
+				}
+
+				s.misses.fetch_add(1, std::memory_order_relaxed);
+				bool       stable  = false;
+				const auto content = load(key, stable);
+				FILE_CPP_PROBE3(cache_miss, first, path.size(), content ? content->size() : 0);
+				if (!content || !stable) {
+					if (!content) {
+						invalidate(path);
+					}
+					return content; // changing while being read, not worth caching
+				}
+
+				std::unique_lock<std::shared_mutex> lock(s.mutex);
+				s.insert(std::move(key), h, content, now, shard_capacity);
+				return content;
+			}
+
+			/* drops the entry for path, if any */
+			void invalidate(const std::string_view path)
+			{
+				const auto first = path.data();
+				const auto last  = first + path.size();
+				const auto h     = key_hash(first, last);
+				auto&      s     = shard_of(h);
+
+				std::unique_lock<std::shared_mutex> lock(s.mutex);
+				if (const auto e = s.find(h, first, last)) {
+					s.erase(e);
+				}
+			}
+
+			void clear()
+			{
+				for (size_t i = 0; i < shard_count; i++) {
+					std::unique_lock<std::shared_mutex> lock(shards[i].mutex);
+					shards[i].reset();
+				}
+			}
+
+			content_cache_stats stats() const
+			{
+				content_cache_stats ret = {};
+				for (size_t i = 0; i < shard_count; i++) {
+					auto& s = shards[i];
+					ret.hits += s.hits.load(std::memory_order_relaxed);
+					ret.revalidations += s.revalidations.load(std::memory_order_relaxed);
+					ret.misses += s.misses.load(std::memory_order_relaxed);
+					ret.evictions += s.evictions.load(std::memory_order_relaxed);
+
+					std::shared_lock<std::shared_mutex> lock(s.mutex);
+					ret.bytes += s.bytes;
+					ret.entries += s.entries.size();
+				}
+				return ret;
+			}
+
+		private:
+			struct entry {
+				std::string          key; // canonical path
+				uint64_t             hash;
+				size_t               cost;
+				content_handle       content;
+				std::atomic<int64_t> checked;        // steady_clock ticks of the last load or stat
+				std::atomic<uint8_t> referenced = 0; // CLOCK bit, set by hits
+			};
+
+			struct alignas(64) shard {
+				mutable std::shared_mutex           mutex;
+				std::vector<std::unique_ptr<entry>> entries; // in CLOCK order
+				std::vector<uint32_t>               slots = std::vector<uint32_t>(16, 0); // entry index + 1
+				size_t                              hand  = 0;
+				size_t                              bytes = 0;
+
+				std::atomic<uint64_t> hits          = 0;
+				std::atomic<uint64_t> revalidations = 0;
+				std::atomic<uint64_t> misses        = 0;
+				std::atomic<uint64_t> evictions     = 0;
+
+				size_t home(uint64_t h) const
+				{
+					return static_cast<size_t>(hash::mix(h)) & (slots.size() - 1);
+				}
+
+				entry* find(uint64_t h, const char* const first, const char* const last) const
+				{
+					const auto mask = slots.size() - 1;
+					for (auto i = home(h); slots[i]; i = (i + 1) & mask) {
+						const auto& e = entries[slots[i] - 1];
+						if (e->hash == h && detail::canonical_equal(e->key, first, last)) {
+							return e.get();
+						}
+					}
+					return nullptr;
+				}
+
+				size_t slot_of(const entry* const e) const
+				{
+					const auto mask = slots.size() - 1;
+					auto       i    = home(e->hash);
+					while (entries[slots[i] - 1].get() != e) {
+						i = (i + 1) & mask;
+					}
+					return i;
+				}
+
+				void insert(std::string key, uint64_t h, const content_handle& content, int64_t now, size_t capacity)
+				{
+					const auto cost = content->size() + key.size() + sizeof(entry);
+					if (const auto e = find(h, key.data(), key.data() + key.size())) {
+						erase(e); // reloaded, possibly by another thread in the meantime
+					}
+					if (cost > capacity) {
+						return;
+					}
+					while (bytes + cost > capacity) {
+						evict();
+					}
+
+					auto e     = std::make_unique<entry>();
+					e->key     = std::move(key);
+					e->hash    = h;
+					e->cost    = cost;
+					e->content = content;
+					e->checked.store(now, std::memory_order_relaxed);
+					bytes += cost;
+					entries.push_back(std::move(e));
+					if (entries.size() * 2 > slots.size()) {
+						slots.assign(slots.size() * 2, 0);
+						for (size_t i = 0; i < entries.size(); i++) {
+							place(i);
+						}
+					} else {
+						place(entries.size() - 1);
+					}
+				}
+
+				void place(size_t index)
+				{
+					const auto mask = slots.size() - 1;
+					auto       i    = home(entries[index]->hash);
+					while (slots[i]) {
+						i = (i + 1) & mask;
+					}
+					slots[i] = static_cast<uint32_t>(index + 1);
+				}
+
+				void evict()
+				{
+					// advance the hand, giving referenced entries a second chance
+					for (;;) {
+						if (hand >= entries.size()) {
+							hand = 0;
+						}
+						auto& e = entries[hand];
+						if (!e->referenced.exchange(0, std::memory_order_relaxed)) {
+							evictions.fetch_add(1, std::memory_order_relaxed);
+							erase(e.get());
+							return;
+						}
+						hand++;
+					}
+				}
+
+				void erase(entry* const e)
+				{
+					// backward shift deletion keeps the probe sequences intact without tombstones
+					const auto mask  = slots.size() - 1;
+					auto       i     = slot_of(e);
+					const auto index = slots[i] - 1;
+					for (auto j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+						const auto h = home(entries[slots[j] - 1]->hash);
+						if (((j - h) & mask) >= ((j - i) & mask)) {
+							slots[i] = slots[j];
+							i        = j;
+						}
+					}
+					slots[i] = 0;
+
+					// swap the last entry into the hole so the CLOCK order stays dense
+					bytes -= e->cost;
+					const auto last = entries.size() - 1;
+					if (index != last) {
+						slots[slot_of(entries[last].get())] = index + 1;
+						entries[index]                      = std::move(entries[last]);
+					}
+					entries.pop_back();
+				}
+
+				void reset()
+				{
+					entries.clear();
+					slots.assign(16, 0);
+					hand  = 0;
+					bytes = 0;
+				}
+			};
+
+			static uint64_t key_hash(const char* const first, const char* const last)
+			{
+				uint64_t ret = 0;
+				detail::walk_prefixes(first, last, UINT32_MAX, [&](uint32_t, uint64_t h, const char*) {
+					ret = h;
+					return true;
+				});
+				return ret;
+			}
+
+			shard& shard_of(uint64_t h) const
+			{
+				// the slots use the low bits of mix(h), pick the shard from the high ones
+				return shards[static_cast<size_t>(hash::mix(h) >> 48) & (shard_count - 1)];
+			}
+
+			int64_t revalidate_ticks() const
+			{
+				using ticks = std::chrono::steady_clock::duration;
+				return std::chrono::duration_cast<ticks>(options.revalidate_after).count();
+			}
+
+			content_handle load(const std::string& path, bool& stable) const
+			{
+				// read or map path, stable is set when its identity did not change while doing so
+				stable = false;
+				file_identity before;
+				if (!stat_identity(path.c_str(), before)) {
+					return nullptr;
+				}
+
+				auto ret = std::make_shared<cached_content>();
+				if (before.size >= options.map_threshold) {
+					if (!ret->mapping.open(path.c_str())) {
+						return nullptr;
+					}
+				} else {
+					FILE* const file = std::fopen(path.c_str(), "rb");
+					if (!file) {
+						return nullptr;
+					}
+					ret->buffer.resize(static_cast<size_t>(before.size));
+					const auto n = std::fread(ret->buffer.data(), 1, ret->buffer.size(), file);
+					ret->buffer.resize(n);
+					std::fclose(file);
+				}
+
+				file_identity after;
+				ret->id = before;
+				stable  = stat_identity(path.c_str(), after) && after == before && ret->size() == before.size;
+				return ret;
+			}
+
+			content_cache_options    options;
+			std::unique_ptr<shard[]> shards;
+			size_t                   shard_count    = 0;
+			size_t                   shard_capacity = 0;
+		};
+	} // namespace utf8
+} // namespace util
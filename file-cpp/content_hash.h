@@ -0,0 +1,295 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "parallel.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Hashes the contents of every file in a listing, for dedupe and cache keys.
+
+	auto hashes = util::utf8::hash_files(paths.data(), paths.size());
+	// next time, only files whose size or mtime changed are read again
+	util::utf8::content_hash_options options;
+	options.previous = hashes.data();
+	hashes = util::utf8::hash_files(paths.data(), paths.size(), options);
+
+The result is one file_hash per path, in the order of paths. The hash is XXH64 (see hash.h) of the
+whole contents. With previous, a column aligned with paths as an earlier call returned it, a file
+keeps its previous hash without being read when the entry at its position is the same file (device
+and inode) with the same size and mtime. A listing that changed order or had files inserted only
+has the files that moved hashed again, it never hands one file's hash to another.
+
+Threads take blocks of paths from a shared counter, so a thread stuck on large files does not hold
+up the rest. Each thread keeps a few parent directories open and stats and opens files relative to
+them. Files are read chunk_size at a time into a buffer of the thread and hashed as they go, a
+file truncated while it is read is hashed up to where it ended.
+*/
+namespace util {
+	namespace utf8 {
+		struct file_hash {
+			uint64_t hash     = 0;
+			uint64_t size     = 0;
+			int64_t  mtime_ns = 0;
+			uint64_t device   = 0;     // the volume serial number on Windows
+			uint64_t inode    = 0;     // the file index on Windows
+			int      error    = 0;     // errno (GetLastError() on Windows), the other fields are 0 then
+			bool     reused   = false; // copied from previous rather than read
+		};
+
+		struct content_hash_options {
+			unsigned         threads    = 0;       // 0 for one per hardware thread
+			size_t           chunk_size = 1 << 20; // bytes read at once, files are hashed as they are read
+			const file_hash* previous   = nullptr; // aligned with paths, or null
+		};
+
+		namespace detail {
+			/* the last few parent directories a thread opened, replaced round robin */
+			class dirfd_cache {
+			public:
+				static constexpr size_t slots = 8;
+
+				dirfd_cache() = default;
+
+				dirfd_cache(const dirfd_cache&)            = delete;
+				dirfd_cache& operator=(const dirfd_cache&) = delete;
+
+				~dirfd_cache()
+				{
+#if !defined(_WIN32)
+					for (const auto& e : entries) {
+						if (e.fd >= 0) {
+							::close(e.fd);
+						}
+					}
+#endif
+				}
+
+#if !defined(_WIN32)
+				/* a descriptor for parent, AT_FDCWD for "", -1 with errno set if it cannot be opened */
+				int get(const std::string_view parent)
+				{
+					if (parent.empty()) {
+						return AT_FDCWD;
+					}
+					for (const auto& e : entries) {
+						if (e.fd >= 0 && e.parent == parent) {
+							return e.fd;
+						}
+					}
+					auto& e = entries[next++ % slots];
+					if (e.fd >= 0) {
+						::close(e.fd);
+					}
+					e.parent.assign(parent);
+					e.fd = ::open(e.parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+					return e.fd;
+				}
+#endif
+
+			private:
+				struct entry {
+					std::string parent;
+					int         fd = -1;
+				};
+
+				entry  entries[slots];
+				size_t next = 0;
+			};
+
+			/* whether previous, read at the same position of an earlier listing, is this file unchanged */
+			inline bool same_file(const file_hash& previous, const file_hash& now)
+			{
+				return !previous.error && previous.device == now.device && previous.inode == now.inode &&
+								previous.size == now.size && previous.mtime_ns == now.mtime_ns;
+			}
+
+			/*
+			hashes the file at path into out, which holds the previous result if there is one. reads are bounded by
+			the size stat() saw, a file that shrank since is hashed up to its end
+			*/
+			inline void hash_one_file(const std::string_view path, file_hash& out, const bool has_previous,
+							const size_t chunk_size, dirfd_cache& dirs, std::vector<char>& buffer, std::string& z)
+			{
+				const file_hash previous = has_previous ? out : file_hash{};
+				out                      = {};
+				hash::xxh64_state state;
+				uint64_t          done  = 0;
+				int               error = 0;
+#if defined(_WIN32)
+				(void)dirs;
+				z.assign(path);
+				const HANDLE file = CreateFileA(z.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+								OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+				if (file == INVALID_HANDLE_VALUE) {
+					out.error = static_cast<int>(GetLastError());
+					return;
+				}
+				BY_HANDLE_FILE_INFORMATION info = {};
+				if (!GetFileInformationByHandle(file, &info)) {
+					out.error = static_cast<int>(GetLastError());
+					CloseHandle(file);
+					return;
+				}
+				const uint64_t ticks = (uint64_t{info.ftLastWriteTime.dwHighDateTime} << 32) |
+								info.ftLastWriteTime.dwLowDateTime;
+				out.device   = info.dwVolumeSerialNumber;
+				out.inode    = (uint64_t{info.nFileIndexHigh} << 32) | info.nFileIndexLow;
+				out.size     = (uint64_t{info.nFileSizeHigh} << 32) | info.nFileSizeLow;
+				out.mtime_ns = static_cast<int64_t>(ticks * 100);
+				if (has_previous && same_file(previous, out)) {
+					out.hash   = previous.hash;
+					out.reused = true;
+					CloseHandle(file);
+					return;
+				}
+				buffer.resize(std::max(buffer.size(), static_cast<size_t>(std::min<uint64_t>(out.size, chunk_size))));
+				while (done < out.size) {
+					DWORD      got  = 0;
+					const auto want = static_cast<DWORD>(std::min<uint64_t>(out.size - done, chunk_size));
+					if (!ReadFile(file, buffer.data(), want, &got, nullptr)) {
+						error = static_cast<int>(GetLastError());
+						break;
+					}
+					if (got == 0) {
+						break;
+					}
+					state.update(buffer.data(), got);
+					done += got;
+				}
+				CloseHandle(file);
+#else
+				// split into the parent, opened once per thread, and the name to open relative to it
+				const char* const data   = path.data();
+				const char* const tail   = data + path.size();
+				const char* const name   = find_filename(data, tail);
+				const char* const root   = find_relative_path(data, tail);
+				const char*       parent = name;
+				while (parent != root && is_slash(parent[-1])) {
+					--parent;
+				}
+				const int dir = dirs.get(std::string_view(data, static_cast<size_t>(parent - data)));
+				if (dir == -1) {
+					out.error = errno;
+					return;
+				}
+				z.assign(name, static_cast<size_t>(tail - name));
+
+				struct stat st = {};
+				if (::fstatat(dir, z.c_str(), &st, 0) != 0) {
+					out.error = errno;
+					return;
+				}
+				if (S_ISDIR(st.st_mode)) {
+					out.error = EISDIR;
+					return;
+				}
+				out.device = static_cast<uint64_t>(st.st_dev);
+				out.inode  = static_cast<uint64_t>(st.st_ino);
+				out.size   = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+				out.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+				out.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+				if (has_previous && same_file(previous, out)) {
+					out.hash   = previous.hash;
+					out.reused = true;
+					return;
+				}
+
+				const int fd = ::openat(dir, z.c_str(), O_RDONLY | O_CLOEXEC);
+				if (fd == -1) {
+					const int e = errno;
+					out         = {};
+					out.error   = e;
+					return;
+				}
+#if defined(POSIX_FADV_SEQUENTIAL)
+				if (out.size > chunk_size) {
+					::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+				}
+#endif
+				// read rather than mapped: a file truncated under a mapping raises SIGBUS, under read() it ends early
+				buffer.resize(std::max(buffer.size(), static_cast<size_t>(std::min<uint64_t>(out.size, chunk_size))));
+				while (done < out.size) {
+					const auto    want = static_cast<size_t>(std::min<uint64_t>(out.size - done, chunk_size));
+					const ssize_t got  = ::pread(fd, buffer.data(), want, static_cast<off_t>(done));
+					if (got < 0 && errno == EINTR) {
+						continue;
+					}
+					if (got < 0) {
+						error = errno;
+						break;
+					}
+					if (got == 0) {
+						break;
+					}
+					state.update(buffer.data(), static_cast<size_t>(got));
+					done += static_cast<uint64_t>(got);
+				}
+				::close(fd);
+#endif
+				if (error) {
+					out       = {};
+					out.error = error;
+					return;
+				}
+				out.size = done;
+				out.hash = state.digest();
+			}
+		} // namespace detail
+
+		/* hashes the files at paths[0, count), see the top of this file */
+		inline std::vector<file_hash> hash_files(const std::string_view* const paths, const size_t count,
+						const content_hash_options& options = {})
+		{
+			// blocks small enough to even out files of very different sizes, large enough to keep a thread in
+			// one directory for a while
+			constexpr size_t block = 64;
+
+			std::vector<file_hash> ret(count);
+			if (options.previous) {
+				std::copy(options.previous, options.previous + count, ret.begin());
+			}
+			const unsigned n = std::min(parallel::resolve_threads(options.threads),
+							static_cast<unsigned>(std::min<size_t>(count / block + 1, 1024)));
+
+			std::atomic<size_t> next_block{0};
+			parallel::run(n, [&](unsigned) {
+				detail::dirfd_cache dirs;
+				std::vector<char>   buffer;
+				std::string         z;
+				for (size_t b; (b = next_block.fetch_add(1, std::memory_order_relaxed)) * block < count;) {
+					const size_t last = std::min(count, (b + 1) * block);
+					for (size_t i = b * block; i < last; i++) {
+						detail::hash_one_file(paths[i], ret[i], options.previous != nullptr,
+										std::max<size_t>(options.chunk_size, 4096), dirs, buffer, z);
+					}
+				}
+			});
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
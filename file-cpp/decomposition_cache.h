@@ -0,0 +1,210 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Remembers the decomposition of recently seen paths, for inputs such as access logs where the same
+paths come back over and over.
+
+	auto& cache = util::utf8::thread_decomposition_cache();
+	for (const auto line : log) {
+		const auto path  = request_path(line);
+		const auto parts = cache.get(path);
+		count(parts.parent_path(path), parts.extension(path));
+	}
+	report(cache.hits(), cache.misses());
+
+A path_decomposition holds where each part of a path starts and ends, as the offsets the
+functions of file.h would return, so the parts are views into the path it was made from (or an
+identical one).
+
+The cache is set associative: a path's hash picks a set of 4 ways, a hit also compares the bytes
+and an insert replaces the least recently used way. Each cache belongs to one thread, see
+thread_decomposition_cache(). Whether it pays off depends on how often paths repeat within the
+cache's capacity, which hits() and misses() tell.
+*/
+namespace util {
+	namespace utf8 {
+		struct path_decomposition {
+			uint32_t root_name_end    = 0; // also where root_directory starts
+			uint32_t relative_offset  = 0; // end of root_path, start of relative_path
+			uint32_t parent_end       = 0;
+			uint32_t filename_offset  = 0;
+			uint32_t extension_offset = 0; // start of extension, end of stem
+			uint32_t stream_offset    = 0; // of a trailing alternate data stream (:name), or the path's end
+
+			std::string_view root_name(const std::string_view path) const
+			{
+				return path.substr(0, root_name_end);
+			}
+
+			std::string_view root_directory(const std::string_view path) const
+			{
+				return path.substr(root_name_end, relative_offset - root_name_end);
+			}
+
+			std::string_view root_path(const std::string_view path) const
+			{
+				return path.substr(0, relative_offset);
+			}
+
+			std::string_view relative_path(const std::string_view path) const
+			{
+				return path.substr(relative_offset);
+			}
+
+			std::string_view parent_path(const std::string_view path) const
+			{
+				return path.substr(0, parent_end);
+			}
+
+			std::string_view filename(const std::string_view path) const
+			{
+				return path.substr(filename_offset);
+			}
+
+			std::string_view stem(const std::string_view path) const
+			{
+				return path.substr(filename_offset, extension_offset - filename_offset);
+			}
+
+			/* as extension(), the stream is excluded */
+			std::string_view extension(const std::string_view path) const
+			{
+				return path.substr(extension_offset, stream_offset - extension_offset);
+			}
+		};
+
+		/* every part of path in one pass, path must be shorter than 4 GiB */
+		inline path_decomposition decompose(const std::string_view path)
+		{
+			const char* const data          = path.data();
+			const char* const tail          = data + path.size();
+			const char* const root_name_end = find_root_name_end(data, tail);
+			const char*       relative      = root_name_end;
+			while (relative != tail && is_slash(*relative)) {
+				++relative;
+			}
+			const char* name = tail;
+			while (name != relative && !is_slash(name[-1])) {
+				--name;
+			}
+			const char* parent_end = name;
+			while (parent_end != relative && is_slash(parent_end[-1])) {
+				--parent_end;
+			}
+			const char* const ads = std::find(name, tail, ':');
+			const char* const ext = find_extension(name, ads);
+
+			path_decomposition ret;
+			ret.root_name_end    = static_cast<uint32_t>(root_name_end - data);
+			ret.relative_offset  = static_cast<uint32_t>(relative - data);
+			ret.parent_end       = static_cast<uint32_t>(parent_end - data);
+			ret.filename_offset  = static_cast<uint32_t>(name - data);
+			ret.extension_offset = static_cast<uint32_t>(ext - data);
+			ret.stream_offset    = static_cast<uint32_t>(ads - data);
+			return ret;
+		}
+
+		class decomposition_cache {
+		public:
+			static constexpr size_t ways = 4;
+
+			/* sets is rounded up to a power of two, the cache holds sets * 4 paths */
+			explicit decomposition_cache(const size_t sets = 4096)
+							: tags(std::bit_ceil(std::max<size_t>(sets, 1)) * ways), used(tags.size()),
+							  entries(tags.size()), mask(tags.size() / ways - 1)
+			{
+			}
+
+			/* the decomposition of path, from the cache if it holds path */
+			path_decomposition get(const std::string_view path)
+			{
+				const uint64_t h     = key(path);
+				const size_t   set   = static_cast<size_t>(h & mask) * ways;
+				size_t         least = set;
+				clock++;
+				// the tags of a set share a cache line, the entry is only touched to verify a matching tag
+				for (size_t i = set; i < set + ways; i++) {
+					if (tags[i] == h) {
+						entry& e = entries[i];
+						if (e.path.size() == path.size() && std::memcmp(e.path.data(), path.data(), path.size()) == 0) {
+							hit_count++;
+							used[i] = clock;
+							return e.parts;
+						}
+					}
+					if (used[i] < used[least]) {
+						least = i;
+					}
+				}
+				miss_count++;
+				tags[least]  = h;
+				used[least]  = clock;
+				entry& e     = entries[least];
+				e.parts      = decompose(path);
+				e.path.assign(path);
+				return e.parts;
+			}
+
+			uint64_t hits() const
+			{
+				return hit_count;
+			}
+
+			uint64_t misses() const
+			{
+				return miss_count;
+			}
+
+			/* forgets every path and resets the counters */
+			void clear()
+			{
+				std::fill(tags.begin(), tags.end(), 0);
+				std::fill(used.begin(), used.end(), 0);
+				for (auto& e : entries) {
+					e = {};
+				}
+				clock      = 0;
+				hit_count  = 0;
+				miss_count = 0;
+			}
+
+		private:
+			struct entry {
+				path_decomposition parts;
+				std::string        path;
+			};
+
+			static uint64_t key(const std::string_view path)
+			{
+				// the whole path, paths in logs often differ only in the middle (/users/<id>/settings/profile.json)
+				return hash::bytes(path.data(), path.size());
+			}
+
+			std::vector<uint64_t> tags; // key of each way, sets of 4
+			std::vector<uint64_t> used; // clock of each way's last hit or insert, 0 when empty
+			std::vector<entry>    entries;
+			uint64_t              mask       = 0;
+			uint64_t              clock      = 0;
+			uint64_t              hit_count  = 0;
+			uint64_t              miss_count = 0;
+		};
+
+		/* the calling thread's cache, with the default size */
+		inline decomposition_cache& thread_decomposition_cache()
+		{
+			thread_local decomposition_cache cache;
+			return cache;
+		}
+	} // namespace utf8
+} // namespace util
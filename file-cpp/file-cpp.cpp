@@ -1,17 +1,666 @@
 ﻿// file-cpp.cpp : Defines the entry point for the application.
 //
+// Benchmarks the path decomposition functions over a few synthetic corpora.
+//
+//   file-cpp                              run and print the results
+//   file-cpp --save baseline.json         run and store the results as a baseline
+//   file-cpp --compare baseline.json      run and compare against a baseline, exits with 1 on a regression
+//
+// Options: --samples N (default 15), --threshold PCT (default 5), --sigmas K (default 3),
+//          --filter TEXT (only run functions or corpora containing TEXT)
 
 #include "file.h"
+#include "bench.h"
+#include "natural_compare.h"
+#include "mount_table.h"
+#include "collision.h"
+#include "merkle.h"
+#include "router.h"
+#include "content_cache.h"
+#include "component_index.h"
+#include "snapshot.h"
+#include "partition.h"
+#include "path_codec.h"
+#include "log_paths.h"
+#include "path_template.h"
+#include "metrics.h"
+#include "path_translate.h"
+#include "anonymize.h"
+#include "shared_paths.h"
+#include "path_trie.h"
+#include "decomposition_cache.h"
+#include "bulk_load.h"
+#include "content_hash.h"
+#include "incremental_walk.h"
+#include "file_type.h"
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace std;
 
-int main()
+namespace {
+	struct corpus {
+		std::string                   name;
+		std::vector<std::string>      storage;
+		std::vector<std::string_view> paths;
+	};
+
+	struct bench_case {
+		std::string                           name;
+		std::function<size_t(const corpus &)> run;
+	};
+
+	/*
+	a case over real files rather than a corpus, run once. setup writes its tree below root, sets items to the
+	number of files and returns the run, root is removed afterwards
+	*/
+	struct file_case {
+		std::string                                                                        name;
+		std::function<std::function<size_t()>(const std::filesystem::path&, size_t&)> setup;
+	};
+
+	/* small deterministic generator so every run sees the same corpora */
+	struct lcg {
+		uint64_t state;
+
+		uint32_t next()
+		{
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			return static_cast<uint32_t>(state >> 33);
+		}
+
+		uint32_t below(uint32_t n)
+		{
+			return next() % n;
+		}
+	};
+
+	corpus make_corpus(std::string name, const char* root, char sep, size_t count, uint64_t seed)
+	{
+		static const char* const dirs[]  = {"usr", "lib", "src", "include", "Users", "build", "assets",
+						 "node_modules", "x86_64-linux-gnu", "Documents", "release", "v1.10", ".git", "cache"};
+		static const char* const files[] = {"main", "file", "index", "libfoo", "README", "image", "CMakeLists",
+						 ".bashrc", "archive.tar", "data", "thumb", "config"};
+		static const char* const exts[]  = {"", ".cpp", ".h", ".txt", ".so.1", ".png", ".gz", ".json", "."};
+
+		corpus ret;
+		lcg    rng = {seed};
+		ret.name   = std::move(name);
+		ret.storage.reserve(count);
+		for (size_t i = 0; i < count; i++) {
+			std::string path  = root;
+			const auto  depth = 1 + rng.below(8);
+			for (uint32_t d = 0; d < depth; d++) {
+				path += dirs[rng.below(sizeof(dirs) / sizeof(dirs[0]))];
+				path += sep;
+			}
+			path += files[rng.below(sizeof(files) / sizeof(files[0]))];
+			path += exts[rng.below(sizeof(exts) / sizeof(exts[0]))];
+			ret.storage.push_back(std::move(path));
+		}
+		for (const auto& p : ret.storage) {
+			ret.paths.push_back(p);
+		}
+		return ret;
+	}
+
+	std::vector<corpus> make_corpora()
+	{
+		constexpr size_t    count = 50000;
+		std::vector<corpus> ret;
+		ret.push_back(make_corpus("posix", "/", '/', count, 1));
+		ret.push_back(make_corpus("relative", "", '/', count, 2));
+		ret.push_back(make_corpus("windows", "C:\\", '\\', count, 3));
+		ret.push_back(make_corpus("unc", "\\\\server\\share\\", '\\', count, 4));
+		ret.push_back(make_corpus("device", "\\\\?\\", '\\', count, 5));
+		return ret;
+	}
+
+	template<typename Fn> bench_case view_case(std::string name, Fn fn)
+	{
+		const auto run = [fn](const corpus& c) {
+			size_t total = 0;
+			for (const auto p : c.paths) {
+				total += fn(p).size();
+			}
+			return total;
+		};
+		return {std::move(name), run};
+	}
+
+	template<typename Fn> bench_case find_case(std::string name, Fn fn)
+	{
+		const auto run = [fn](const corpus& c) {
+			size_t total = 0;
+			for (const auto p : c.paths) {
+				total += static_cast<size_t>(fn(p.data(), p.data() + p.size()) - p.data());
+			}
+			return total;
+		};
+		return {std::move(name), run};
+	}
+
+	std::vector<bench_case> make_cases()
+	{
+		using namespace util::utf8;
+		std::vector<bench_case> ret;
+		ret.push_back(find_case("find_root_name_end", [](auto f, auto l) { return find_root_name_end(f, l); }));
+		ret.push_back(find_case("find_relative_path", [](auto f, auto l) { return find_relative_path(f, l); }));
+		ret.push_back(find_case("find_filename", [](auto f, auto l) { return find_filename(f, l); }));
+		ret.push_back(view_case("root_name", [](std::string_view p) { return root_name(p); }));
+		ret.push_back(view_case("root_directory", [](std::string_view p) { return root_directory(p); }));
+		ret.push_back(view_case("root_path", [](std::string_view p) { return root_path(p); }));
+		ret.push_back(view_case("relative_path", [](std::string_view p) { return relative_path(p); }));
+		ret.push_back(view_case("parent_path", [](std::string_view p) { return parent_path(p); }));
+		ret.push_back(view_case("filename", [](std::string_view p) { return filename(p); }));
+		ret.push_back(view_case("stem", [](std::string_view p) { return stem(p); }));
+		ret.push_back(view_case("extension", [](std::string_view p) { return extension(p); }));
+		ret.push_back({"natural_compare", [](const corpus& c) {
+			size_t total = 0;
+			for (size_t i = 1; i < c.paths.size(); i++) {
+				total += natural_compare_filename(c.paths[i - 1], c.paths[i]) < 0;
+			}
+			return total;
+		}});
+		ret.push_back({"natural_sort_key", [](const corpus& c) {
+			std::string key;
+			size_t      total = 0;
+			for (const auto p : c.paths) {
+				key.clear();
+				total += append_natural_sort_key(key, filename(p)).size();
+			}
+			return total;
+		}});
+		ret.push_back({"mount_table_find", [](const corpus& c) {
+			static const auto table = [] {
+				mount_table<int> t;
+				const char* const prefixes[] = {"/", "/usr", "/usr/lib", "/build/cache", "C:\\", "C:\\Users",
+								"\\\\server\\share", "\\\\server\\share\\assets", "src", "src/include"};
+				for (const auto p : prefixes) {
+					t.insert(p, static_cast<int>(t.size()));
+				}
+				return t;
+			}();
+			size_t total = 0;
+			for (const auto p : c.paths) {
+				total += table.find(p).length;
+			}
+			return total;
+		}});
+		ret.push_back({"find_case_collisions", [](const corpus& c) {
+			return find_case_collisions(c.paths).indices.size();
+		}});
+		ret.push_back({"merkle_tree_build", [](const corpus& c) {
+			std::vector<merkle_digest> leaves(c.paths.size());
+			for (size_t i = 0; i < leaves.size(); i++) {
+				leaves[i] = file_digest(i);
+			}
+			return merkle_tree::build(c.paths.data(), leaves.data(), c.paths.size()).root_digest().lo;
+		}});
+		ret.push_back({"router_find", [](const corpus& c) {
+			static const auto routes = [] {
+				router<int> r;
+				const char* const patterns[] = {"/usr/lib/:name", "/usr/*rest", "/src/include/*.h", "/src/*.cpp",
+								"/build/:config/cache/*rest", "/assets/*.png", "/Users/:user/Documents/*rest",
+								"C:/Users/:user/*rest", "/node_modules/:package/*rest", "/:root/:dir/main.cpp"};
+				for (const auto p : patterns) {
+					r.add(p, static_cast<int>(r.size()));
+				}
+				return r;
+			}();
+			router<int>::match m;
+			size_t             total = 0;
+			for (const auto p : c.paths) {
+				total += routes.find(p, m) ? m.count : 0;
+			}
+			return total;
+		}});
+		ret.push_back({"content_cache_hit", [](const corpus& c) {
+			// the hot path only, every lookup after the first is served from memory
+			static const auto path = [] {
+				const auto p = (std::filesystem::temp_directory_path() / "file-cpp-content-cache.txt").string();
+				util::write_file_atomic(p, "cached contents");
+				return p;
+			}();
+			static content_cache cache({.revalidate_after = std::chrono::hours(1)});
+			size_t               total = 0;
+			for (size_t i = 0; i < c.paths.size(); i++) {
+				const auto file = cache.get(path);
+				total += file ? file->size() : 0;
+			}
+			return total;
+		}});
+		ret.push_back({"component_index", [](const corpus& c) {
+			const auto bytes = component_index::build(c.paths.data(), c.paths.size()).serialize();
+			return bytes.size() + component_index_view(bytes).all_of({"node_modules", ".git"}).size();
+		}});
+		ret.push_back({"snapshot_read", [](const corpus& c) {
+			// mount_table_find through a snapshot, the difference is the cost of a read section
+			static util::snapshot<mount_table<int>> tables([] {
+				mount_table<int> t;
+				const char* const prefixes[] = {"/", "/usr", "/usr/lib", "/build/cache", "C:\\", "C:\\Users",
+								"\\\\server\\share", "\\\\server\\share\\assets", "src", "src/include"};
+				for (const auto p : prefixes) {
+					t.insert(p, static_cast<int>(t.size()));
+				}
+				return t;
+			}());
+			static auto reader = tables.make_reader();
+			size_t      total  = 0;
+			for (const auto p : c.paths) {
+				total += reader.read()->find(p).length;
+			}
+			return total;
+		}});
+		ret.push_back({"partition_paths", [](const corpus& c) {
+			partition_options opts;
+			opts.shards = 16;
+			opts.depth  = 2;
+			return partition_paths(c.paths.data(), c.paths.size(), opts).size();
+		}});
+		ret.push_back({"path_codec", [](const corpus& c) {
+			path_encoder encoder;
+			std::string  wire;
+			for (const auto p : c.paths) {
+				encoder.add(p);
+				if (encoder.pending() == 4096) {
+					encoder.flush(wire);
+				}
+			}
+			encoder.flush(wire);
+			path_decoder     decoder;
+			std::string_view in    = wire;
+			size_t           bytes = 0;
+			while (decoder.decode(in) == decode_status::ok) {
+				for (const auto& p : decoder.paths()) {
+					bytes += p.filename().size() + p.extension().size();
+				}
+			}
+			return bytes + wire.size();
+		}});
+		ret.push_back({"path_references", [](const corpus& c) {
+			// a build log mentioning every path of the corpus, built once per corpus
+			static std::vector<std::pair<const corpus*, std::string>> logs;
+			auto it = std::find_if(logs.begin(), logs.end(), [&](const auto& l) { return l.first == &c; });
+			if (it == logs.end()) {
+				std::string log;
+				for (size_t i = 0; i < c.paths.size(); i++) {
+					log.append("[ 42%] Building CXX object\n");
+					log.append(c.paths[i]).append(":").append(std::to_string(i % 900 + 1)).append(":17: warning: ");
+					log.append("unused variable 'x' [-Wunused-variable]\n");
+				}
+				it = logs.insert(logs.end(), {&c, std::move(log)});
+			}
+			size_t total = 0;
+			find_path_references(it->second, [&](const path_reference& ref) {
+				total += ref.line + ref.filename().size();
+				return true;
+			});
+			return total;
+		}});
+		ret.push_back({"path_template", [](const corpus& c) {
+			static const path_template thumb("{parent}/{stem}_thumb{ext}");
+			return format_paths(thumb, c.paths.data(), c.paths.size()).buffer.size();
+		}});
+		ret.push_back({"metrics_record", [](const corpus& c) {
+			// filename with a counter and a histogram around it, the difference is the cost of the metrics
+			static util::metrics_registry metrics;
+			static auto&                  parsed = metrics.counter("file_cpp_filenames_total", "Filenames parsed");
+			static auto&                  sizes  = metrics.histogram("file_cpp_filename_bytes", "Filename sizes");
+			size_t                        total  = 0;
+			for (const auto p : c.paths) {
+				const auto name = filename(p);
+				parsed.add();
+				sizes.record(name.size());
+				total += name.size();
+			}
+			return total;
+		}});
+		ret.push_back({"path_translate", [](const corpus& c) {
+			static const auto wsl = path_translator::wsl();
+			return wsl.to_posix(c.paths.data(), c.paths.size()).buffer.size();
+		}});
+		ret.push_back({"translate_mounted", [](const corpus& c) {
+			// the documented WSL setup, to POSIX and back: drive paths have to win over the mount on /
+			static const auto wsl = [] {
+				auto ret = path_translator::wsl();
+				ret.add_mount("\\\\wsl$\\Ubuntu", "/");
+				return ret;
+			}();
+			const auto                    posix = wsl.to_posix(c.paths.data(), c.paths.size());
+			std::vector<std::string_view> views(c.paths.size());
+			for (size_t i = 0; i < views.size(); i++) {
+				views[i] = posix[i];
+			}
+			return wsl.to_windows(views.data(), views.size()).buffer.size();
+		}});
+		ret.push_back({"anonymize_paths", [](const corpus& c) {
+			static const path_anonymizer anon({0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull});
+			return anonymize_paths(anon, c.paths.data(), c.paths.size()).buffer.size();
+		}});
+		ret.push_back({"shared_intern", [](const corpus& c) {
+			// a fresh anonymous region every run, so these are inserts
+			size_t bytes = 0;
+			for (const auto p : c.paths) {
+				bytes += p.size();
+			}
+			shared_path_table table;
+			table.create(nullptr, static_cast<uint32_t>(c.paths.size() * 8 + 16), bytes);
+			for (const auto p : c.paths) {
+				table.intern(p);
+			}
+			return size_t{table.size()};
+		}});
+		ret.push_back({"path_trie", [](const corpus& c) {
+			// lookups of every path, the trie is built once per corpus
+			static std::vector<std::pair<const corpus*, std::string>> images;
+			auto it = std::find_if(images.begin(), images.end(), [&](const auto& i) { return i.first == &c; });
+			if (it == images.end()) {
+				it = images.insert(images.end(), {&c, build_path_trie(c.paths.data(), c.paths.size())});
+			}
+			const path_trie_view trie(it->second);
+			size_t               total = 0;
+			for (const auto p : c.paths) {
+				total += trie.find(p);
+			}
+			return total;
+		}});
+		ret.push_back({"decompose_cached", [](const corpus& c) {
+			// an access log: the first 1024 paths of the corpus over and over
+			auto&        cache = thread_decomposition_cache();
+			const size_t hot   = std::min<size_t>(c.paths.size(), 1024);
+			size_t       total = 0;
+			for (size_t i = 0; i < c.paths.size(); i++) {
+				const auto p = c.paths[i % hot];
+				total += cache.get(p).extension(p).size();
+			}
+			return total;
+		}});
+		ret.push_back({"content_type", [](const corpus& c) {
+			// the sniffing alone, over file heads built once per corpus, a PNG every 8th path and text otherwise
+			static std::vector<std::pair<const corpus*, std::vector<std::string>>> heads;
+			auto it = std::find_if(heads.begin(), heads.end(), [&](const auto& h) { return h.first == &c; });
+			if (it == heads.end()) {
+				std::vector<std::string> h;
+				for (size_t i = 0; i < c.paths.size(); i++) {
+					h.push_back((i % 8 ? std::string() : std::string("\x89PNG\r\n\x1a\n")).append(c.paths[i]));
+				}
+				it = heads.insert(heads.end(), {&c, std::move(h)});
+			}
+			size_t total = 0;
+			for (size_t i = 0; i < c.paths.size(); i++) {
+				const auto type = reconcile_file_type(extension_type(c.paths[i]), content_type(it->second[i]));
+				total += static_cast<size_t>(type);
+			}
+			return total;
+		}});
+		return ret;
+	}
+
+	std::vector<file_case> make_file_cases()
+	{
+		using namespace util::utf8;
+		std::vector<file_case> ret;
+		ret.push_back({"bulk_load", [](const std::filesystem::path& root, size_t& items) {
+			// 512 small files over 16 directories, warm in the page cache after the first run
+			std::vector<std::string> paths;
+			for (int i = 0; i < 512; i++) {
+				const auto dir = root / std::to_string(i % 16);
+				std::filesystem::create_directories(dir);
+				paths.push_back((dir / ('f' + std::to_string(i) + ".txt")).string());
+				util::write_file_atomic(paths.back(), std::string(static_cast<size_t>(64 + i * 7), 'x'));
+			}
+			items = paths.size();
+			return [paths = std::move(paths)] {
+				const std::vector<std::string_view> views(paths.begin(), paths.end());
+				size_t                              total = 0;
+				load_files(views.data(), views.size(), [&](const loaded_file& file) { total += file.contents.size(); });
+				return total;
+			};
+		}});
+		ret.push_back({"hash_files", [](const std::filesystem::path& root, size_t& items) {
+			// 256 files of 4 KiB to 1 MiB over 8 directories, hashed from the page cache every run
+			std::vector<std::string> paths;
+			for (int i = 0; i < 256; i++) {
+				const auto dir = root / std::to_string(i % 8);
+				std::filesystem::create_directories(dir);
+				paths.push_back((dir / ('f' + std::to_string(i) + ".bin")).string());
+				util::write_file_atomic(paths.back(), std::string(static_cast<size_t>(4096) << (i % 9), 'h'));
+			}
+			items = paths.size();
+			return [paths = std::move(paths)] {
+				const std::vector<std::string_view> views(paths.begin(), paths.end());
+				size_t                              total = 0;
+				for (const auto& h : hash_files(views.data(), views.size())) {
+					total += h.size;
+				}
+				return total;
+			};
+		}});
+		ret.push_back({"path_trie_mapped", [](const std::filesystem::path& root, size_t& items) {
+			// a trie written to disk and queried from the mapping with every separator flipped, which also checks
+			// the round trip: a listed path has to be found however its separators are written
+			std::vector<corpus> listed;
+			listed.push_back(make_corpus("posix", "/", '/', 4096, 11));
+			listed.push_back(make_corpus("windows", "C:\\", '\\', 4096, 12));
+			listed.push_back(make_corpus("unc", "\\\\server\\share\\", '\\', 4096, 13));
+			std::vector<std::string_view> paths;
+			std::vector<std::string>      flipped;
+			for (const auto& c : listed) {
+				for (const auto p : c.paths) {
+					paths.push_back(p);
+					flipped.emplace_back(p);
+					for (auto& ch : flipped.back()) {
+						ch = ch == '/' ? '\\' : ch == '\\' ? '/' : ch;
+					}
+				}
+			}
+			const auto file = (root / "paths.trie").string();
+			std::filesystem::create_directories(root);
+			util::write_file_atomic(file, build_path_trie(paths.data(), paths.size()));
+			auto mapped = std::make_shared<util::mapped_file>(file.c_str());
+			const path_trie_view trie(mapped->view());
+			for (size_t i = 0; i < paths.size(); i++) {
+				const auto id = trie.find(paths[i]);
+				if (id == path_trie_view::npos || trie.find(flipped[i]) != id) {
+					cerr << "path_trie round trip failed for " << paths[i] << endl;
+					std::filesystem::remove_all(root);
+					std::exit(1);
+				}
+			}
+			items = paths.size();
+			return [mapped, flipped = std::move(flipped)] {
+				const path_trie_view trie(mapped->view());
+				size_t               total = 0;
+				for (const auto& p : flipped) {
+					total += trie.find(p);
+				}
+				return total;
+			};
+		}});
+		ret.push_back({"walk", [](const std::filesystem::path& root, size_t& items) {
+			// a full walk of 64 directories with the checkpoint appended after every one, the worst case for the log
+			const auto tree = root / "tree";
+			for (int i = 0; i < 256; i++) {
+				const auto sub = tree / std::to_string(i % 8) / std::to_string(i % 64);
+				std::filesystem::create_directories(sub);
+				util::write_file_atomic((sub / ('f' + std::to_string(i))).string(), "x");
+			}
+			items = 256;
+			return [tree = tree.string(), checkpoint = (root / "walk.ckpt").string()] {
+				walk_options options;
+				options.checkpoint       = checkpoint;
+				options.checkpoint_every = std::chrono::milliseconds(0);
+				const auto result = walk(tree, [](std::string_view, bool) { return true; }, options);
+				return result.entries + result.checkpoint_failed;
+			};
+		}});
+		ret.push_back({"incremental_walk", [](const std::filesystem::path& root, size_t& items) {
+			// a rescan of an unchanged tree of 64 directories, every directory is stat()ed and none listed
+			for (int i = 0; i < 256; i++) {
+				const auto sub = root / std::to_string(i % 8) / std::to_string(i % 64);
+				std::filesystem::create_directories(sub);
+				util::write_file_atomic((sub / ('f' + std::to_string(i))).string(), "x");
+			}
+			items = 256;
+			// the tree was just written, a racy window would have every directory listed again
+			return [root = root.string(), index = walk_index()]() mutable {
+				incremental_walk_options options;
+				options.threads     = 1;
+				options.racy_window = std::chrono::nanoseconds(0);
+				const auto result   = incremental_walk(root, index, options);
+				return result.entries + result.changes.size();
+			};
+		}});
+		return ret;
+	}
+
+	bool read_file(const std::string& path, std::string& out)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in) {
+			return false;
+		}
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		out = ss.str();
+		return true;
+	}
+
+	int usage()
+	{
+		cerr << "usage: file-cpp [--save FILE] [--compare FILE] [--samples N] [--threshold PCT] [--sigmas K] "
+						"[--filter TEXT]"
+						<< endl;
+		return 2;
+	}
+} // namespace
+
+int main(int argc, char** argv)
 {
-	const wchar_t* prefix = L"x:";
-	cout << std::filesystem::_Has_drive_letter_prefix(prefix, prefix + 2);
-	cout << util::wide::has_drive_letter_prefix(prefix, prefix + 2);
-	cout << "Hello CMake." << endl;
-	return 0;
+	std::string                  save_path;
+	std::string                  compare_path;
+	std::string                  filter;
+	size_t                       samples = 15;
+	util::bench::compare_options opts    = {};
+
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (i + 1 >= argc) {
+			return usage();
+		}
+		if (arg == "--save") {
+			save_path = argv[++i];
+		} else if (arg == "--compare") {
+			compare_path = argv[++i];
+		} else if (arg == "--samples") {
+			samples = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--threshold") {
+			opts.threshold = std::strtod(argv[++i], nullptr) / 100.0;
+		} else if (arg == "--sigmas") {
+			opts.sigmas = std::strtod(argv[++i], nullptr);
+		} else if (arg == "--filter") {
+			filter = argv[++i];
+		} else {
+			return usage();
+		}
+	}
+	if (samples < 3) {
+		samples = 3;
+	}
+
+	// load the baseline before spending time on the run
+	std::vector<util::bench::result> baseline;
+	if (!compare_path.empty()) {
+		std::string text;
+		if (!read_file(compare_path, text) || !util::bench::from_json(text, baseline)) {
+			cerr << "unable to read baseline " << compare_path << endl;
+			return 2;
+		}
+	}
+
+	const auto                       corpora    = make_corpora();
+	const auto                       cases      = make_cases();
+	const auto                       file_cases = make_file_cases();
+	std::vector<util::bench::result> results;
+	for (const auto& bc : cases) {
+		for (const auto& c : corpora) {
+			if (!filter.empty() && bc.name.find(filter) == std::string::npos &&
+							c.name.find(filter) == std::string::npos) {
+				continue;
+			}
+			util::bench::result r;
+			r.function    = bc.name;
+			r.corpus      = c.name;
+			r.items       = c.paths.size();
+			r.ns_per_item = util::bench::measure([&] { return bc.run(c); }, c.paths.size(), samples);
+			printf("%-20s %-10s %9.3f ns/path (mad %.3f)\n", r.function.c_str(), r.corpus.c_str(),
+							r.ns_per_item.median, r.ns_per_item.mad);
+			results.push_back(std::move(r));
+		}
+	}
+	for (const auto& fc : file_cases) {
+		if (!filter.empty() && fc.name.find(filter) == std::string::npos &&
+						std::string_view("files").find(filter) == std::string_view::npos) {
+			continue;
+		}
+		const auto root = std::filesystem::temp_directory_path() / ("file-cpp-" + fc.name);
+		std::filesystem::remove_all(root);
+		util::bench::result r;
+		r.function = fc.name;
+		r.corpus   = "files";
+		const auto run = fc.setup(root, r.items);
+		r.ns_per_item  = util::bench::measure(run, r.items, samples);
+		std::filesystem::remove_all(root);
+		printf("%-20s %-10s %9.3f ns/file (mad %.3f)\n", r.function.c_str(), r.corpus.c_str(), r.ns_per_item.median,
+						r.ns_per_item.mad);
+		results.push_back(std::move(r));
+	}
+
+	if (!save_path.empty()) {
+		std::ofstream out(save_path, std::ios::binary | std::ios::trunc);
+		out << util::bench::to_json(results);
+		if (!out) {
+			cerr << "unable to write baseline " << save_path << endl;
+			return 2;
+		}
+	}
+
+	if (compare_path.empty()) {
+		return 0;
+	}
+
+	if (!filter.empty()) {
+		// only compare what was run
+		const auto not_run = [&](const util::bench::result& b) {
+			return b.function.find(filter) == std::string::npos && b.corpus.find(filter) == std::string::npos;
+		};
+		baseline.erase(std::remove_if(baseline.begin(), baseline.end(), not_run), baseline.end());
+	}
+
+	const auto report = util::bench::compare(baseline, results, opts);
+	printf("\n%-20s %-10s %9s %9s %7s\n", "function", "corpus", "baseline", "current", "ratio");
+	for (const auto& c : report.cases) {
+		printf("%-20s %-10s %9.3f %9.3f %6.3fx%s\n", c.function.c_str(), c.corpus.c_str(), c.baseline, c.current,
+						c.ratio, c.regressed ? "  REGRESSION" : "");
+	}
+	printf("\n");
+	for (const auto& c : report.functions) {
+		printf("function %-20s %6.3fx%s\n", c.function.c_str(), c.ratio, c.regressed ? "  REGRESSION" : "");
+	}
+	for (const auto& c : report.corpora) {
+		printf("corpus   %-20s %6.3fx%s\n", c.corpus.c_str(), c.ratio, c.regressed ? "  REGRESSION" : "");
+	}
+	for (const auto& m : report.missing) {
+		printf("missing  %s\n", m.c_str());
+	}
+	return report.regressed ? 1 : 0;
 }
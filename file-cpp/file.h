@@ -3,6 +3,7 @@
 #include <string_view>
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 
 /*
 The MIT License (MIT)
@@ -72,6 +73,12 @@ namespace util {
 			return c & ~(L'a' - L'A'); /* a gap of 32 */
 		}
 
+		/* lowercase only ascii letters, unlike ascii_lowercase which also moves punctuation ('_' -> DEL) */
+		constexpr inline wchar_t fold_letter(wchar_t c)
+		{
+			return ((uint32_t)((uint32_t)c - (uint32_t)L'A') < 26) ? ascii_lowercase(c) : c;
+		}
+
 		/* TODO: endianness check! */
 		constexpr inline bool is_drive_prefix(const wchar_t* const _First)
 		{
@@ -165,6 +172,12 @@ namespace util {
 			return std::wstring_view(root_name_end, static_cast<size_t>(relative_start - root_name_end));
 		}
 
+		constexpr const wchar_t* find_relative_path(const wchar_t* const _First, const wchar_t* const _Last)
+		{
+			// attempt to parse [_First, _Last) as a path and return the start of relative-path
+			return std::find_if_not(find_root_name_end(_First, _Last), _Last, is_slash);
+		}
+
 		constexpr std::wstring_view root_path(const std::wstring_view path)
 		{
 			// attempt to parse path as a path and return the root-path if it exists; otherwise, an empty view
@@ -173,12 +186,6 @@ namespace util {
 			return std::wstring_view(data, static_cast<size_t>(find_relative_path(data, tail) - data));
 		}
 
-		constexpr const wchar_t* find_relative_path(const wchar_t* const _First, const wchar_t* const _Last)
-		{
-			// attempt to parse [_First, _Last) as a path and return the start of relative-path
-			return std::find_if_not(find_root_name_end(_First, _Last), _Last, is_slash);
-		}
-
 		constexpr std::wstring_view relative_path(const std::wstring_view path)
 		{
 			// attempt to parse path as a path and return the relative-path if it exists; otherwise, an empty view
@@ -291,6 +298,76 @@ namespace util {
 			return std::wstring_view(exts, static_cast<size_t>(addtional - exts));
 		}
 
+		/* forward iterator over the non-empty components of a path, separators are skipped */
+		class component_iterator {
+		public:
+			constexpr component_iterator() = default;
+
+			constexpr component_iterator(const wchar_t* const first, const wchar_t* const last)
+							: it(std::find_if_not(first, last, is_slash)),
+							  component_end(std::find_if(it, last, is_slash)), tail(last)
+			{
+			}
+
+			constexpr std::wstring_view operator*() const
+			{
+				return std::wstring_view(it, static_cast<size_t>(component_end - it));
+			}
+
+			constexpr component_iterator& operator++()
+			{
+				it            = std::find_if_not(component_end, tail, is_slash);
+				component_end = std::find_if(it, tail, is_slash);
+				return *this;
+			}
+
+			constexpr component_iterator operator++(int)
+			{
+				auto ret = *this;
+				++*this;
+				return ret;
+			}
+
+			constexpr bool operator==(const component_iterator& other) const
+			{
+				return it == other.it;
+			}
+
+			constexpr bool operator!=(const component_iterator& other) const
+			{
+				return it != other.it;
+			}
+
+		private:
+			const wchar_t* it            = nullptr;
+			const wchar_t* component_end = nullptr;
+			const wchar_t* tail          = nullptr;
+		};
+
+		struct component_range {
+			component_iterator first;
+			component_iterator last;
+
+			constexpr component_iterator begin() const
+			{
+				return first;
+			}
+
+			constexpr component_iterator end() const
+			{
+				return last;
+			}
+		};
+
+		constexpr component_range components(const std::wstring_view path)
+		{
+			// attempt to parse path as a path and iterate the components of its relative-path, unlike
+			// std::filesystem::path there is no trailing empty component for a trailing separator
+			const auto data = path.data();
+			const auto tail = data + path.size();
+			return {component_iterator(find_relative_path(data, tail), tail), component_iterator(tail, tail)};
+		}
+
 	} // namespace wide
 	namespace utf8 {
 		/* lowercase -> higher value, we set a bit to convert any uppercase to lowercase */
@@ -305,6 +382,12 @@ namespace util {
 			return c & ~('a' - 'A'); /* a gap of 32 */
 		}
 
+		/* lowercase only ascii letters, unlike ascii_lowercase which also moves punctuation ('_' -> DEL) */
+		constexpr inline char fold_letter(char c)
+		{
+			return ((uint8_t)((uint8_t)c - (uint8_t)'A') < 26) ? ascii_lowercase(c) : c;
+		}
+
 		constexpr inline bool is_drive_prefix(const char* const _First)
 		{
 			// test if _First points to a prefix of the form X:
@@ -397,6 +480,12 @@ namespace util {
 			return std::string_view(root_name_end, static_cast<size_t>(relative_start - root_name_end));
 		}
 
+		constexpr const char* find_relative_path(const char* const _First, const char* const _Last)
+		{
+			// attempt to parse [_First, _Last) as a path and return the start of relative-path
+			return std::find_if_not(find_root_name_end(_First, _Last), _Last, is_slash);
+		}
+
 		constexpr std::string_view root_path(const std::string_view path)
 		{
 			// attempt to parse path as a path and return the root-path if it exists; otherwise, an empty view
@@ -405,12 +494,6 @@ namespace util {
 			return std::string_view(data, static_cast<size_t>(find_relative_path(data, tail) - data));
 		}
 
-		constexpr const char* find_relative_path(const char* const _First, const char* const _Last)
-		{
-			// attempt to parse [_First, _Last) as a path and return the start of relative-path
-			return std::find_if_not(find_root_name_end(_First, _Last), _Last, is_slash);
-		}
-
 		constexpr std::string_view relative_path(const std::string_view path)
 		{
 			// attempt to parse path as a path and return the relative-path if it exists; otherwise, an empty view
@@ -522,5 +605,75 @@ namespace util {
 			const auto exts = find_extension(fname, addtional);
 			return std::string_view(exts, static_cast<size_t>(addtional - exts));
 		}
+
+		/* forward iterator over the non-empty components of a path, separators are skipped */
+		class component_iterator {
+		public:
+			constexpr component_iterator() = default;
+
+			constexpr component_iterator(const char* const first, const char* const last)
+							: it(std::find_if_not(first, last, is_slash)),
+							  component_end(std::find_if(it, last, is_slash)), tail(last)
+			{
+			}
+
+			constexpr std::string_view operator*() const
+			{
+				return std::string_view(it, static_cast<size_t>(component_end - it));
+			}
+
+			constexpr component_iterator& operator++()
+			{
+				it            = std::find_if_not(component_end, tail, is_slash);
+				component_end = std::find_if(it, tail, is_slash);
+				return *this;
+			}
+
+			constexpr component_iterator operator++(int)
+			{
+				auto ret = *this;
+				++*this;
+				return ret;
+			}
+
+			constexpr bool operator==(const component_iterator& other) const
+			{
+				return it == other.it;
+			}
+
+			constexpr bool operator!=(const component_iterator& other) const
+			{
+				return it != other.it;
+			}
+
+		private:
+			const char* it            = nullptr;
+			const char* component_end = nullptr;
+			const char* tail          = nullptr;
+		};
+
+		struct component_range {
+			component_iterator first;
+			component_iterator last;
+
+			constexpr component_iterator begin() const
+			{
+				return first;
+			}
+
+			constexpr component_iterator end() const
+			{
+				return last;
+			}
+		};
+
+		constexpr component_range components(const std::string_view path)
+		{
+			// attempt to parse path as a path and iterate the components of its relative-path, unlike
+			// std::filesystem::path there is no trailing empty component for a trailing separator
+			const auto data = path.data();
+			const auto tail = data + path.size();
+			return {component_iterator(find_relative_path(data, tail), tail), component_iterator(tail, tail)};
+		}
 	} // namespace utf8
 } // namespace util
\ No newline at end of file
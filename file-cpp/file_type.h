@@ -0,0 +1,477 @@
+﻿#pragma once
+
+#include "bulk_load.h"
+#include "file.h"
+#include "simd.h"
+#include <string_view>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+/*
+Classifies files by their extension and the magic numbers at their start, for ingestion where
+extensions lie often enough that they cannot be trusted alone.
+
+	auto types = util::utf8::classify_files(paths.data(), paths.size());
+	for (size_t i = 0; i < types.size(); i++)
+		route(paths[i], util::utf8::file_type_name(types[i].type));
+
+	auto t = util::utf8::content_type(first_bytes); // or one file at a time
+
+The first 4 KiB of every file are read through load_files() (see bulk_load.h), so on Linux the
+reads are batched in an io_uring. The bytes are matched against a signature table compiled once:
+every signature is up to 16 bytes at a fixed offset with a mask, so a match is one masked 16 byte
+compare, and a table indexed by the first byte narrows the signatures at offset 0 down to the few
+that can match before any compare.
+
+The extension and the content are reconciled by reconcile_file_type(): a signature that matched
+wins over the extension, except where the extension says what a generic container holds (a .docx
+is a zip) or which kind of text a text file is. Without a signature match the extension is
+believed only if its type has no signature to check, a .png that is not a PNG is unknown.
+*/
+namespace util {
+	namespace utf8 {
+		enum class file_type : uint8_t {
+			unknown,
+			// text, told apart by extension only
+			text,
+			source,
+			json,
+			csv,
+			xml,
+			html,
+			// documents and images
+			pdf,
+			png,
+			jpeg,
+			gif,
+			bmp,
+			tiff,
+			webp,
+			ico,
+			// archives
+			zip,
+			gzip,
+			bzip2,
+			xz,
+			zstd,
+			seven_zip,
+			rar,
+			tar,
+			// zip containers, told apart by extension
+			docx,
+			xlsx,
+			pptx,
+			odf,
+			epub,
+			jar,
+			apk,
+			// executables and data
+			elf,
+			pe,
+			mach_o,
+			wasm,
+			sqlite,
+			// audio and video
+			mp3,
+			ogg,
+			flac,
+			wav,
+			avi,
+			mp4,
+			matroska,
+			count
+		};
+
+		constexpr std::string_view file_type_name(const file_type type)
+		{
+			constexpr std::string_view names[] = {"unknown", "text", "source", "json", "csv", "xml", "html", "pdf",
+							"png", "jpeg", "gif", "bmp", "tiff", "webp", "ico", "zip", "gzip", "bzip2", "xz", "zstd",
+							"7z", "rar", "tar", "docx", "xlsx", "pptx", "odf", "epub", "jar", "apk", "elf", "pe",
+							"mach-o", "wasm", "sqlite", "mp3", "ogg", "flac", "wav", "avi", "mp4", "matroska"};
+			static_assert(std::size(names) == static_cast<size_t>(file_type::count));
+			return static_cast<size_t>(type) < std::size(names) ? names[static_cast<size_t>(type)] : names[0];
+		}
+
+		namespace detail {
+			struct file_signature {
+				file_type        type;
+				uint16_t         offset;
+				std::string_view bytes;        // '?' never matches itself, it is a wildcard when wildcards is set
+				bool             wildcards   = false;
+				bool             ignore_case = false; // ascii letters, bytes holds them in upper case
+			};
+
+			// in priority order, the first that matches wins. at most 16 bytes each
+			constexpr file_signature file_signatures[] = {
+							{file_type::sqlite, 0, {"SQLite format 3\0", 16}},
+							{file_type::png, 0, "\x89PNG\r\n\x1a\n"},
+							{file_type::pdf, 0, "%PDF-"},
+							{file_type::jpeg, 0, "\xff\xd8\xff"},
+							{file_type::gif, 0, "GIF87a"},
+							{file_type::gif, 0, "GIF89a"},
+							{file_type::webp, 0, "RIFF????WEBP", true},
+							{file_type::wav, 0, "RIFF????WAVE", true},
+							{file_type::avi, 0, "RIFF????AVI ", true},
+							{file_type::tiff, 0, {"II*\0", 4}},
+							{file_type::tiff, 0, {"MM\0*", 4}},
+							{file_type::ico, 0, {"\0\0\1\0", 4}},
+							{file_type::bmp, 0, {"BM????\0\0\0\0", 10}, true}, // the reserved fields are 0
+							{file_type::zip, 0, "PK\x03\x04"},
+							{file_type::zip, 0, "PK\x05\x06"},
+							{file_type::gzip, 0, "\x1f\x8b"},
+							{file_type::bzip2, 0, "BZh"},
+							{file_type::xz, 0, {"\xfd" "7zXZ\0", 6}},
+							{file_type::zstd, 0, "\x28\xb5\x2f\xfd"},
+							{file_type::seven_zip, 0, "7z\xbc\xaf\x27\x1c"},
+							{file_type::rar, 0, "Rar!\x1a\x07"},
+							{file_type::tar, 257, "ustar"},
+							{file_type::elf, 0, "\x7f" "ELF"},
+							{file_type::mach_o, 0, "\xfe\xed\xfa\xce"},
+							{file_type::mach_o, 0, "\xfe\xed\xfa\xcf"},
+							{file_type::mach_o, 0, "\xce\xfa\xed\xfe"},
+							{file_type::mach_o, 0, "\xcf\xfa\xed\xfe"},
+							{file_type::wasm, 0, {"\0asm", 4}},
+							{file_type::mp3, 0, "ID3"},
+							{file_type::mp3, 0, "\xff\xfb"},
+							{file_type::ogg, 0, "OggS"},
+							{file_type::flac, 0, "fLaC"},
+							{file_type::mp4, 4, "ftyp"},
+							{file_type::matroska, 0, "\x1a\x45\xdf\xa3"},
+							{file_type::xml, 0, "<?xml"},
+							{file_type::html, 0, "<!DOCTYPE HTML", false, true},
+							{file_type::html, 0, "<HTML", false, true},
+							{file_type::pe, 0, "MZ"},
+			};
+
+			/* the signature table in the form matching needs, see signatures() */
+			class signature_table {
+			public:
+				static constexpr size_t max_signatures = 64;
+
+				signature_table()
+				{
+					static_assert(std::size(file_signatures) <= max_signatures);
+					for (size_t i = 0; i < std::size(file_signatures); i++) {
+						const auto& s = file_signatures[i];
+						auto&       c = compiled[i];
+						c.type        = s.type;
+						c.offset      = s.offset;
+						c.size        = static_cast<uint8_t>(s.bytes.size());
+						for (size_t j = 0; j < s.bytes.size(); j++) {
+							const char b      = s.bytes[j];
+							const bool letter = s.ignore_case && b >= 'A' && b <= 'Z';
+							const bool any    = s.wildcards && b == '?';
+							c.value[j]        = any ? 0 : b;
+							c.mask[j]         = any ? 0 : letter ? static_cast<char>(~('a' - 'A')) : '\xff';
+						}
+						has_signature[static_cast<size_t>(s.type)] = true;
+
+						// signatures at offset 0 with a fixed first byte are only tried after that byte
+						const uint64_t bit = uint64_t{1} << i;
+						if (s.offset == 0 && static_cast<uint8_t>(c.mask[0]) == 0xff) {
+							by_first_byte[static_cast<uint8_t>(c.value[0])] |= bit;
+						} else if (s.offset == 0 && c.mask[0] != 0) {
+							// a letter in either case
+							by_first_byte[static_cast<uint8_t>(c.value[0])] |= bit;
+							by_first_byte[static_cast<uint8_t>(c.value[0] | ('a' - 'A'))] |= bit;
+						} else {
+							always |= bit;
+						}
+					}
+				}
+
+				/* the type of the first signature that head starts with, unknown if none */
+				file_type match(const std::string_view head) const
+				{
+					if (head.empty()) {
+						return file_type::unknown;
+					}
+					uint64_t candidates = always | by_first_byte[static_cast<uint8_t>(head[0])];
+					while (candidates) {
+						const auto  i = static_cast<size_t>(std::countr_zero(candidates));
+						const auto& c = compiled[i];
+						candidates &= candidates - 1;
+						if (head.size() >= size_t{c.offset} + c.size && matches(c, head)) {
+							return c.type;
+						}
+					}
+					return file_type::unknown;
+				}
+
+				/* whether some signature can confirm type */
+				bool checkable(const file_type type) const
+				{
+					return has_signature[static_cast<size_t>(type)];
+				}
+
+			private:
+				struct compiled_signature {
+					alignas(16) char value[16] = {};
+					alignas(16) char mask[16]  = {};
+					uint16_t  offset           = 0;
+					uint8_t   size             = 0;
+					file_type type             = file_type::unknown;
+				};
+
+				static bool matches(const compiled_signature& c, const std::string_view head)
+				{
+					// 16 bytes from the signature's offset, zero padded where head ends before them
+					const char* p = head.data() + c.offset;
+					char        padded[16];
+					if (head.size() - c.offset < 16) {
+						std::memset(padded, 0, sizeof(padded));
+						std::memcpy(padded, p, head.size() - c.offset);
+						p = padded;
+					}
+#if defined(FILE_CPP_SSE2)
+					const __m128i value  = _mm_load_si128(reinterpret_cast<const __m128i*>(c.value));
+					const __m128i mask   = _mm_load_si128(reinterpret_cast<const __m128i*>(c.mask));
+					const __m128i masked = _mm_and_si128(simd::load(p), mask);
+					return simd::movemask(_mm_cmpeq_epi8(masked, value)) == 0xffff;
+#else
+					for (size_t j = 0; j < c.size; j++) {
+						if ((p[j] & c.mask[j]) != c.value[j]) {
+							return false;
+						}
+					}
+					return true;
+#endif
+				}
+
+				std::array<compiled_signature, max_signatures>          compiled;
+				std::array<uint64_t, 256>                               by_first_byte = {};
+				uint64_t                                                always        = 0;
+				std::array<bool, static_cast<size_t>(file_type::count)> has_signature = {};
+			};
+
+			inline const signature_table& signatures()
+			{
+				static const signature_table table;
+				return table;
+			}
+
+			/* whether head looks like text, no NUL byte in it */
+			inline bool looks_like_text(const std::string_view head)
+			{
+				const char* p    = head.data();
+				const char* tail = p + head.size();
+#if defined(FILE_CPP_SSE2)
+				for (; tail - p >= 16; p += 16) {
+					if (simd::movemask(_mm_cmpeq_epi8(simd::load(p), _mm_setzero_si128()))) {
+						return false;
+					}
+				}
+#endif
+				return std::find(p, tail, '\0') == tail;
+			}
+
+			constexpr bool is_text_type(const file_type type)
+			{
+				return type >= file_type::text && type <= file_type::html;
+			}
+
+			constexpr bool is_zip_container(const file_type type)
+			{
+				return type >= file_type::docx && type <= file_type::apk;
+			}
+
+			struct extension_entry {
+				std::string_view extension; // lower case, without the dot, at most 8 bytes
+				file_type        type;
+			};
+
+			constexpr extension_entry file_extensions[] = {
+							{"7z", file_type::seven_zip},
+							{"apk", file_type::apk},
+							{"avi", file_type::avi},
+							{"bmp", file_type::bmp},
+							{"bz2", file_type::bzip2},
+							{"c", file_type::source},
+							{"cc", file_type::source},
+							{"cfg", file_type::text},
+							{"cpp", file_type::source},
+							{"cs", file_type::source},
+							{"css", file_type::source},
+							{"csv", file_type::csv},
+							{"cxx", file_type::source},
+							{"db", file_type::sqlite},
+							{"dll", file_type::pe},
+							{"docx", file_type::docx},
+							{"dylib", file_type::mach_o},
+							{"epub", file_type::epub},
+							{"exe", file_type::pe},
+							{"flac", file_type::flac},
+							{"gif", file_type::gif},
+							{"go", file_type::source},
+							{"gz", file_type::gzip},
+							{"h", file_type::source},
+							{"hpp", file_type::source},
+							{"htm", file_type::html},
+							{"html", file_type::html},
+							{"ico", file_type::ico},
+							{"ini", file_type::text},
+							{"jar", file_type::jar},
+							{"java", file_type::source},
+							{"jpeg", file_type::jpeg},
+							{"jpg", file_type::jpeg},
+							{"js", file_type::source},
+							{"json", file_type::json},
+							{"log", file_type::text},
+							{"m4a", file_type::mp4},
+							{"md", file_type::text},
+							{"mkv", file_type::matroska},
+							{"mov", file_type::mp4},
+							{"mp3", file_type::mp3},
+							{"mp4", file_type::mp4},
+							{"odp", file_type::odf},
+							{"ods", file_type::odf},
+							{"odt", file_type::odf},
+							{"oga", file_type::ogg},
+							{"ogg", file_type::ogg},
+							{"pdf", file_type::pdf},
+							{"png", file_type::png},
+							{"pptx", file_type::pptx},
+							{"py", file_type::source},
+							{"rar", file_type::rar},
+							{"rs", file_type::source},
+							{"sh", file_type::source},
+							{"so", file_type::elf},
+							{"sqlite", file_type::sqlite},
+							{"svg", file_type::xml},
+							{"tar", file_type::tar},
+							{"tif", file_type::tiff},
+							{"tiff", file_type::tiff},
+							{"toml", file_type::text},
+							{"ts", file_type::source},
+							{"txt", file_type::text},
+							{"wasm", file_type::wasm},
+							{"wav", file_type::wav},
+							{"webm", file_type::matroska},
+							{"webp", file_type::webp},
+							{"xlsx", file_type::xlsx},
+							{"xml", file_type::xml},
+							{"xz", file_type::xz},
+							{"yaml", file_type::text},
+							{"yml", file_type::text},
+							{"zip", file_type::zip},
+							{"zst", file_type::zstd},
+			};
+
+			/* file_extensions as up to 8 folded bytes in an integer each, so a lookup compares integers */
+			struct extension_table {
+				std::vector<uint64_t>  keys; // sorted
+				std::vector<file_type> types;
+
+				static uint64_t pack(const std::string_view ext)
+				{
+					uint64_t ret = 0;
+					for (size_t i = 0; i < ext.size(); i++) {
+						ret |= uint64_t{static_cast<uint8_t>(fold_letter(ext[i]))} << (8 * i);
+					}
+					return ret;
+				}
+
+				static const extension_table& get()
+				{
+					static const extension_table table = [] {
+						std::vector<std::pair<uint64_t, file_type>> entries;
+						for (const auto& e : file_extensions) {
+							entries.emplace_back(pack(e.extension), e.type);
+						}
+						std::sort(entries.begin(), entries.end());
+						extension_table ret;
+						for (const auto& [key, type] : entries) {
+							ret.keys.push_back(key);
+							ret.types.push_back(type);
+						}
+						return ret;
+					}();
+					return table;
+				}
+			};
+		} // namespace detail
+
+		/* the type path's extension names, compared case insensitively. unknown without a known extension */
+		inline file_type extension_type(const std::string_view path)
+		{
+			const auto ext = extension(path);
+			if (ext.size() < 2 || ext.size() > 9) {
+				return file_type::unknown;
+			}
+			const auto& table = detail::extension_table::get();
+			const auto  key   = detail::extension_table::pack(ext.substr(1));
+			const auto  it    = std::lower_bound(table.keys.begin(), table.keys.end(), key);
+			if (it == table.keys.end() || *it != key) {
+				return file_type::unknown;
+			}
+			return table.types[static_cast<size_t>(it - table.keys.begin())];
+		}
+
+		/* the type head, the first bytes of a file, has a signature of, text if it has no NUL, unknown otherwise */
+		inline file_type content_type(const std::string_view head)
+		{
+			const auto type = detail::signatures().match(head);
+			if (type == file_type::unknown && !head.empty() && detail::looks_like_text(head)) {
+				return file_type::text;
+			}
+			return type;
+		}
+
+		/* the type of a file whose extension and content gave by_extension and by_content, see the top of this file */
+		inline file_type reconcile_file_type(const file_type by_extension, const file_type by_content)
+		{
+			if (by_content == file_type::zip && detail::is_zip_container(by_extension)) {
+				return by_extension;
+			}
+			if (by_content == file_type::text && detail::is_text_type(by_extension)) {
+				return by_extension;
+			}
+			if (by_content != file_type::unknown) {
+				return by_content;
+			}
+			return detail::signatures().checkable(by_extension) ? file_type::unknown : by_extension;
+		}
+
+		struct file_classification {
+			file_type type         = file_type::unknown;
+			file_type by_extension = file_type::unknown;
+			file_type by_content   = file_type::unknown; // unknown if the file could not be read
+			int       error        = 0;                  // as loaded_file::error, type is by_extension then
+		};
+
+		struct classify_options {
+			uint64_t head_bytes   = 4096; // read from the start of each file
+			unsigned in_flight    = 64;
+			bool     use_io_uring = true;
+		};
+
+		/* classifies the files at paths[0, count), one result per path in the order of paths */
+		inline std::vector<file_classification> classify_files(const std::string_view* const paths, const size_t count,
+						const classify_options& options = {})
+		{
+			std::vector<file_classification> ret(count);
+			bulk_load_options                load;
+			load.in_flight    = options.in_flight;
+			load.use_io_uring = options.use_io_uring;
+			load.max_bytes    = options.head_bytes;
+			load_files(paths, count, [&](const loaded_file& file) {
+				auto& r        = ret[file.index];
+				r.by_extension = extension_type(paths[file.index]);
+				r.error        = file.error;
+				if (file.error) {
+					r.type = r.by_extension;
+					return;
+				}
+				r.by_content = content_type(file.contents);
+				r.type       = reconcile_file_type(r.by_extension, r.by_content);
+			}, load);
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,285 @@
+﻿#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+Non cryptographic hashing shared by the path tables. FNV-1a is used where a hash has to be
+built incrementally one (canonicalized) byte at a time, mix() finishes it into something
+with well distributed high and low bits for bucketing.
+
+bytes() hashes a whole string 8 bytes at a time, for caches keyed by strings that are hashed
+often. siphash() is keyed (SipHash-2-4), for hashes that must not be computed or forged without
+the key. xxh64() is XXH64, for file contents, where throughput matters more than anything else,
+xxh64_state the same for contents read in pieces.
+*/
+namespace util {
+	namespace hash {
+		constexpr uint64_t fnv_offset = 14695981039346656037ull;
+		constexpr uint64_t fnv_prime  = 1099511628211ull;
+
+		constexpr inline uint64_t fnv_byte(uint64_t h, char c)
+		{
+			return (h ^ (uint8_t)c) * fnv_prime;
+		}
+
+		constexpr inline uint64_t fnv_range(uint64_t h, const char* first, const char* const last)
+		{
+			for (; first != last; ++first) {
+				h = fnv_byte(h, *first);
+			}
+			return h;
+		}
+
+		/* murmur3's 64 bit finalizer */
+		constexpr inline uint64_t mix(uint64_t h)
+		{
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		struct sip_key {
+			uint64_t k0 = 0;
+			uint64_t k1 = 0;
+		};
+
+		namespace detail {
+			inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+			{
+				v0 += v1;
+				v1 = std::rotl(v1, 13);
+				v1 ^= v0;
+				v0 = std::rotl(v0, 32);
+				v2 += v3;
+				v3 = std::rotl(v3, 16);
+				v3 ^= v2;
+				v0 += v3;
+				v3 = std::rotl(v3, 21);
+				v3 ^= v0;
+				v2 += v1;
+				v1 = std::rotl(v1, 17);
+				v1 ^= v2;
+				v2 = std::rotl(v2, 32);
+			}
+
+			inline uint64_t load_le64(const char* p)
+			{
+				// byte by byte so it is little endian everywhere, compilers fold it into one load
+				uint64_t ret = 0;
+				for (int i = 0; i < 8; i++) {
+					ret |= uint64_t{(uint8_t)p[i]} << (8 * i);
+				}
+				return ret;
+			}
+
+			inline uint32_t load_le32(const char* p)
+			{
+				uint32_t ret = 0;
+				for (int i = 0; i < 4; i++) {
+					ret |= uint32_t{(uint8_t)p[i]} << (8 * i);
+				}
+				return ret;
+			}
+
+			constexpr uint64_t xxh_prime1 = 0x9e3779b185ebca87ull;
+			constexpr uint64_t xxh_prime2 = 0xc2b2ae3d27d4eb4full;
+			constexpr uint64_t xxh_prime3 = 0x165667b19e3779f9ull;
+			constexpr uint64_t xxh_prime4 = 0x85ebca77c2b2ae63ull;
+			constexpr uint64_t xxh_prime5 = 0x27d4eb2f165667c5ull;
+
+			inline uint64_t xxh_round(uint64_t acc, const uint64_t input)
+			{
+				acc += input * xxh_prime2;
+				acc = std::rotl(acc, 31);
+				return acc * xxh_prime1;
+			}
+
+			inline uint64_t xxh_merge(uint64_t acc, const uint64_t v)
+			{
+				acc ^= xxh_round(0, v);
+				return acc * xxh_prime1 + xxh_prime4;
+			}
+		} // namespace detail
+
+		/* SipHash-2-4 of [data, data + size) under key */
+		inline uint64_t siphash(const sip_key& key, const char* const data, const size_t size)
+		{
+			uint64_t v0 = key.k0 ^ 0x736f6d6570736575ull;
+			uint64_t v1 = key.k1 ^ 0x646f72616e646f6dull;
+			uint64_t v2 = key.k0 ^ 0x6c7967656e657261ull;
+			uint64_t v3 = key.k1 ^ 0x7465646279746573ull;
+
+			const char* p    = data;
+			const char* tail = data + (size & ~size_t{7});
+			for (; p != tail; p += 8) {
+				const uint64_t m = detail::load_le64(p);
+				v3 ^= m;
+				detail::sip_round(v0, v1, v2, v3);
+				detail::sip_round(v0, v1, v2, v3);
+				v0 ^= m;
+			}
+			// the last 0 to 7 bytes, with the length in the top byte
+			uint64_t m = uint64_t{size} << 56;
+			for (size_t i = 0; i < (size & 7); i++) {
+				m |= uint64_t{(uint8_t)p[i]} << (8 * i);
+			}
+			v3 ^= m;
+			detail::sip_round(v0, v1, v2, v3);
+			detail::sip_round(v0, v1, v2, v3);
+			v0 ^= m;
+
+			v2 ^= 0xff;
+			for (int i = 0; i < 4; i++) {
+				detail::sip_round(v0, v1, v2, v3);
+			}
+			return v0 ^ v1 ^ v2 ^ v3;
+		}
+
+		/* hash of [data, data + size), a multiply and shift per 8 bytes */
+		inline uint64_t bytes(const char* const data, const size_t size)
+		{
+			uint64_t    h    = fnv_offset ^ (size * 0x9e3779b97f4a7c15ull);
+			const char* p    = data;
+			const char* tail = data + (size & ~size_t{7});
+			for (; p != tail; p += 8) {
+				h = (h ^ detail::load_le64(p)) * 0xbf58476d1ce4e5b9ull;
+				h ^= h >> 31;
+			}
+			uint64_t last = 0;
+			for (size_t i = 0; i < (size & 7); i++) {
+				last |= uint64_t{(uint8_t)p[i]} << (8 * i);
+			}
+			return mix(h ^ last);
+		}
+
+		namespace detail {
+			/* the four lanes of XXH64 folded into one */
+			inline uint64_t xxh_lanes(const uint64_t v1, const uint64_t v2, const uint64_t v3, const uint64_t v4)
+			{
+				uint64_t h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+				h          = xxh_merge(h, v1);
+				h          = xxh_merge(h, v2);
+				h          = xxh_merge(h, v3);
+				return xxh_merge(h, v4);
+			}
+
+			/* XXH64's last step over the fewer than 32 bytes [p, tail) the lanes did not take */
+			inline uint64_t xxh_finish(uint64_t h, const char* p, const char* const tail)
+			{
+				for (; tail - p >= 8; p += 8) {
+					h ^= xxh_round(0, load_le64(p));
+					h = std::rotl(h, 27) * xxh_prime1 + xxh_prime4;
+				}
+				if (tail - p >= 4) {
+					h ^= uint64_t{load_le32(p)} * xxh_prime1;
+					h = std::rotl(h, 23) * xxh_prime2 + xxh_prime3;
+					p += 4;
+				}
+				for (; p != tail; ++p) {
+					h ^= uint64_t{(uint8_t)*p} * xxh_prime5;
+					h = std::rotl(h, 11) * xxh_prime1;
+				}
+				h ^= h >> 33;
+				h *= xxh_prime2;
+				h ^= h >> 29;
+				h *= xxh_prime3;
+				h ^= h >> 32;
+				return h;
+			}
+		} // namespace detail
+
+		/* XXH64 of [data, data + size) */
+		inline uint64_t xxh64(const char* const data, const size_t size, const uint64_t seed = 0)
+		{
+			using namespace detail;
+			const char*       p    = data;
+			const char* const tail = data + size;
+			uint64_t          h    = 0;
+			if (size >= 32) {
+				// four independent lanes of 8 bytes, the loop the compiler keeps in registers
+				uint64_t          v1    = seed + xxh_prime1 + xxh_prime2;
+				uint64_t          v2    = seed + xxh_prime2;
+				uint64_t          v3    = seed;
+				uint64_t          v4    = seed - xxh_prime1;
+				const char* const limit = tail - 32;
+				do {
+					v1 = xxh_round(v1, load_le64(p));
+					v2 = xxh_round(v2, load_le64(p + 8));
+					v3 = xxh_round(v3, load_le64(p + 16));
+					v4 = xxh_round(v4, load_le64(p + 24));
+					p += 32;
+				} while (p <= limit);
+				h = xxh_lanes(v1, v2, v3, v4);
+			} else {
+				h = seed + xxh_prime5;
+			}
+			return xxh_finish(h + size, p, tail);
+		}
+
+		/* XXH64 of data given in pieces, digest() equals xxh64() of the pieces concatenated */
+		class xxh64_state {
+		public:
+			explicit xxh64_state(const uint64_t seed = 0) : seed(seed)
+			{
+				v[0] = seed + detail::xxh_prime1 + detail::xxh_prime2;
+				v[1] = seed + detail::xxh_prime2;
+				v[2] = seed;
+				v[3] = seed - detail::xxh_prime1;
+			}
+
+			void update(const char* data, size_t size)
+			{
+				total += size;
+				if (buffered + size < 32) {
+					if (size) {
+						std::memcpy(buffer + buffered, data, size);
+					}
+					buffered += size;
+					return;
+				}
+				if (buffered) {
+					const size_t fill = 32 - buffered;
+					std::memcpy(buffer + buffered, data, fill);
+					consume(buffer);
+					data += fill;
+					size -= fill;
+					buffered = 0;
+				}
+				for (; size >= 32; data += 32, size -= 32) {
+					consume(data);
+				}
+				if (size) {
+					std::memcpy(buffer, data, size);
+				}
+				buffered = size;
+			}
+
+			uint64_t digest() const
+			{
+				const uint64_t h = total >= 32 ? detail::xxh_lanes(v[0], v[1], v[2], v[3]) : seed + detail::xxh_prime5;
+				return detail::xxh_finish(h + total, buffer, buffer + buffered);
+			}
+
+		private:
+			void consume(const char* const p)
+			{
+				v[0] = detail::xxh_round(v[0], detail::load_le64(p));
+				v[1] = detail::xxh_round(v[1], detail::load_le64(p + 8));
+				v[2] = detail::xxh_round(v[2], detail::load_le64(p + 16));
+				v[3] = detail::xxh_round(v[3], detail::load_le64(p + 24));
+			}
+
+			uint64_t seed;
+			uint64_t v[4];
+			uint64_t total    = 0;
+			char     buffer[32];
+			size_t   buffered = 0;
+		};
+	} // namespace hash
+} // namespace util
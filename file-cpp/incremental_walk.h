@@ -0,0 +1,410 @@
+﻿#pragma once
+
+#include "file.h"
+#include "parallel.h"
+#include "trace.h"
+#include "walk.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/*
+Rescans a tree by listing only the directories that changed since the last scan, for trees that
+are mostly static between scans.
+
+	util::utf8::walk_index index;
+	util::mapped_file previous("tree.idx");
+	if (previous)
+		index.load(previous.view());
+	auto result = util::utf8::incremental_walk("/archive", index);
+	for (const auto& c : result.changes)
+		update(c.path, c.kind, c.directory);
+	index.for_each([](std::string_view path, bool directory) { ... }); // the complete listing
+	util::write_file_atomic("tree.idx", index.serialize());
+
+A walk_index remembers every directory's mtime and its children, each child under its parent and
+filename. A directory's mtime changes when an entry is added to, removed from or renamed in it, so
+a directory whose mtime is unchanged has the children it had and is not listed again, only stat()ed.
+Directories are revalidated one level at a time, the directories of a level in parallel.
+
+The changes are the entries that were added or removed, an entry that went from file to directory
+or back is both. Everything below a removed directory is reported removed with it, everything
+below an added one added. Changes to the contents of files do not touch their directory and are
+not seen, see content_hash.h for those.
+
+mtimes have a granularity, a directory changed again within the same tick as the scan that saw it
+would look unchanged. Directories whose mtime was within racy_window of the previous scan's start
+are listed again to be safe. A directory that cannot be listed keeps its previous children and is
+listed again by the next scan. Entries are reported the way walk() reports them: symlinks are not
+followed, and a directory that cannot be stat()ed, such as one that is gone, is empty.
+*/
+namespace util {
+	namespace utf8 {
+		enum class walk_change_kind : char {
+			added,
+			removed,
+		};
+
+		struct walk_change {
+			std::string      path;
+			walk_change_kind kind      = walk_change_kind::added;
+			bool             directory = false;
+		};
+
+		struct incremental_walk_options {
+			unsigned                 threads     = 0; // 0 for one per hardware thread
+			std::chrono::nanoseconds racy_window = std::chrono::seconds(2);
+		};
+
+		struct incremental_walk_result {
+			std::vector<walk_change> changes;
+			size_t                   listed  = 0; // directories read again
+			size_t                   reused  = 0; // directories whose previous listing was kept
+			size_t                   entries = 0; // in the tree, not counting root
+		};
+
+		class walk_index;
+		inline incremental_walk_result incremental_walk(
+						std::string_view root, walk_index& index, const incremental_walk_options& options = {});
+
+		/* a scanned tree, see incremental_walk */
+		class walk_index {
+		public:
+			static constexpr uint32_t file = UINT32_MAX; // entry::directory of anything but a directory
+
+			struct entry {
+				std::string name;
+				uint32_t    directory = file; // into the index's directories
+			};
+
+			bool empty() const
+			{
+				return directories.empty();
+			}
+
+			const std::string& root() const
+			{
+				return root_path;
+			}
+
+			/* calls fn(path, directory) for every entry below root, depth first and by name within a directory */
+			template<typename Fn> void for_each(Fn&& fn) const
+			{
+				if (directories.empty()) {
+					return;
+				}
+				std::string path = root_path;
+				for_each_below(0, path, fn);
+			}
+
+			std::string serialize() const
+			{
+				std::string out(magic, sizeof(magic));
+				detail::append_varint(out, root_path.size());
+				out.append(root_path);
+				detail::append_varint(out, static_cast<uint64_t>(scanned_ns));
+				detail::append_varint(out, directories.size());
+				for (const auto& d : directories) {
+					detail::append_varint(out, static_cast<uint64_t>(d.mtime_ns));
+					detail::append_varint(out, d.children.size());
+					for (const auto& e : d.children) {
+						detail::append_varint(out, e.name.size());
+						out.append(e.name);
+						detail::append_varint(out, e.directory == file ? 0 : uint64_t{e.directory} + 1);
+					}
+				}
+				return out;
+			}
+
+			/* replaces the index with a serialized one, false (and an empty index) if bytes are not one */
+			bool load(std::string_view in)
+			{
+				*this = {};
+				walk_index loaded;
+				uint64_t   scanned = 0;
+				uint64_t   count   = 0;
+				if (in.size() < sizeof(magic) || std::memcmp(in.data(), magic, sizeof(magic)) != 0) {
+					return false;
+				}
+				in.remove_prefix(sizeof(magic));
+				std::string_view root;
+				if (!detail::read_bytes(in, root) || !detail::read_varint(in, scanned) ||
+								!detail::read_varint(in, count) || count > in.size() || count == 0) {
+					return false;
+				}
+				loaded.root_path.assign(root);
+				loaded.scanned_ns = static_cast<int64_t>(scanned);
+				loaded.directories.resize(static_cast<size_t>(count));
+				std::vector<bool> seen(static_cast<size_t>(count)); // has a parent, the root never does
+				for (size_t id = 0; id < loaded.directories.size(); id++) {
+					auto&    d        = loaded.directories[id];
+					uint64_t mtime    = 0;
+					uint64_t children = 0;
+					if (!detail::read_varint(in, mtime) || !detail::read_varint(in, children) ||
+									children > in.size()) {
+						return false;
+					}
+					d.mtime_ns = static_cast<int64_t>(mtime);
+					d.children.resize(static_cast<size_t>(children));
+					for (auto& e : d.children) {
+						std::string_view name;
+						uint64_t         directory = 0;
+						if (!detail::read_bytes(in, name) || !detail::read_varint(in, directory)) {
+							return false;
+						}
+						// directories are numbered in the order they were found, so a child always comes after its
+						// parent and the index cannot hold a cycle, and each has one parent so it is a tree
+						if (directory != 0 && (directory - 1 <= id || directory - 1 >= count || seen[directory - 1])) {
+							return false;
+						}
+						if (directory != 0) {
+							seen[directory - 1] = true;
+						}
+						e.name.assign(name);
+						e.directory = directory == 0 ? file : static_cast<uint32_t>(directory - 1);
+					}
+				}
+				*this = std::move(loaded);
+				return true;
+			}
+
+		private:
+			friend incremental_walk_result incremental_walk(
+							std::string_view root, walk_index& index, const incremental_walk_options& options);
+
+			static constexpr char magic[8] = {'F', 'W', 'I', 'D', 'X', '0', '0', '1'};
+
+			struct directory_record {
+				int64_t            mtime_ns = 0; // 0 if it could not be read
+				std::vector<entry> children;     // sorted by name
+			};
+
+			template<typename Fn> void for_each_below(const uint32_t id, std::string& path, Fn& fn) const
+			{
+				const size_t size = path.size();
+				for (const auto& e : directories[id].children) {
+					if (!path.empty() && !is_slash(path.back())) {
+						path.push_back('/');
+					}
+					path.append(e.name);
+					fn(std::string_view(path), e.directory != file);
+					if (e.directory != file) {
+						for_each_below(e.directory, path, fn);
+					}
+					path.resize(size);
+				}
+			}
+
+			std::string                   root_path;
+			int64_t                       scanned_ns = 0; // wall clock at the start of the scan
+			std::vector<directory_record> directories;    // 0 is root
+		};
+
+		namespace detail {
+			/* mtime of the directory at path in nanoseconds, 0 if it cannot be read */
+			inline int64_t directory_mtime(const std::string& path, const bool follow)
+			{
+#if defined(_WIN32)
+				(void)follow;
+				WIN32_FILE_ATTRIBUTE_DATA data = {};
+				if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) ||
+								!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+					return 0;
+				}
+				// 100ns ticks since 1601, the offset does not matter as long as it is the same for every call
+				const uint64_t ticks = (uint64_t{data.ftLastWriteTime.dwHighDateTime} << 32) |
+								data.ftLastWriteTime.dwLowDateTime;
+				return static_cast<int64_t>(ticks * 100 - 11644473600ull * 1000000000ull);
+#else
+				struct stat st = {};
+				if ((follow ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st)) != 0 || !S_ISDIR(st.st_mode)) {
+					return 0;
+				}
+#if defined(__APPLE__)
+				return static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+				return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+			}
+
+			inline std::string join_path(const std::string_view parent, const std::string_view name)
+			{
+				std::string ret(parent);
+				if (!ret.empty() && !is_slash(ret.back())) {
+					ret.push_back('/');
+				}
+				ret.append(name);
+				return ret;
+			}
+		} // namespace detail
+
+		/*
+		brings index up to date with the tree at root and returns what changed, see the top of this file. an
+		empty index, or one of another root, is scanned in full and everything is reported added
+		*/
+		inline incremental_walk_result incremental_walk(
+						const std::string_view root, walk_index& index, const incremental_walk_options& options)
+		{
+			using entry = walk_index::entry;
+			constexpr uint32_t file = walk_index::file;
+			constexpr uint32_t none = UINT32_MAX;
+
+			// one directory of the current level, and what revalidating it found
+			struct task {
+				uint32_t           id       = 0;    // in the new index
+				uint32_t           previous = none; // in the old index
+				std::string        path;
+				int64_t            mtime_ns = 0;
+				bool               reused   = false;
+				bool               failed   = false; // listing it failed, its previous children are kept
+				std::vector<entry> children;         // when listed again, sorted by name
+			};
+
+			incremental_walk_result ret;
+			walk_index              old = std::move(index);
+			if (old.root_path != root) {
+				old = {};
+			}
+			index            = {};
+			index.root_path  = std::string(root);
+			index.scanned_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::system_clock::now().time_since_epoch())
+											   .count();
+			index.directories.emplace_back();
+			const int64_t racy_after = old.scanned_ns - static_cast<int64_t>(options.racy_window.count());
+
+			// reports an entry of the old index as removed, and everything below it if it is a directory
+			const auto removed = [&](const std::string& parent, const entry& e) {
+				std::string path = detail::join_path(parent, e.name);
+				ret.changes.push_back({path, walk_change_kind::removed, e.directory != file});
+				if (e.directory != file) {
+					auto below = [&](const std::string_view p, const bool directory) {
+						ret.changes.push_back({std::string(p), walk_change_kind::removed, directory});
+					};
+					old.for_each_below(e.directory, path, below);
+				}
+			};
+
+			std::vector<task> level(1);
+			level[0].path     = index.root_path;
+			level[0].previous = old.empty() ? none : 0;
+			for (uint32_t depth = 0; !level.empty(); depth++) {
+				// stat every directory of the level and list those that changed, in parallel
+				const unsigned n = std::min(parallel::resolve_threads(options.threads),
+								static_cast<unsigned>(std::min<size_t>(level.size() / 16 + 1, 256)));
+				std::atomic<size_t> next{0};
+				FILE_CPP_PROBE2(rescan_begin, level.size(), depth);
+				parallel::run(n, [&](unsigned) {
+					for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < level.size();) {
+						task& t    = level[i];
+						t.mtime_ns = detail::directory_mtime(t.path, t.id == 0);
+						if (t.previous != none) {
+							const int64_t before = old.directories[t.previous].mtime_ns;
+							t.reused             = t.mtime_ns != 0 && t.mtime_ns == before && before < racy_after;
+						}
+						if (!t.reused && t.mtime_ns != 0) {
+							const auto add = [&](const std::string_view name, bool directory) {
+								t.children.push_back({std::string(name), directory ? 0 : file});
+								return true;
+							};
+							if (!detail::list_directory(t.path, add)) {
+								// out of descriptors, permissions changed... nothing is known to have changed, and an
+								// mtime of 0 has it listed again by the next scan
+								t.mtime_ns = 0;
+								t.failed   = true;
+								t.children.clear();
+							}
+							std::sort(t.children.begin(), t.children.end(),
+											[](const entry& a, const entry& b) { return a.name < b.name; });
+						}
+					}
+				});
+				FILE_CPP_PROBE2(rescan_end, level.size(), depth);
+
+				// fill in the new index in level order, diffing listed directories against their old children
+				std::vector<task> next_level;
+				const auto        descend = [&](const std::string& parent, entry& e, const uint32_t previous) {
+					e.directory = static_cast<uint32_t>(index.directories.size());
+					index.directories.emplace_back();
+					task next;
+					next.id       = e.directory;
+					next.previous = previous;
+					next.path     = detail::join_path(parent, e.name);
+					next_level.push_back(std::move(next));
+				};
+				for (auto& t : level) {
+					static const std::vector<entry> no_children;
+					const auto& before = t.previous == none ? no_children : old.directories[t.previous].children;
+					if (t.reused || t.failed) {
+						ret.reused += t.reused;
+						ret.listed += t.failed;
+						t.children = before;
+						for (size_t i = 0; i < t.children.size(); i++) {
+							if (t.children[i].directory != file) {
+								descend(t.path, t.children[i], before[i].directory);
+							}
+						}
+					} else {
+						// both sorted by name, so one merge pass finds what was added and removed. an added
+						// directory has no previous children, so everything below it is reported added as its
+						// level is filled in
+						ret.listed++;
+						size_t i = 0;
+						for (auto& e : t.children) {
+							while (i != before.size() && before[i].name < e.name) {
+								removed(t.path, before[i++]);
+							}
+							const bool directory = e.directory != file;
+							uint32_t   previous  = none;
+							bool       same      = false;
+							if (i != before.size() && before[i].name == e.name) {
+								same = (before[i].directory != file) == directory;
+								if (same) {
+									previous = before[i].directory;
+								} else {
+									removed(t.path, before[i]); // a file that became a directory or the other way round
+								}
+								i++;
+							}
+							if (!same) {
+								const auto path = detail::join_path(t.path, e.name);
+								ret.changes.push_back({path, walk_change_kind::added, directory});
+							}
+							if (directory) {
+								descend(t.path, e, previous);
+							}
+						}
+						while (i != before.size()) {
+							removed(t.path, before[i++]);
+						}
+					}
+					ret.entries += t.children.size();
+					auto& d    = index.directories[t.id];
+					d.mtime_ns = t.mtime_ns;
+					d.children = std::move(t.children);
+				}
+				level = std::move(next_level);
+			}
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,267 @@
+﻿#pragma once
+
+#include "file.h"
+#include "simd.h"
+#include <string_view>
+#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/*
+Finds file references in compiler, test runner and stack trace output.
+
+	util::utf8::find_path_references(log, [](const util::utf8::path_reference& ref) {
+		report(ref.path, ref.filename(), ref.line, ref.column, ref.offset);
+		return true; // false stops the scan
+	});
+
+	C:\src\a.cpp(12,5): error C2065    -> C:\src\a.cpp, line 12, column 5
+	/src/b.h:40:2: warning: unused     -> /src/b.h, line 40, column 2
+	at foo (src/x.js:10:3)             -> src/x.js, line 10, column 3
+
+A reference is a run of characters between delimiters (whitespace, quotes, brackets, ',', ';', '=',
+'|', '<' and '>') that holds a '/' or '\\', or that names a file with an extension and has a
+location. The scan jumps from one '/', '\\' or ':' to the next with SSE2 and only looks at the
+tokens around them, so text without any is skipped at memory speed.
+
+A location is a trailing :line or :line:column, or a (line) or (line,column) right after the token.
+A colon followed by anything but digits stays in the path, so drive letters (C:) and alternate
+data streams (a.txt:stream) are left for root_name() and extension() to handle, and a lone drive
+letter followed by digits (C:12) is read as a drive relative path rather than a location. Tokens
+holding "://" (urls) and tokens made only of digits and punctuation (dates, times, fractions) are
+not references.
+*/
+namespace util {
+	namespace utf8 {
+		struct path_reference {
+			std::string_view path;                 // without the location
+			size_t           offset           = 0; // of path in the text
+			size_t           end              = 0; // one past the reference in the text, location included
+			uint32_t         line             = 0; // 0 when the reference has no location
+			uint32_t         column           = 0; // 0 when the location has no column
+			uint32_t         filename_offset  = 0;
+			uint32_t         extension_offset = 0;
+
+			std::string_view filename() const
+			{
+				return path.substr(filename_offset);
+			}
+
+			/* as extension(), a trailing stream name is excluded */
+			std::string_view extension() const
+			{
+				const auto ext = path.substr(extension_offset);
+				return ext.substr(0, std::min(ext.find(':'), ext.size()));
+			}
+
+			std::string_view parent_path() const
+			{
+				return utf8::parent_path(path);
+			}
+		};
+
+		namespace detail {
+			enum reference_class : uint8_t {
+				reference_delimiter = 1, // ends a token
+				reference_separator = 2, // '/' or '\\'
+				reference_name      = 4, // anything but digits and punctuation
+			};
+
+			/* the class of every byte, so widening a hit to its token also classifies the token */
+			inline constexpr std::array<uint8_t, 256> reference_classes = [] {
+				std::array<uint8_t, 256> ret = {};
+				for (unsigned c = 0; c < 256; c++) {
+					const auto ch = static_cast<char>(c);
+					if (c <= ' ' || std::string_view("\"'`()[]{}<>,;=|").find(ch) != std::string_view::npos) {
+						ret[c] = reference_delimiter;
+					} else if (is_slash(ch)) {
+						ret[c] = reference_separator;
+					} else if ((c < '0' || c > '9') && ch != '.' && ch != ':' && ch != '-') {
+						ret[c] = reference_name;
+					}
+				}
+				return ret;
+			}();
+
+			constexpr uint8_t reference_class(char c)
+			{
+				return reference_classes[(uint8_t)c];
+			}
+
+			constexpr bool is_location_digit(char c)
+			{
+				return (uint8_t)((uint8_t)c - (uint8_t)'0') < 10;
+			}
+
+			inline const char* find_reference_candidate(const char* first, const char* const last)
+			{
+				// return the first '/', '\\' or ':' in [first, last); otherwise, last
+#if defined(FILE_CPP_SSE2)
+				for (; last - first >= 16; first += 16) {
+					const __m128i  v     = simd::load(first);
+					const __m128i  colon = _mm_cmpeq_epi8(v, _mm_set1_epi8(':'));
+					const uint32_t mask  = simd::movemask(_mm_or_si128(simd::is_slash(v), colon));
+					if (mask) {
+						return first + simd::count_trailing_zeros(mask);
+					}
+				}
+#endif
+				while (first != last && !is_slash(*first) && *first != ':') {
+					++first;
+				}
+				return first;
+			}
+
+			inline bool parse_location_number(const char*& p, const char* const last, uint32_t& out)
+			{
+				// 1 to 9 digits, so the value fits
+				const char* const first = p;
+				out                     = 0;
+				for (; p != last && is_location_digit(*p) && p - first < 9; ++p) {
+					out = out * 10 + static_cast<uint32_t>(*p - '0');
+				}
+				return p != first && (p == last || !is_location_digit(*p));
+			}
+
+			inline const char* find_trailing_location(const char* const first, const char* const last, uint32_t& out)
+			{
+				// return the ':' of a trailing :digits in [first, last); otherwise, nullptr
+				const char* colon = last;
+				while (colon != first && is_location_digit(colon[-1])) {
+					--colon;
+				}
+				if (colon == last || last - colon > 9 || colon - first < 2 || colon[-1] != ':') {
+					return nullptr;
+				}
+				--colon;
+				if (colon - first == 1 && has_drive_letter_prefix(first, last)) {
+					return nullptr; // C:12 is a drive relative path
+				}
+				const char* p = colon + 1;
+				parse_location_number(p, last, out);
+				return colon;
+			}
+
+			/*
+			parses the token [first, last) of text into ref, false if it is not a reference. kind is the union of the
+			classes of the token's bytes
+			*/
+			inline bool parse_reference(const std::string_view text, const char* const first, const char* const last,
+							const uint8_t kind, path_reference& ref)
+			{
+				const char* const text_end = text.data() + text.size();
+				const char*       path_end = last;
+				const char*       ref_end  = last;
+				uint32_t          line     = 0;
+				uint32_t          column   = 0;
+				bool              located  = false;
+
+				if (last != text_end && *last == '(') {
+					// (line) or (line,column) right after the token
+					const char* p = last + 1;
+					located       = parse_location_number(p, text_end, line);
+					if (located && p != text_end && *p == ',') {
+						++p;
+						located = parse_location_number(p, text_end, column);
+					}
+					located = located && p != text_end && *p == ')';
+					if (located) {
+						ref_end = p + 1;
+					}
+				}
+				if (!located) {
+					// :line or :line:column, possibly followed by the ':' that introduces a message
+					const char* tail = last;
+					if (tail - first > 1 && tail[-1] == ':') {
+						--tail;
+					}
+					uint32_t n = 0;
+					line       = 0;
+					column     = 0;
+					if (const auto colon = find_trailing_location(first, tail, n)) {
+						path_end = colon;
+						ref_end  = tail;
+						line     = n;
+						located  = true;
+						if (const auto before = find_trailing_location(first, colon, n)) {
+							path_end = before;
+							column   = line;
+							line     = n;
+						}
+					}
+				}
+				if (!located && path_end - first > 1) {
+					if (path_end[-1] == ':') {
+						--path_end; // "In file included from /src/a.h:"
+					} else if (path_end[-1] == '.' && path_end[-2] != '.' && !is_slash(path_end[-2])) {
+						--path_end; // the full stop ending a sentence
+					}
+					ref_end = path_end;
+				}
+
+				// something other than digits and punctuation (dates, times), and not a url. the location that was
+				// cut off is digits and punctuation, so kind still holds for path
+				const auto path = std::string_view(first, static_cast<size_t>(path_end - first));
+				if (!(kind & reference_name) || path.find("://") != std::string_view::npos) {
+					return false;
+				}
+				const auto name = find_filename(path.data(), path_end);
+				const auto ext  = find_extension(name, std::find(name, path_end, ':'));
+				if (!(kind & reference_separator) && (!located || ext == path_end || *ext != '.')) {
+					return false;
+				}
+				ref.path             = path;
+				ref.filename_offset  = static_cast<uint32_t>(name - first);
+				ref.extension_offset = static_cast<uint32_t>(ext - first);
+				ref.offset           = static_cast<size_t>(first - text.data());
+				ref.end              = static_cast<size_t>(ref_end - text.data());
+				ref.line             = line;
+				ref.column           = column;
+				return true;
+			}
+		} // namespace detail
+
+		/*
+		calls fn(const path_reference&) for every file reference in text in order, fn returns false to stop.
+		returns the number of references reported
+		*/
+		template<typename Fn> inline size_t find_path_references(const std::string_view text, Fn&& fn)
+		{
+			const char* const data  = text.data();
+			const char* const tail  = data + text.size();
+			const char*       p     = data;
+			size_t            found = 0;
+			path_reference    ref;
+			while ((p = detail::find_reference_candidate(p, tail)) != tail) {
+				// widen the hit to its token, the scan resumes after it
+				const char* first = p;
+				const char* last  = p;
+				uint8_t     kind  = 0;
+				for (; first != data; --first) {
+					const uint8_t c = detail::reference_class(first[-1]);
+					if (c & detail::reference_delimiter) {
+						break;
+					}
+					kind |= c;
+				}
+				for (; last != tail; ++last) {
+					const uint8_t c = detail::reference_class(*last);
+					if (c & detail::reference_delimiter) {
+						break;
+					}
+					kind |= c;
+				}
+				p = last;
+				if (detail::parse_reference(text, first, last, kind, ref)) {
+					found++;
+					if (!fn(static_cast<const path_reference&>(ref))) {
+						break;
+					}
+					p = data + ref.end > last ? data + ref.end : last;
+				}
+			}
+			return found;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,174 @@
+﻿#pragma once
+
+#include <string_view>
+#include <string>
+#include <cstddef>
+#include <cstdio>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Read only memory mapping of a whole file, used to query on-disk indexes in place, and
+write_file_atomic() to produce such files without readers ever seeing a partial one.
+
+	util::mapped_file file("index.bin");
+	if (file)
+		use(file.view());
+*/
+namespace util {
+	class mapped_file {
+	public:
+		mapped_file() = default;
+
+		explicit mapped_file(const char* const path)
+		{
+			open(path);
+		}
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		mapped_file(mapped_file&& other) noexcept
+						: data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+		{
+		}
+
+		mapped_file& operator=(mapped_file&& other) noexcept
+		{
+			if (this != &other) {
+				close();
+				data_ = std::exchange(other.data_, nullptr);
+				size_ = std::exchange(other.size_, 0);
+			}
+			return *this;
+		}
+
+		~mapped_file()
+		{
+			close();
+		}
+
+		/* maps path, returns false (and leaves the mapping empty) on failure. empty files map to an empty view */
+		bool open(const char* const path)
+		{
+			close();
+#if defined(_WIN32)
+			const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+							OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER size = {};
+			bool          ok   = GetFileSizeEx(file, &size) != 0;
+			if (ok && size.QuadPart > 0) {
+				const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				ok                   = mapping != nullptr;
+				if (ok) {
+					data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					ok    = data_ != nullptr;
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+			size_ = ok && data_ ? static_cast<size_t>(size.QuadPart) : 0;
+			return ok;
+#else
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat st = {};
+			bool        ok = ::fstat(fd, &st) == 0;
+			if (ok && st.st_size > 0) {
+				void* const p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+				ok            = p != MAP_FAILED;
+				if (ok) {
+					data_ = static_cast<const char*>(p);
+					size_ = static_cast<size_t>(st.st_size);
+				}
+			}
+			::close(fd);
+			return ok;
+#endif
+		}
+
+		void close()
+		{
+			if (data_) {
+#if defined(_WIN32)
+				UnmapViewOfFile(data_);
+#else
+				::munmap(const_cast<char*>(data_), size_);
+#endif
+			}
+			data_ = nullptr;
+			size_ = 0;
+		}
+
+		const char* data() const
+		{
+			return data_;
+		}
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+		std::string_view view() const
+		{
+			return std::string_view(data_, size_);
+		}
+
+		explicit operator bool() const
+		{
+			return data_ != nullptr;
+		}
+
+	private:
+		const char* data_ = nullptr;
+		size_t      size_ = 0;
+	};
+
+	/*
+	writes bytes to path + ".tmp" and renames it over path, so path always holds either the old or
+	the new contents. returns false on failure, in which case path is untouched
+	*/
+	inline bool write_file_atomic(const std::string& path, const std::string_view bytes)
+	{
+		const std::string tmp  = path + ".tmp";
+		FILE* const       file = std::fopen(tmp.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+		bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+		ok      = std::fflush(file) == 0 && ok;
+#if !defined(_WIN32)
+		ok = ::fsync(::fileno(file)) == 0 && ok;
+#endif
+		ok = std::fclose(file) == 0 && ok;
+#if defined(_WIN32)
+		ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		ok = ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+		if (!ok) {
+			std::remove(tmp.c_str());
+		}
+		return ok;
+	}
+} // namespace util
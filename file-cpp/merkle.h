@@ -0,0 +1,586 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "parallel.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/*
+Merkle tree over a path hierarchy, every directory keeps a digest of everything below it so
+two snapshots can be compared by only descending into subtrees whose digests differ.
+
+Leaves carry a caller provided digest (a content hash, or size and mtime through
+file_digest()). A directory's digest is the sum of hash(name, digest) of its children, an
+order independent multiset hash, which lets an update fix the digests of a changed path's
+ancestors in O(depth) without looking at any siblings. This is for change detection, not
+for security.
+
+	auto tree = util::utf8::merkle_tree::build(paths, leaves, count);
+	tree.update("src/a.cpp", util::utf8::file_digest(size, mtime));
+	util::write_file_atomic("tree.bin", tree.serialize());
+
+	util::mapped_file old_file("old.bin"), new_file("tree.bin");
+	util::utf8::merkle_diff(util::utf8::merkle_view(old_file.view()), util::utf8::merkle_view(new_file.view()),
+		[](std::string_view path, util::utf8::merkle_change change) { ... });
+
+Paths are split with parent_path/filename and their root_path becomes the topmost node, so
+"/a/b" and "a/b" are different trees. Components are compared exactly (case sensitive).
+*/
+namespace util {
+	namespace utf8 {
+		struct merkle_digest {
+			uint64_t lo = 0;
+			uint64_t hi = 0;
+
+			bool operator==(const merkle_digest& other) const
+			{
+				return lo == other.lo && hi == other.hi;
+			}
+
+			bool operator!=(const merkle_digest& other) const
+			{
+				return !(*this == other);
+			}
+
+			merkle_digest& operator+=(const merkle_digest& other)
+			{
+				lo += other.lo;
+				hi += other.hi;
+				return *this;
+			}
+
+			merkle_digest& operator-=(const merkle_digest& other)
+			{
+				lo -= other.lo;
+				hi -= other.hi;
+				return *this;
+			}
+		};
+
+		inline merkle_digest file_digest(uint64_t content_hash)
+		{
+			return {hash::mix(content_hash ^ 0x243f6a8885a308d3ull), hash::mix(content_hash + 0x13198a2e03707344ull)};
+		}
+
+		inline merkle_digest file_digest(uint64_t size, int64_t mtime_ns)
+		{
+			return file_digest(hash::mix(size) ^ static_cast<uint64_t>(mtime_ns));
+		}
+
+		enum class merkle_change { added, removed, modified };
+
+		namespace detail {
+			inline merkle_digest merkle_contribution(uint64_t name_hash, const merkle_digest& d)
+			{
+				// what a child adds to its parent's digest
+				return {hash::mix(name_hash ^ hash::mix(d.lo ^ 0xa4093822299f31d0ull)),
+								hash::mix((name_hash + 0x082efa98ec4e6c89ull) ^ hash::mix(d.hi) ^ d.lo)};
+			}
+
+			struct merkle_disk_header {
+				char     magic[8];
+				uint32_t node_count;
+				uint32_t names_size;
+			};
+
+			struct merkle_disk_node {
+				uint64_t lo;
+				uint64_t hi;
+				uint32_t name_offset;
+				uint32_t name_size;
+				uint32_t first_child; // children are contiguous and sorted by name
+				uint32_t child_count;
+			};
+
+			constexpr char merkle_magic[8] = {'F', 'M', 'E', 'R', 'K', 'L', 'E', '1'};
+
+			/* calls fn(name) for root_path and then every component of path, top down */
+			template<typename Fn> inline void for_each_component(const std::string_view path, Fn&& fn)
+			{
+				// walk up with parent_path/filename, then hand the components out top down
+				std::string_view              stack_names[64];
+				std::vector<std::string_view> heap_names;
+				size_t                        depth = 0;
+				auto                          p     = path;
+				const auto                    root  = root_path(path);
+				while (p.size() > root.size()) {
+					const auto name = filename(p);
+					if (name.empty()) { // parent_path of a path ending in separators drops just the separators
+						p = parent_path(p);
+						continue;
+					}
+					if (depth < 64) {
+						stack_names[depth] = name;
+					} else {
+						heap_names.push_back(name);
+					}
+					depth++;
+					p = parent_path(p);
+				}
+
+				fn(root);
+				while (depth > 64) {
+					fn(heap_names[--depth - 64]);
+				}
+				while (depth) {
+					fn(stack_names[--depth]);
+				}
+			}
+		} // namespace detail
+
+		class merkle_tree {
+		public:
+			/* builds a tree over paths[i] with leaf digests leaves[i], digests are propagated on threads threads */
+			static merkle_tree build(const std::string_view* const paths, const merkle_digest* const leaves,
+							const size_t count, const unsigned threads = 0)
+			{
+				merkle_tree ret;
+				for (size_t i = 0; i < count; i++) {
+					const auto n = ret.intern(paths[i]);
+					ret.set_present(n, true);
+					ret.nodes[n].leaf = leaves[i];
+				}
+				ret.propagate_all(parallel::resolve_threads(threads));
+				return ret;
+			}
+
+			/* adds or changes the leaf digest of path and fixes up its ancestors */
+			void update(const std::string_view path, const merkle_digest leaf)
+			{
+				const auto n = intern(path);
+				change_node(n, [&] {
+					nodes[n].digest -= nodes[n].leaf;
+					nodes[n].digest += leaf;
+					nodes[n].leaf = leaf;
+					set_present(n, true);
+				});
+			}
+
+			/* removes path, descendants that are still present keep it (and its digest) alive */
+			void remove(const std::string_view path)
+			{
+				const auto n = find_node(path);
+				if (!n || !nodes[n].explicit_) {
+					return;
+				}
+				change_node(n, [&] {
+					nodes[n].digest -= nodes[n].leaf;
+					nodes[n].leaf = {};
+					set_present(n, false);
+				});
+			}
+
+			struct change {
+				std::string_view path;
+				merkle_digest    leaf;
+				bool             removed = false;
+			};
+
+			void update(const change* const changes, const size_t count)
+			{
+				for (size_t i = 0; i < count; i++) {
+					if (changes[i].removed) {
+						remove(changes[i].path);
+					} else {
+						update(changes[i].path, changes[i].leaf);
+					}
+				}
+			}
+
+			/* digest of a file or directory, nullptr if path is not in the tree */
+			const merkle_digest* find(const std::string_view path) const
+			{
+				const auto n = find_node(path);
+				return n && present(n) ? &nodes[n].digest : nullptr;
+			}
+
+			/* digest over every root */
+			const merkle_digest& root_digest() const
+			{
+				return nodes[0].digest;
+			}
+
+			/* the tree in the format read by merkle_view */
+			std::string serialize() const
+			{
+				// breadth first so the children of a node are contiguous, sorted by name for binary searches
+				std::vector<uint32_t> order = {0};
+				std::vector<uint32_t> child_start;
+				std::vector<uint32_t> child_count;
+				std::vector<uint32_t> children;
+				for (size_t i = 0; i < order.size(); i++) {
+					children.clear();
+					for (auto c = nodes[order[i]].first_child; c; c = nodes[c].next_sibling) {
+						if (present(c)) {
+							children.push_back(c);
+						}
+					}
+					std::sort(children.begin(), children.end(),
+									[&](uint32_t a, uint32_t b) { return name_of(a) < name_of(b); });
+					child_start.push_back(static_cast<uint32_t>(order.size()));
+					child_count.push_back(static_cast<uint32_t>(children.size()));
+					order.insert(order.end(), children.begin(), children.end());
+				}
+
+				std::string names;
+				std::string ret(sizeof(detail::merkle_disk_header) + order.size() * sizeof(detail::merkle_disk_node),
+								'\0');
+				auto disk = reinterpret_cast<detail::merkle_disk_node*>(&ret[sizeof(detail::merkle_disk_header)]);
+				for (size_t i = 0; i < order.size(); i++) {
+					const auto& n  = nodes[order[i]];
+					const auto  nm = name_of(order[i]);
+					disk[i]        = {n.digest.lo, n.digest.hi, static_cast<uint32_t>(names.size()),
+									static_cast<uint32_t>(nm.size()), child_start[i], child_count[i]};
+					names.append(nm);
+				}
+
+				detail::merkle_disk_header header = {};
+				std::memcpy(header.magic, detail::merkle_magic, sizeof(header.magic));
+				header.node_count = static_cast<uint32_t>(order.size());
+				header.names_size = static_cast<uint32_t>(names.size());
+				std::memcpy(&ret[0], &header, sizeof(header));
+				return ret + names;
+			}
+
+		private:
+			struct node {
+				uint32_t      parent           = 0;
+				uint32_t      first_child      = 0;
+				uint32_t      next_sibling     = 0;
+				uint32_t      name_offset      = 0;
+				uint32_t      name_size        = 0;
+				uint32_t      depth            = 0;
+				uint32_t      present_children = 0;
+				bool          explicit_        = false; // added as a path itself, not only as an ancestor
+				uint64_t      name_hash        = 0;
+				merkle_digest leaf;
+				merkle_digest digest; // leaf + sum of the children's contributions
+			};
+
+			merkle_tree()
+			{
+				nodes.emplace_back(); // 0 is the parent of every root_path
+				slots.assign(1024, 0);
+			}
+
+			std::string_view name_of(uint32_t n) const
+			{
+				return std::string_view(names.data() + nodes[n].name_offset, nodes[n].name_size);
+			}
+
+			bool present(uint32_t n) const
+			{
+				return n == 0 || nodes[n].explicit_ || nodes[n].present_children;
+			}
+
+			static uint64_t name_hash(const std::string_view name)
+			{
+				return hash::fnv_range(hash::fnv_offset, name.data(), name.data() + name.size());
+			}
+
+			merkle_digest contribution(uint32_t n) const
+			{
+				return present(n) ? detail::merkle_contribution(nodes[n].name_hash, nodes[n].digest) : merkle_digest{};
+			}
+
+			size_t slot_of(uint32_t parent, uint64_t name_hash) const
+			{
+				const auto h = hash::mix(name_hash ^ (parent * 0x9e3779b97f4a7c15ull));
+				return static_cast<size_t>(h) & (slots.size() - 1);
+			}
+
+			uint32_t find_child(uint32_t parent, const std::string_view name, uint64_t name_hash) const
+			{
+				for (auto i = slot_of(parent, name_hash); slots[i]; i = (i + 1) & (slots.size() - 1)) {
+					const auto& n = nodes[slots[i]];
+					if (n.parent == parent && n.name_hash == name_hash && name_of(slots[i]) == name) {
+						return slots[i];
+					}
+				}
+				return 0;
+			}
+
+			uint32_t find_node(const std::string_view path) const
+			{
+				uint32_t n     = 0;
+				bool     found = true;
+				detail::for_each_component(path, [&](std::string_view name) {
+					if (found) {
+						n     = find_child(n, name, name_hash(name));
+						found = n != 0;
+					}
+				});
+				return found ? n : 0;
+			}
+
+			uint32_t intern(const std::string_view path)
+			{
+				uint32_t n = 0;
+				detail::for_each_component(path, [&](std::string_view name) {
+					const auto h     = name_hash(name);
+					const auto child = find_child(n, name, h);
+					if (child) {
+						n = child;
+						return;
+					}
+
+					node c         = {};
+					c.parent       = n;
+					c.next_sibling = nodes[n].first_child;
+					c.name_offset  = static_cast<uint32_t>(names.size());
+					c.name_size    = static_cast<uint32_t>(name.size());
+					c.depth        = nodes[n].depth + 1;
+					c.name_hash    = h;
+					names.append(name);
+					const auto id        = static_cast<uint32_t>(nodes.size());
+					nodes[n].first_child = id;
+					nodes.push_back(c);
+
+					if (nodes.size() * 2 > slots.size()) {
+						slots.assign(slots.size() * 2, 0);
+						for (uint32_t i = 1; i < nodes.size(); i++) {
+							insert_slot(i);
+						}
+					} else {
+						insert_slot(id);
+					}
+					n = id;
+				});
+				return n;
+			}
+
+			void insert_slot(uint32_t id)
+			{
+				auto i = slot_of(nodes[id].parent, nodes[id].name_hash);
+				while (slots[i]) {
+					i = (i + 1) & (slots.size() - 1);
+				}
+				slots[i] = id;
+			}
+
+			void set_present(uint32_t n, bool value)
+			{
+				// mark n as explicitly present (or not), keeping the present child counts of its ancestors
+				const bool was = present(n);
+				nodes[n].explicit_ = value;
+				if (was == present(n)) {
+					return;
+				}
+				for (auto p = nodes[n].parent; p; p = nodes[p].parent) {
+					const bool parent_was = present(p);
+					nodes[p].present_children += value ? 1 : uint32_t(-1);
+					if (parent_was == present(p)) {
+						break;
+					}
+				}
+			}
+
+			template<typename Fn> void change_node(uint32_t n, Fn&& mutate)
+			{
+				// mutate() changes the leaf (and digest) or presence of n, then the change is pushed up to the root by
+				// replacing what each node on the way contributed to its parent
+				chain.clear();
+				for (auto x = n; x; x = nodes[x].parent) {
+					chain.push_back(contribution(x));
+				}
+				mutate();
+				for (size_t i = 0; n; i++) {
+					auto& parent = nodes[nodes[n].parent].digest;
+					parent -= chain[i];
+					parent += contribution(n);
+					n = nodes[n].parent;
+				}
+			}
+
+			void propagate_all(unsigned threads)
+			{
+				// bottom up one depth at a time, children of the same parent add to it concurrently
+				uint32_t max_depth = 0;
+				for (auto& n : nodes) {
+					n.digest  = n.leaf;
+					max_depth = std::max(max_depth, n.depth);
+				}
+				std::vector<std::vector<uint32_t>> levels(max_depth + 1);
+				for (uint32_t i = 1; i < nodes.size(); i++) {
+					levels[nodes[i].depth].push_back(i);
+				}
+
+				for (auto depth = max_depth; depth > 0; depth--) {
+					const auto& level = levels[depth];
+					const auto  used  = std::min(threads, static_cast<unsigned>(level.size() / 4096 + 1));
+					parallel::run(used, [&](unsigned t) {
+						const auto chunk = parallel::split(level.size(), used, t);
+						for (size_t i = chunk.first; i < chunk.last; i++) {
+							const auto c = contribution(level[i]);
+							auto&      d = nodes[nodes[level[i]].parent].digest;
+							std::atomic_ref<uint64_t>(d.lo).fetch_add(c.lo, std::memory_order_relaxed);
+							std::atomic_ref<uint64_t>(d.hi).fetch_add(c.hi, std::memory_order_relaxed);
+						}
+					});
+				}
+			}
+
+			std::vector<node>          nodes;
+			std::vector<uint32_t>      slots; // (parent, name) -> node, open addressing, 0 is empty
+			std::string                names;
+			std::vector<merkle_digest> chain; // scratch for change_node()
+		};
+
+		/* read only view of a serialized merkle_tree, eg: from a mapped_file */
+		class merkle_view {
+		public:
+			explicit merkle_view(const std::string_view image)
+			{
+				detail::merkle_disk_header header = {};
+				if (image.size() < sizeof(header)) {
+					return;
+				}
+				std::memcpy(&header, image.data(), sizeof(header));
+				const size_t nodes_size = size_t{header.node_count} * sizeof(detail::merkle_disk_node);
+				if (std::memcmp(header.magic, detail::merkle_magic, sizeof(header.magic)) != 0 ||
+								header.node_count == 0 ||
+								image.size() != sizeof(header) + nodes_size + header.names_size) {
+					return;
+				}
+				nodes = reinterpret_cast<const detail::merkle_disk_node*>(image.data() + sizeof(header));
+				names = image.data() + sizeof(header) + nodes_size;
+				count = header.node_count;
+				// children come after their parent in the breadth first image, which also rules out cycles that
+				// would send a diff or a lookup around in circles, and have one parent so it is a tree
+				std::vector<bool> seen(count); // has a parent, the root never does
+				for (uint32_t i = 0; i < count; i++) {
+					const auto& n  = nodes[i];
+					bool        ok = size_t{n.name_offset} + n.name_size <= header.names_size &&
+									n.first_child <= count && n.child_count <= count - n.first_child &&
+									(n.child_count == 0 || n.first_child > i);
+					for (uint32_t c = n.first_child; ok && c < n.first_child + n.child_count; c++) {
+						ok      = !seen[c];
+						seen[c] = true;
+					}
+					if (!ok) {
+						nodes = nullptr;
+						count = 0;
+						return;
+					}
+				}
+			}
+
+			bool valid() const
+			{
+				return nodes != nullptr;
+			}
+
+			merkle_digest root_digest() const
+			{
+				return valid() ? merkle_digest{nodes[0].lo, nodes[0].hi} : merkle_digest{};
+			}
+
+			/* digest of a file or directory, false if path is not in the tree */
+			bool find(const std::string_view path, merkle_digest& out) const
+			{
+				if (!valid()) {
+					return false;
+				}
+				uint32_t n     = 0;
+				bool     found = true;
+				detail::for_each_component(path, [&](std::string_view name) {
+					if (found) {
+						found = find_child(n, name, n);
+					}
+				});
+				if (found) {
+					out = {nodes[n].lo, nodes[n].hi};
+				}
+				return found;
+			}
+
+		private:
+			template<typename Fn> friend void merkle_diff(const merkle_view&, const merkle_view&, Fn&&);
+
+			std::string_view name_of(uint32_t n) const
+			{
+				return std::string_view(names + nodes[n].name_offset, nodes[n].name_size);
+			}
+
+			bool find_child(uint32_t parent, const std::string_view name, uint32_t& out) const
+			{
+				auto first = nodes[parent].first_child;
+				auto last  = first + nodes[parent].child_count;
+				while (first < last) {
+					const auto mid = first + (last - first) / 2;
+					const auto c   = name_of(mid).compare(name);
+					if (c == 0) {
+						out = mid;
+						return true;
+					}
+					if (c < 0) {
+						first = mid + 1;
+					} else {
+						last = mid;
+					}
+				}
+				return false;
+			}
+
+			const detail::merkle_disk_node* nodes = nullptr;
+			const char*                     names = nullptr;
+			uint32_t                        count = 0;
+		};
+
+		/*
+		calls fn(path, merkle_change) for what changed from before to after, only descending into subtrees
+		whose digests differ. added and removed directories are reported once, not per descendant, and
+		modified is only reported for leaves
+		*/
+		template<typename Fn> inline void merkle_diff(const merkle_view& before, const merkle_view& after, Fn&& fn)
+		{
+			if (!before.valid() || !after.valid()) {
+				return;
+			}
+			std::string path;
+			const auto  walk = [&](const auto& self, uint32_t a, uint32_t b, uint32_t depth) -> void {
+				const auto& na = before.nodes[a];
+				const auto& nb = after.nodes[b];
+				if (na.lo == nb.lo && na.hi == nb.hi) {
+					return;
+				}
+				if (!na.child_count && !nb.child_count) {
+					fn(std::string_view(path), merkle_change::modified);
+					return;
+				}
+
+				const auto length = path.size();
+				const auto enter  = [&](std::string_view name) {
+					// root_path nodes (depth 1) are already joined to their first component
+					if (depth > 1) {
+						path.push_back('/');
+					}
+					path.append(name);
+				};
+				auto ia = na.first_child, la = na.first_child + na.child_count;
+				auto ib = nb.first_child, lb = nb.first_child + nb.child_count;
+				while (ia < la || ib < lb) {
+					const int c = ia == la ? 1 : ib == lb ? -1 : before.name_of(ia).compare(after.name_of(ib));
+					if (c < 0) {
+						enter(before.name_of(ia++));
+						fn(std::string_view(path), merkle_change::removed);
+					} else if (c > 0) {
+						enter(after.name_of(ib++));
+						fn(std::string_view(path), merkle_change::added);
+					} else {
+						enter(before.name_of(ia));
+						self(self, ia++, ib++, depth + 1);
+					}
+					path.resize(length);
+				}
+			};
+			walk(walk, 0, 0, 0);
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,408 @@
+﻿#pragma once
+
+#include "mapped_file.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <charconv>
+#include <bit>
+#include <cstdint>
+
+/*
+Counters, gauges and latency histograms for the path processing stages, exported in the Prometheus
+text format to a file node_exporter's textfile collector picks up.
+
+	util::metrics_registry metrics;
+	auto& parsed  = metrics.counter("file_cpp_decompositions_total", "Paths decomposed");
+	auto& hits    = metrics.counter("file_cpp_cache_lookups_total", "Cache lookups", "result=\"hit\"");
+	auto& depth   = metrics.gauge("file_cpp_walk_queue_depth", "Directories waiting to be listed");
+	auto& latency = metrics.histogram("file_cpp_batch_seconds", "Batch latency", "", 1e-9); // recorded in ns
+
+	{
+		util::metric_timer timer(latency);
+		for (const auto p : batch)
+			work(p);
+		parsed.add(batch.size()); // count in a local, add once per batch in the hottest loops
+	}
+	metrics.write_textfile("/var/lib/node_exporter/textfile/file_cpp.prom"); // eg: every few seconds
+
+Counters and histograms are split into cache line sized shards, a thread updates the shard it was
+assigned on first use with relaxed atomics, so threads do not contend and no lock is taken. Shards
+are only summed when the registry is rendered.
+
+Histograms are log linear like HDR histograms: values below 8 are exact, above that every power of
+two is split into 8 buckets, so a bucket's bounds are within 12.5% of any value in it. quantile()
+uses the full resolution, the export lists a bucket per power of two, plus _sum and _count, all
+multiplied by the histogram's scale. As le is inclusive, a bucket's le is one unit of the recorded
+value below the power of two, eg: 1.023e-06 for values below 1024 ns.
+*/
+namespace util {
+	namespace detail {
+		constexpr unsigned metric_shards        = 16;
+		constexpr unsigned histogram_sub_bits   = 3;
+		constexpr unsigned histogram_sub_counts = 1u << histogram_sub_bits;
+		constexpr unsigned histogram_buckets    = (64 - histogram_sub_bits + 1) * histogram_sub_counts;
+
+		/* the shard of the calling thread, threads are dealt out round robin on first use */
+		inline unsigned metric_shard()
+		{
+			static std::atomic<unsigned> next = {0};
+			thread_local const unsigned  ret  = next.fetch_add(1, std::memory_order_relaxed) % metric_shards;
+			return ret;
+		}
+
+		inline unsigned histogram_bucket(uint64_t v)
+		{
+			if (v < histogram_sub_counts) {
+				return static_cast<unsigned>(v);
+			}
+			// the top histogram_sub_bits bits below the leading one pick the bucket within the power of two
+			const unsigned exponent = static_cast<unsigned>(std::bit_width(v)) - 1;
+			const unsigned shift    = exponent - histogram_sub_bits;
+			const unsigned sub      = static_cast<unsigned>(v >> shift) % histogram_sub_counts;
+			return (exponent - histogram_sub_bits + 1) * histogram_sub_counts + sub;
+		}
+
+		/* the smallest value in bucket b */
+		inline uint64_t histogram_lower_bound(unsigned b)
+		{
+			if (b < histogram_sub_counts) {
+				return b;
+			}
+			const unsigned exponent = b / histogram_sub_counts + histogram_sub_bits - 1;
+			const uint64_t sub      = b % histogram_sub_counts;
+			return (histogram_sub_counts + sub) << (exponent - histogram_sub_bits);
+		}
+
+		inline void append_metric_number(std::string& out, double v)
+		{
+			char       buffer[32];
+			const auto end = std::to_chars(buffer, buffer + sizeof(buffer), v).ptr;
+			out.append(buffer, end);
+		}
+
+		/* a scaled bucket bound, rounded to 15 digits so 3 * 1e-9 prints as 3e-09 */
+		inline void append_metric_bound(std::string& out, double v)
+		{
+			char       buffer[32];
+			const auto end = std::to_chars(buffer, buffer + sizeof(buffer), v, std::chars_format::general, 15).ptr;
+			out.append(buffer, end);
+		}
+
+		inline void append_metric_number(std::string& out, uint64_t v)
+		{
+			char       buffer[24];
+			const auto end = std::to_chars(buffer, buffer + sizeof(buffer), v).ptr;
+			out.append(buffer, end);
+		}
+
+		inline void append_metric_help(std::string& out, const std::string_view help)
+		{
+			// the text format escapes '\\' and newlines in help
+			for (const char c : help) {
+				if (c == '\\') {
+					out.append("\\\\");
+				} else if (c == '\n') {
+					out.append("\\n");
+				} else {
+					out.push_back(c);
+				}
+			}
+		}
+	} // namespace detail
+
+	/* a monotonic count */
+	class metric_counter {
+	public:
+		void add(uint64_t n = 1)
+		{
+			shards[detail::metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+		}
+
+		uint64_t value() const
+		{
+			uint64_t ret = 0;
+			for (const auto& s : shards) {
+				ret += s.value.load(std::memory_order_relaxed);
+			}
+			return ret;
+		}
+
+	private:
+		struct alignas(64) shard {
+			std::atomic<uint64_t> value = 0;
+		};
+
+		std::array<shard, detail::metric_shards> shards;
+	};
+
+	/* a value that goes up and down, eg: a queue depth */
+	class metric_gauge {
+	public:
+		void set(int64_t v)
+		{
+			current.store(v, std::memory_order_relaxed);
+		}
+
+		void add(int64_t n)
+		{
+			current.fetch_add(n, std::memory_order_relaxed);
+		}
+
+		int64_t value() const
+		{
+			return current.load(std::memory_order_relaxed);
+		}
+
+	private:
+		alignas(64) std::atomic<int64_t> current = 0;
+	};
+
+	/* the summed shards of a histogram */
+	struct histogram_counts {
+		std::array<uint64_t, detail::histogram_buckets> buckets = {};
+		uint64_t                                        count   = 0;
+		uint64_t                                        sum     = 0;
+
+		/* the value below which a fraction q of the recorded values fall, at bucket resolution */
+		uint64_t quantile(double q) const
+		{
+			if (!count) {
+				return 0;
+			}
+			const auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1));
+			uint64_t   seen = 0;
+			for (unsigned b = 0; b < detail::histogram_buckets; b++) {
+				seen += buckets[b];
+				if (seen > rank) {
+					return detail::histogram_lower_bound(b);
+				}
+			}
+			return detail::histogram_lower_bound(detail::histogram_buckets - 1);
+		}
+	};
+
+	class metric_histogram {
+	public:
+		void record(uint64_t v)
+		{
+			auto& s = shards[detail::metric_shard()];
+			s.buckets[detail::histogram_bucket(v)].fetch_add(1, std::memory_order_relaxed);
+			s.sum.fetch_add(v, std::memory_order_relaxed);
+		}
+
+		histogram_counts counts() const
+		{
+			histogram_counts ret;
+			for (const auto& s : shards) {
+				for (unsigned b = 0; b < detail::histogram_buckets; b++) {
+					ret.buckets[b] += s.buckets[b].load(std::memory_order_relaxed);
+				}
+				ret.sum += s.sum.load(std::memory_order_relaxed);
+			}
+			for (const auto n : ret.buckets) {
+				ret.count += n;
+			}
+			return ret;
+		}
+
+	private:
+		struct alignas(64) shard {
+			std::array<std::atomic<uint64_t>, detail::histogram_buckets> buckets = {};
+			std::atomic<uint64_t>                                        sum     = 0;
+		};
+
+		std::array<shard, detail::metric_shards> shards;
+	};
+
+	/* records the nanoseconds from construction to destruction into a histogram */
+	class metric_timer {
+	public:
+		explicit metric_timer(metric_histogram& h) : target(h), start(std::chrono::steady_clock::now())
+		{
+		}
+
+		metric_timer(const metric_timer&) = delete;
+		metric_timer& operator=(const metric_timer&) = delete;
+
+		~metric_timer()
+		{
+			const auto elapsed = std::chrono::steady_clock::now() - start;
+			target.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+		}
+
+	private:
+		metric_histogram&                     target;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	class metrics_registry {
+	public:
+		/*
+		the counter name{labels}, created on first use. labels are written as in the text format (key="value",
+		comma separated), metrics sharing a name are one family and share the help of the first
+		*/
+		metric_counter& counter(const std::string_view name, const std::string_view help,
+						const std::string_view labels = {})
+		{
+			return *find(name, help, labels, metric_type::counter, 1).counter;
+		}
+
+		metric_gauge& gauge(const std::string_view name, const std::string_view help,
+						const std::string_view labels = {})
+		{
+			return *find(name, help, labels, metric_type::gauge, 1).gauge;
+		}
+
+		/* scale converts recorded values to the exported unit, eg: 1e-9 for nanoseconds exported as seconds */
+		metric_histogram& histogram(const std::string_view name, const std::string_view help,
+						const std::string_view labels = {}, const double scale = 1)
+		{
+			return *find(name, help, labels, metric_type::histogram, scale).histogram;
+		}
+
+		/* every metric in the Prometheus text format, families in registration order */
+		std::string render() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::string                 out;
+			std::vector<bool>           done(metrics.size(), false);
+			for (size_t i = 0; i < metrics.size(); i++) {
+				if (done[i]) {
+					continue;
+				}
+				const auto& family = metrics[i];
+				out.append("# HELP ").append(family.name).push_back(' ');
+				detail::append_metric_help(out, family.help);
+				out.append("\n# TYPE ").append(family.name).push_back(' ');
+				out.append(family.type == metric_type::counter ? "counter"
+								   : family.type == metric_type::gauge ? "gauge"
+																	   : "histogram");
+				out.push_back('\n');
+				for (size_t j = i; j < metrics.size(); j++) {
+					if (!done[j] && metrics[j].name == family.name && metrics[j].type == family.type) {
+						render(out, metrics[j]);
+						done[j] = true;
+					}
+				}
+			}
+			return out;
+		}
+
+		/* renders into path atomically, so the collector never reads a partial file. false on failure */
+		bool write_textfile(const std::string& path) const
+		{
+			return write_file_atomic(path, render());
+		}
+
+	private:
+		enum class metric_type { counter, gauge, histogram };
+
+		struct metric {
+			std::string                       name;
+			std::string                       help;
+			std::string                       labels;
+			metric_type                       type;
+			double                            scale;
+			std::unique_ptr<metric_counter>   counter;
+			std::unique_ptr<metric_gauge>     gauge;
+			std::unique_ptr<metric_histogram> histogram;
+		};
+
+		metric& find(const std::string_view name, const std::string_view help, const std::string_view labels,
+						const metric_type type, const double scale)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& m : metrics) {
+				if (m.name == name && m.labels == labels && m.type == type) {
+					return m;
+				}
+			}
+			auto& m = metrics.emplace_back(metric{std::string(name), std::string(help), std::string(labels), type,
+							scale, nullptr, nullptr, nullptr});
+			if (type == metric_type::counter) {
+				m.counter = std::make_unique<metric_counter>();
+			} else if (type == metric_type::gauge) {
+				m.gauge = std::make_unique<metric_gauge>();
+			} else {
+				m.histogram = std::make_unique<metric_histogram>();
+			}
+			return m;
+		}
+
+		static void append_series(std::string& out, const metric& m, const std::string_view suffix,
+						const std::string_view extra_label = {})
+		{
+			out.append(m.name).append(suffix);
+			if (!m.labels.empty() || !extra_label.empty()) {
+				out.push_back('{');
+				out.append(m.labels);
+				if (!m.labels.empty() && !extra_label.empty()) {
+					out.push_back(',');
+				}
+				out.append(extra_label);
+				out.push_back('}');
+			}
+			out.push_back(' ');
+		}
+
+		static void render(std::string& out, const metric& m)
+		{
+			if (m.type == metric_type::counter) {
+				append_series(out, m, "");
+				detail::append_metric_number(out, m.counter->value());
+				out.push_back('\n');
+				return;
+			}
+			if (m.type == metric_type::gauge) {
+				append_series(out, m, "");
+				out.append(std::to_string(m.gauge->value()));
+				out.push_back('\n');
+				return;
+			}
+
+			// one cumulative bucket per power of two, up to the first bound above the largest value recorded. below
+			// counts the values under bound, so the inclusive le is the last value before it
+			const auto  counts = m.histogram->counts();
+			unsigned    last   = 0;
+			uint64_t    below  = 0;
+			std::string le;
+			for (unsigned b = 0; b < detail::histogram_buckets; b++) {
+				last = counts.buckets[b] ? b : last;
+			}
+			for (unsigned b = 0; b + 1 < detail::histogram_buckets; b++) {
+				below += counts.buckets[b];
+				const auto bound = detail::histogram_lower_bound(b + 1);
+				if (std::has_single_bit(bound)) {
+					le.assign("le=\"");
+					detail::append_metric_bound(le, static_cast<double>(bound - 1) * m.scale);
+					le.push_back('"');
+					append_series(out, m, "_bucket", le);
+					detail::append_metric_number(out, below);
+					out.push_back('\n');
+					if (b >= last) {
+						break;
+					}
+				}
+			}
+			append_series(out, m, "_bucket", "le=\"+Inf\"");
+			detail::append_metric_number(out, counts.count);
+			out.push_back('\n');
+			append_series(out, m, "_sum");
+			detail::append_metric_number(out, static_cast<double>(counts.sum) * m.scale);
+			out.push_back('\n');
+			append_series(out, m, "_count");
+			detail::append_metric_number(out, counts.count);
+			out.push_back('\n');
+		}
+
+		mutable std::mutex mutex;
+		std::deque<metric> metrics; // never moves a metric, handed out references stay valid
+	};
+} // namespace util
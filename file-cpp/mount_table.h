@@ -0,0 +1,417 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "snapshot.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+
+/*
+Longest prefix matching of paths against a table of mount points (or volumes, backends...),
+answering the question "which mount owns this path" without repeatedly calling parent_path.
+
+Prefixes are matched by whole components, "/data2/x" does not match "/data". Slashes are
+canonicalized ('\\' and '/' are equal, runs of separators count as one) but no other lexical
+normalization happens, "." and ".." should be resolved by the caller.
+
+	util::utf8::mount_table<int> table;
+	table.insert("/", 0);
+	table.insert("/data", 1);
+	auto m = table.find("/data/x/y"); // *m.value == 1, path.substr(m.length) == "/x/y"
+
+A lookup walks the separators of the query once, hashing the canonical prefix as it goes and
+probing the table only at depths where some prefix exists, so the cost is bounded by the
+depth of the deepest mount rather than the depth of the path.
+
+mount_router<T> holds a table that can be replaced while lookups are running.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			/*
+			walks [first, last) as the canonical prefix form: root-name with '/' for slashes, a single '/' for
+			the root-directory and components joined with single '/'. calls fn(depth, hash, end) at the end of
+			root-path (depth 0) and after every component, stopping early once fn returns false.
+			*/
+			template<typename Fn>
+			inline void walk_prefixes(const char* const first, const char* const last, uint32_t max_depth, Fn&& fn)
+			{
+				const auto root_name_end = find_root_name_end(first, last);
+				uint64_t   h             = hash::fnv_offset;
+				for (auto it = first; it != root_name_end; ++it) {
+					h = hash::fnv_byte(h, is_slash(*it) ? '/' : *it);
+				}
+
+				auto it = root_name_end;
+				if (it != last && is_slash(*it)) {
+					h  = hash::fnv_byte(h, '/');
+					it = std::find_if_not(it, last, is_slash);
+				}
+				if (!fn(uint32_t{0}, h, it)) {
+					return;
+				}
+
+				bool need_separator = false; // root-path already ends in a separator (or there is none)
+				for (uint32_t depth = 1; it != last && depth <= max_depth; depth++) {
+					const auto component_end = std::find_if(it, last, is_slash);
+					if (need_separator) {
+						h = hash::fnv_byte(h, '/');
+					}
+					h = hash::fnv_range(h, it, component_end);
+					if (!fn(depth, h, component_end)) {
+						return;
+					}
+					need_separator = true;
+					it             = std::find_if_not(component_end, last, is_slash);
+				}
+			}
+
+			inline std::string canonical_prefix(const std::string_view path, uint32_t& depth)
+			{
+				// canonical form of path as walked by walk_prefixes, trailing separators are dropped
+				std::string ret;
+				const auto  first         = path.data();
+				const auto  last          = first + path.size();
+				const auto  root_name_end = find_root_name_end(first, last);
+				for (auto it = first; it != root_name_end; ++it) {
+					ret.push_back(is_slash(*it) ? '/' : *it);
+				}
+
+				auto it = root_name_end;
+				if (it != last && is_slash(*it)) {
+					ret.push_back('/');
+					it = std::find_if_not(it, last, is_slash);
+				}
+
+				bool need_separator = false;
+				depth               = 0;
+				while (it != last) {
+					const auto component_end = std::find_if(it, last, is_slash);
+					if (need_separator) {
+						ret.push_back('/');
+					}
+					ret.append(it, component_end);
+					depth++;
+					need_separator = true;
+					it             = std::find_if_not(component_end, last, is_slash);
+				}
+				return ret;
+			}
+
+			inline bool canonical_equal(const std::string_view canonical, const char* const first,
+							const char* const last)
+			{
+				// test if [first, last) walks to exactly the canonical prefix
+				const auto root_name_end = find_root_name_end(first, last);
+				size_t     i             = 0;
+				for (auto it = first; it != last; ++it) {
+					char c = *it;
+					if (is_slash(c)) {
+						c = '/';
+						if (it >= root_name_end) { // collapse separators outside of root-name
+							it = std::find_if_not(it, last, is_slash) - 1;
+						}
+					}
+					if (i == canonical.size() || canonical[i] != c) {
+						return false;
+					}
+					i++;
+				}
+				return i == canonical.size();
+			}
+		} // namespace detail
+
+		template<typename T> class mount_table {
+		public:
+			struct match {
+				const T* value  = nullptr; // nullptr when no prefix matched
+				size_t   length = 0;       // bytes of the query covered by the matched prefix
+
+				explicit operator bool() const
+				{
+					return value != nullptr;
+				}
+			};
+
+			/* adds or replaces the value for prefix */
+			void insert(const std::string_view prefix, T value)
+			{
+				uint32_t depth     = 0;
+				auto     canonical = detail::canonical_prefix(prefix, depth);
+				uint64_t hash      = 0;
+				detail::walk_prefixes(canonical.data(), canonical.data() + canonical.size(), depth,
+								[&](uint32_t, uint64_t h, const char*) {
+									hash = h;
+									return true;
+								});
+
+				if (const auto slot = find_slot(hash, depth, canonical); slots[slot]) {
+					entries[slots[slot] - 1].value = std::move(value);
+					return;
+				}
+
+				entries.push_back({std::move(canonical), hash, depth, std::move(value)});
+				depth_mask |= uint64_t{1} << (depth < 63 ? depth : 63);
+				max_depth = std::max(max_depth, depth);
+				if (entries.size() * 2 > slots.size()) {
+					rehash(slots.size() * 2);
+				} else {
+					slots[find_slot(hash, depth, entries.back().prefix)] = static_cast<uint32_t>(entries.size());
+				}
+			}
+
+			/* longest prefix of path in the table */
+			match find(const std::string_view path) const
+			{
+				match      ret   = {};
+				const auto first = path.data();
+				if (entries.empty()) {
+					return ret;
+				}
+				detail::walk_prefixes(first, first + path.size(), max_depth,
+								[&](uint32_t depth, uint64_t hash, const char* end) {
+									if (!(depth_mask & (uint64_t{1} << (depth < 63 ? depth : 63)))) {
+										return true;
+									}
+									const auto mask = slots.size() - 1;
+									for (auto i = mix(hash, depth) & mask; slots[i]; i = (i + 1) & mask) {
+										const auto& e = entries[slots[i] - 1];
+										if (e.hash == hash && e.depth == depth &&
+														detail::canonical_equal(e.prefix, first, end)) {
+											ret.value  = &e.value;
+											ret.length = static_cast<size_t>(end - first);
+											break;
+										}
+									}
+									return true;
+								});
+				return ret;
+			}
+
+			size_t size() const
+			{
+				return entries.size();
+			}
+
+			/* calls fn(canonical_prefix, value) for every entry in insertion order */
+			template<typename Fn> void for_each(Fn&& fn) const
+			{
+				for (const auto& e : entries) {
+					fn(std::string_view(e.prefix), e.value);
+				}
+			}
+
+		private:
+			struct entry {
+				std::string prefix; // canonical form
+				uint64_t    hash;
+				uint32_t    depth;
+				T           value;
+			};
+
+			static size_t mix(uint64_t h, uint32_t depth)
+			{
+				return static_cast<size_t>(hash::mix(h ^ (depth * 0x9e3779b97f4a7c15ull)));
+			}
+
+			size_t find_slot(uint64_t hash, uint32_t depth, const std::string& canonical) const
+			{
+				// slot holding the entry, or the empty slot where it belongs
+				const auto mask = slots.size() - 1;
+				auto       i    = mix(hash, depth) & mask;
+				for (; slots[i]; i = (i + 1) & mask) {
+					const auto& e = entries[slots[i] - 1];
+					if (e.hash == hash && e.depth == depth && e.prefix == canonical) {
+						break;
+					}
+				}
+				return i;
+			}
+
+			void rehash(size_t count)
+			{
+				slots.assign(count, 0);
+				for (size_t i = 0; i < entries.size(); i++) {
+					slots[find_slot(entries[i].hash, entries[i].depth, entries[i].prefix)] =
+									static_cast<uint32_t>(i + 1);
+				}
+			}
+
+			std::vector<entry>    entries;
+			std::vector<uint32_t> slots      = std::vector<uint32_t>(16, 0); // entry index + 1, 0 is empty
+			uint64_t              depth_mask = 0; // bit d set when a prefix of depth d exists, 63 for deeper ones
+			uint32_t              max_depth  = 0;
+		};
+
+		/*
+		a mount_table that can be reloaded while other threads look paths up, published through
+		util::snapshot (see snapshot.h). Each reader thread registers once and pins the current table
+		for the length of a read, without a lock or a shared reference count. reload() swaps the new
+		table in without waiting for readers, the old one is freed once no read can still see it.
+
+			auto reader = router.make_reader(); // once per thread
+			auto table  = reader.read();
+			auto m      = table->find(path);
+		*/
+		template<typename T> class mount_router {
+		public:
+			using table_type = mount_table<T>;
+			using reader     = typename util::snapshot<table_type>::reader;
+
+			mount_router() : tables(table_type{})
+			{
+			}
+
+			/* registers the calling thread as a reader, the reader must not outlive the router */
+			reader make_reader() const
+			{
+				return tables.make_reader();
+			}
+
+			void reload(table_type table)
+			{
+				tables.publish(std::move(table));
+			}
+
+		private:
+			util::snapshot<table_type> tables;
+		};
+
+		struct mount_info {
+			uint32_t    id        = 0;
+			uint32_t    parent_id = 0;
+			std::string root;        // root of the mount within its filesystem
+			std::string mount_point;
+			std::string fstype;
+			std::string source;
+		};
+
+		namespace detail {
+			inline std::string unescape_mountinfo(const std::string_view field)
+			{
+				// mountinfo escapes space, tab, newline and backslash as \ooo
+				std::string ret;
+				ret.reserve(field.size());
+				for (size_t i = 0; i < field.size(); i++) {
+					if (field[i] == '\\' && i + 3 < field.size() && (uint8_t)(field[i + 1] - '0') < 8 &&
+									(uint8_t)(field[i + 2] - '0') < 8 && (uint8_t)(field[i + 3] - '0') < 8) {
+						ret.push_back(static_cast<char>(((field[i + 1] - '0') << 6) | ((field[i + 2] - '0') << 3) |
+										(field[i + 3] - '0')));
+						i += 3;
+					} else {
+						ret.push_back(field[i]);
+					}
+				}
+				return ret;
+			}
+
+			inline std::string_view next_field(std::string_view& line)
+			{
+				// split the next whitespace separated field off line
+				const auto start = line.find_first_not_of(" \t");
+				if (start == std::string_view::npos) {
+					line = {};
+					return {};
+				}
+				line            = line.substr(start);
+				const auto stop = std::min(line.find_first_of(" \t"), line.size());
+				const auto ret  = line.substr(0, stop);
+				line            = line.substr(stop);
+				return ret;
+			}
+
+			inline bool read_text(const char* const path, std::string& out)
+			{
+				std::ifstream in(path, std::ios::binary);
+				if (!in) {
+					return false;
+				}
+				std::ostringstream ss;
+				ss << in.rdbuf();
+				out = ss.str();
+				return true;
+			}
+		} // namespace detail
+
+		/* parses /proc/<pid>/mountinfo text, calls fn(const mount_info&) for every well formed line */
+		template<typename Fn> inline void parse_mountinfo(std::string_view text, Fn&& fn)
+		{
+			while (!text.empty()) {
+				const auto eol  = std::min(text.find('\n'), text.size());
+				auto       line = text.substr(0, eol);
+				text            = text.substr(std::min(eol + 1, text.size()));
+
+				// id parent major:minor root mount_point options [optional fields...] - fstype source super_options
+				mount_info info      = {};
+				const auto id        = detail::next_field(line);
+				const auto parent_id = detail::next_field(line);
+				detail::next_field(line); // major:minor
+				const auto root        = detail::next_field(line);
+				const auto mount_point = detail::next_field(line);
+				if (mount_point.empty()) {
+					continue;
+				}
+				auto field = detail::next_field(line); // options
+				while (!field.empty() && field != "-") {
+					field = detail::next_field(line);
+				}
+				const auto fstype = detail::next_field(line);
+				const auto source = detail::next_field(line);
+
+				info.id          = static_cast<uint32_t>(std::strtoul(std::string(id).c_str(), nullptr, 10));
+				info.parent_id   = static_cast<uint32_t>(std::strtoul(std::string(parent_id).c_str(), nullptr, 10));
+				info.root        = detail::unescape_mountinfo(root);
+				info.mount_point = detail::unescape_mountinfo(mount_point);
+				info.fstype      = detail::unescape_mountinfo(fstype);
+				info.source      = detail::unescape_mountinfo(source);
+				fn(static_cast<const mount_info&>(info));
+			}
+		}
+
+		/* table of the mounts in a mountinfo file, later mounts on the same point shadow earlier ones */
+		inline mount_table<mount_info> load_mountinfo(const char* const path = "/proc/self/mountinfo")
+		{
+			mount_table<mount_info> ret;
+			std::string             text;
+			if (detail::read_text(path, text)) {
+				parse_mountinfo(text, [&](const mount_info& info) { ret.insert(info.mount_point, info); });
+			}
+			return ret;
+		}
+
+		/*
+		parses a routing config of "prefix backend" lines, blank lines and lines starting with '#' are skipped
+		and the backend is the rest of the line with surrounding whitespace removed
+		*/
+		inline mount_table<std::string> parse_mount_config(std::string_view text)
+		{
+			mount_table<std::string> ret;
+			while (!text.empty()) {
+				const auto eol  = std::min(text.find('\n'), text.size());
+				auto       line = text.substr(0, eol);
+				text            = text.substr(std::min(eol + 1, text.size()));
+				if (!line.empty() && line.back() == '\r') {
+					line.remove_suffix(1); // CRLF files, neither the prefix nor the backend ends in '\r'
+				}
+
+				const auto prefix = detail::next_field(line);
+				if (prefix.empty() || prefix[0] == '#') {
+					continue;
+				}
+				const auto first = line.find_first_not_of(" \t");
+				if (first == std::string_view::npos) {
+					ret.insert(prefix, std::string());
+					continue;
+				}
+				const auto last = line.find_last_not_of(" \t");
+				ret.insert(prefix, std::string(line.substr(first, last - first + 1)));
+			}
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
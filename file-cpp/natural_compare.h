@@ -0,0 +1,230 @@
+﻿#pragma once
+
+#include "file.h"
+#include "simd.h"
+#include <string_view>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Natural (version aware) ordering of file names, "file2" < "file10" and "v1.9" < "v1.10".
+
+Digit runs are compared by value without converting them to integers: leading zeros are
+skipped, the run with fewer remaining digits is smaller and runs of equal length compare
+lexically. Everything else compares byte by byte, optionally folding ascii case. When two
+strings are equal under those rules (eg: "a01" and "a1", or "File" and "file" when folding)
+the raw bytes break the tie, so the order is total.
+
+natural_sort_key() produces a byte string whose memcmp order is the natural_compare order,
+useful for sorting large lists once with memcmp or a radix sort.
+*/
+namespace util {
+	namespace utf8 {
+		struct natural_options {
+			bool fold_case = false; // compare ascii letters case insensitively
+		};
+
+		constexpr inline bool is_digit(char c)
+		{
+			return (uint8_t)((uint8_t)c - (uint8_t)'0') < 10;
+		}
+
+		inline const char* find_digit(const char* first, const char* const last)
+		{
+			// return the first digit in [first, last); otherwise, last
+#if defined(FILE_CPP_SSE2)
+			for (; last - first >= 16; first += 16) {
+				// bytes >= 0x80 are negative as signed chars and never match
+				const uint32_t mask = simd::movemask(simd::in_range(simd::load(first), '0', '9'));
+				if (mask) {
+					return first + simd::count_trailing_zeros(mask);
+				}
+			}
+#endif
+			while (first != last && !is_digit(*first)) {
+				++first;
+			}
+			return first;
+		}
+
+		inline const char* find_non_digit(const char* first, const char* const last)
+		{
+			// return the first non digit in [first, last); otherwise, last
+#if defined(FILE_CPP_SSE2)
+			for (; last - first >= 16; first += 16) {
+				const uint32_t mask = simd::movemask(simd::in_range(simd::load(first), '0', '9')) ^ 0xffff;
+				if (mask) {
+					return first + simd::count_trailing_zeros(mask);
+				}
+			}
+#endif
+			while (first != last && is_digit(*first)) {
+				++first;
+			}
+			return first;
+		}
+
+		inline int natural_compare(const std::string_view lhs, const std::string_view rhs,
+						const natural_options opts = {})
+		{
+			// compare lhs and rhs in natural order, returns <0, 0 or >0 like memcmp
+			const char*       a      = lhs.data();
+			const char*       b      = rhs.data();
+			const char* const a_last = a + lhs.size();
+			const char* const b_last = b + rhs.size();
+			while (a != a_last && b != b_last) {
+				if (is_digit(*a) && is_digit(*b)) {
+					// skip leading zeros, keeping the last digit so zero still has a length of 1
+					const auto a_run = find_non_digit(a, a_last);
+					const auto b_run = find_non_digit(b, b_last);
+					while (a_run - a > 1 && *a == '0') {
+						++a;
+					}
+					while (b_run - b > 1 && *b == '0') {
+						++b;
+					}
+					if ((a_run - a) != (b_run - b)) { // more significant digits is the larger number
+						return (a_run - a) < (b_run - b) ? -1 : 1;
+					}
+					if (const int c = std::memcmp(a, b, static_cast<size_t>(a_run - a))) {
+						return c;
+					}
+					a = a_run;
+					b = b_run;
+					continue;
+				}
+
+				// compare text up to the next digit run of either side
+				const auto a_run = find_digit(a, a_last);
+				const auto b_run = find_digit(b, b_last);
+				const auto count = std::min(a_run - a, b_run - b);
+				if (opts.fold_case) {
+					for (std::ptrdiff_t i = 0; i < count; i++) {
+						const auto ca = (uint8_t)fold_letter(a[i]);
+						const auto cb = (uint8_t)fold_letter(b[i]);
+						if (ca != cb) {
+							return ca < cb ? -1 : 1;
+						}
+					}
+				} else if (const int c = std::memcmp(a, b, static_cast<size_t>(count))) {
+					return c;
+				}
+				a += count;
+				b += count;
+				if (a == a_run && b == b_run) {
+					continue;
+				}
+				// one side reached a digit (or the end) first, that character decides
+				if (a == a_last || b == b_last) {
+					break;
+				}
+				const auto ca = (uint8_t)(opts.fold_case ? fold_letter(*a) : *a);
+				const auto cb = (uint8_t)(opts.fold_case ? fold_letter(*b) : *b);
+				return ca < cb ? -1 : 1;
+			}
+
+			if (a != a_last || b != b_last) { // the shorter remainder comes first
+				return a == a_last ? -1 : 1;
+			}
+
+			// equal under natural order, break ties on the raw bytes
+			return lhs.compare(rhs);
+		}
+
+		inline int natural_compare_filename(const std::string_view lhs, const std::string_view rhs,
+						const natural_options opts = {})
+		{
+			// compare the filenames of lhs and rhs in natural order
+			return natural_compare(filename(lhs), filename(rhs), opts);
+		}
+
+		inline int natural_compare_stem(const std::string_view lhs, const std::string_view rhs,
+						const natural_options opts = {})
+		{
+			// compare the stems of lhs and rhs in natural order, extensions only break ties
+			if (const int c = natural_compare(stem(lhs), stem(rhs), opts)) {
+				return c;
+			}
+			return natural_compare(extension(lhs), extension(rhs), opts);
+		}
+
+		/* natural order as a predicate for std::sort and friends */
+		struct natural_less {
+			natural_options opts = {};
+
+			bool operator()(const std::string_view lhs, const std::string_view rhs) const
+			{
+				return natural_compare(lhs, rhs, opts) < 0;
+			}
+		};
+
+		constexpr size_t natural_sort_key_bound(size_t size)
+		{
+			// worst case is alternating single digits (3 bytes each) plus the terminator and raw tie breaker
+			return size * 4 + 1;
+		}
+
+		inline size_t natural_sort_key(const std::string_view str, char* const out, const natural_options opts = {})
+		{
+			// write a key for str to out, which must hold natural_sort_key_bound(str.size()) bytes, and return its
+			// size. Keys of strings without embedded nulls compare with memcmp the same as natural_compare.
+			//
+			// A digit run is written as '0' (so it still orders as a digit against other characters), the count of
+			// significant digits (one byte, or 0xff and four big endian bytes for very long runs) and the digits.
+			// A null ends the natural part, followed by the raw bytes as the tie breaker.
+			const char*       it   = str.data();
+			const char* const last = it + str.size();
+			char*             dest = out;
+			while (it != last) {
+				if (!is_digit(*it)) {
+					const auto run = find_digit(it, last);
+					if (opts.fold_case) {
+						for (; it != run; ++it) {
+							*dest++ = fold_letter(*it);
+						}
+					} else {
+						std::memcpy(dest, it, static_cast<size_t>(run - it));
+						dest += run - it;
+						it = run;
+					}
+					continue;
+				}
+
+				const auto run = find_non_digit(it, last);
+				while (run - it > 1 && *it == '0') {
+					++it;
+				}
+				const auto digits = static_cast<uint32_t>(run - it);
+				*dest++           = '0';
+				if (digits < 0xff) {
+					*dest++ = static_cast<char>(digits);
+				} else {
+					*dest++ = static_cast<char>(0xff);
+					*dest++ = static_cast<char>(digits >> 24);
+					*dest++ = static_cast<char>(digits >> 16);
+					*dest++ = static_cast<char>(digits >> 8);
+					*dest++ = static_cast<char>(digits);
+				}
+				std::memcpy(dest, it, digits);
+				dest += digits;
+				it = run;
+			}
+			*dest++ = '\0';
+			std::memcpy(dest, str.data(), str.size());
+			dest += str.size();
+			return static_cast<size_t>(dest - out);
+		}
+
+		inline std::string& append_natural_sort_key(std::string& out, const std::string_view str,
+						const natural_options opts = {})
+		{
+			// append the key for str to out, see natural_sort_key()
+			const auto offset = out.size();
+			out.resize(offset + natural_sort_key_bound(str.size()));
+			out.resize(offset + natural_sort_key(str, &out[offset], opts));
+			return out;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,96 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+/*
+Minimal fork/join helpers for the batch algorithms. Work is split up front, there is no
+pool, threads are started per call which is fine for jobs that run over millions of paths.
+*/
+namespace util {
+	namespace parallel {
+		inline unsigned resolve_threads(unsigned requested)
+		{
+			// 0 means one thread per hardware thread
+			if (requested) {
+				return requested;
+			}
+			const unsigned hw = std::thread::hardware_concurrency();
+			return hw ? hw : 1;
+		}
+
+		/* calls fn(thread_index) on threads threads, the calling thread runs index 0 */
+		template<typename Fn> inline void run(unsigned threads, Fn&& fn)
+		{
+			std::vector<std::thread> workers;
+			workers.reserve(threads ? threads - 1 : 0);
+			for (unsigned t = 1; t < threads; t++) {
+				workers.emplace_back([&fn, t] { fn(t); });
+			}
+			fn(0u);
+			for (auto& w : workers) {
+				w.join();
+			}
+		}
+
+		struct chunk {
+			size_t first;
+			size_t last;
+		};
+
+		/* [first, last) of chunk index out of chunks roughly equal chunks of count items */
+		inline chunk split(size_t count, size_t chunks, size_t index)
+		{
+			return {count * index / chunks, count * (index + 1) / chunks};
+		}
+
+		/* threads for a batch of count items: requested (0 for one per hardware thread), at most one per 4096 */
+		inline unsigned batch_threads(size_t count, unsigned requested)
+		{
+			const auto useful = static_cast<unsigned>(std::min<size_t>(count / 4096 + 1, 1024));
+			return std::min(resolve_threads(requested), useful);
+		}
+
+		/*
+		writes count results of varying size back to back into buffer, result i at buffer[offsets[i], offsets[i + 1]).
+		size(thread, i) gives the size of result i in a first pass, write(thread, i, out) writes it at out in a
+		second. both passes split the items the same way over threads, so what size() worked out for an item can be
+		kept for write() by the same thread. returns the total size
+		*/
+		template<typename Size, typename Write>
+		inline size_t concatenate(size_t count, unsigned threads, std::string& buffer, std::vector<size_t>& offsets,
+						Size&& size, Write&& write)
+		{
+			offsets.assign(count + 1, 0);
+			std::vector<size_t> chunk_bytes(threads, 0);
+			run(threads, [&](unsigned t) {
+				const auto chunk = split(count, threads, t);
+				size_t     bytes = 0;
+				for (size_t i = chunk.first; i < chunk.last; i++) {
+					offsets[i] = bytes;
+					bytes += size(t, i);
+				}
+				chunk_bytes[t] = bytes;
+			});
+			size_t total = 0;
+			for (auto& bytes : chunk_bytes) {
+				total += std::exchange(bytes, total); // now the chunk's start
+			}
+			offsets[count] = total;
+			buffer.resize(total);
+
+			run(threads, [&](unsigned t) {
+				const auto chunk = split(count, threads, t);
+				for (size_t i = chunk.first; i < chunk.last; i++) {
+					offsets[i] += chunk_bytes[t];
+					write(t, i, buffer.data() + offsets[i]);
+				}
+			});
+			return total;
+		}
+	} // namespace parallel
+} // namespace util
@@ -0,0 +1,319 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include "parallel.h"
+#include "mount_table.h"
+#include "trace.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/*
+Splits a path list into shards without splitting directories, so every shard can aggregate per
+directory on its own and siblings stay together in memory.
+
+	util::utf8::partition_options opts;
+	opts.shards = 16;
+	opts.depth  = 2; // keep whole subtrees two levels down together
+	auto shards = util::utf8::partition_paths(paths.data(), paths.size(), opts);
+	for (const auto& s : shards)
+		for (size_t i = 0; i < s.size(); i++)
+			work(s[i], s.indices[i]);
+
+A path's group is its parent_path cut to the first depth components (the whole parent_path when
+depth is 0), compared with '\\' and '/' equal and runs of separators collapsed as in
+mount_table.h. All paths of a group land in the same shard.
+
+partition_mode::hash_parent collects the groups by hash and deals them out heaviest first to the
+lightest shard. partition_mode::sorted_range sorts the paths by parent, then filename, and cuts
+that order into runs of about equal weight at the nearest group boundary, so every shard is a
+contiguous range of the sorted order. Either way a shard's paths are copied back to back into one
+buffer with the members of a group next to each other.
+*/
+namespace util {
+	namespace utf8 {
+		enum class partition_mode { hash_parent, sorted_range };
+
+		struct partition_options {
+			unsigned       shards  = 0; // 0 for one per hardware thread
+			uint32_t       depth   = 0; // components of parent_path that make up a group, 0 for all
+			partition_mode mode    = partition_mode::hash_parent;
+			unsigned       threads = 0; // 0 for one per hardware thread
+		};
+
+		struct path_shard {
+			std::string           buffer;  // the paths back to back
+			std::vector<size_t>   offsets; // path i is buffer[offsets[i], offsets[i + 1])
+			std::vector<uint32_t> indices; // input index of path i
+			uint64_t              weight = 0;
+
+			size_t size() const
+			{
+				return indices.size();
+			}
+
+			std::string_view operator[](size_t i) const
+			{
+				return std::string_view(buffer.data() + offsets[i], offsets[i + 1] - offsets[i]);
+			}
+		};
+
+		namespace detail {
+			inline uint64_t group_key(const std::string_view path, uint32_t depth)
+			{
+				// hash of parent_path(path) cut to depth components, separators canonical
+				const auto parent = parent_path(path);
+				uint64_t   ret    = 0;
+				walk_prefixes(parent.data(), parent.data() + parent.size(), depth ? depth : UINT32_MAX,
+								[&](uint32_t, uint64_t h, const char*) {
+									ret = h;
+									return true;
+								});
+				return hash::mix(ret);
+			}
+
+			/*
+			appends a key for path whose byte order sorts by root_path, then the components of parent_path
+			(a directory's files before its subdirectories), then filename
+			*/
+			inline void append_parent_order_key(std::string& out, const std::string_view path)
+			{
+				for (const char c : root_path(path)) {
+					out.push_back(is_slash(c) ? '/' : c);
+				}
+				out.push_back('\0');
+				for (const auto name : components(parent_path(path))) {
+					out.append(name);
+					out.push_back('\0');
+				}
+				out.push_back('\1');
+				out.append(filename(path));
+			}
+
+			struct partition_record {
+				uint64_t key;
+				uint32_t index;
+			};
+
+			inline void sort_by_key(std::vector<partition_record>& records, unsigned threads)
+			{
+				// scatter into buckets by the top bits of the key, then sort the buckets in parallel
+				constexpr unsigned bucket_bits = 8;
+				constexpr size_t   buckets     = size_t{1} << bucket_bits;
+				const size_t       count       = records.size();
+				const auto         bucket_of   = [](const partition_record& r) { return r.key >> (64 - bucket_bits); };
+
+				std::vector<size_t> histogram(threads * buckets, 0);
+				parallel::run(threads, [&](unsigned t) {
+					const auto chunk = parallel::split(count, threads, t);
+					for (size_t i = chunk.first; i < chunk.last; i++) {
+						histogram[t * buckets + bucket_of(records[i])]++;
+					}
+				});
+				std::vector<size_t> bucket_start(buckets + 1, 0);
+				size_t              offset = 0;
+				for (size_t b = 0; b < buckets; b++) {
+					bucket_start[b] = offset;
+					for (unsigned t = 0; t < threads; t++) {
+						const auto n               = histogram[t * buckets + b];
+						histogram[t * buckets + b] = offset;
+						offset += n;
+					}
+				}
+				bucket_start[buckets] = offset;
+
+				std::vector<partition_record> sorted(count);
+				parallel::run(threads, [&](unsigned t) {
+					const auto chunk = parallel::split(count, threads, t);
+					auto       next  = &histogram[t * buckets];
+					for (size_t i = chunk.first; i < chunk.last; i++) {
+						sorted[next[bucket_of(records[i])]++] = records[i];
+					}
+				});
+				std::atomic<size_t> next_bucket = {0};
+				parallel::run(threads, [&](unsigned) {
+					for (size_t b; (b = next_bucket.fetch_add(1, std::memory_order_relaxed)) < buckets;) {
+						std::sort(sorted.begin() + static_cast<std::ptrdiff_t>(bucket_start[b]),
+										sorted.begin() + static_cast<std::ptrdiff_t>(bucket_start[b + 1]),
+										[](const partition_record& x, const partition_record& y) {
+											return x.key != y.key ? x.key < y.key : x.index < y.index;
+										});
+					}
+				});
+				records.swap(sorted);
+			}
+
+			/* copies the paths at order[first, last) into shard */
+			inline void fill_shard(path_shard& shard, const std::string_view* const paths, const uint32_t* first,
+							const uint32_t* const last)
+			{
+				size_t bytes = 0;
+				for (auto it = first; it != last; ++it) {
+					bytes += paths[*it].size();
+				}
+				shard.buffer.reserve(bytes);
+				shard.offsets.reserve(static_cast<size_t>(last - first) + 1);
+				shard.indices.assign(first, last);
+				shard.offsets.push_back(0);
+				for (; first != last; ++first) {
+					shard.buffer.append(paths[*first]);
+					shard.offsets.push_back(shard.buffer.size());
+				}
+			}
+		} // namespace detail
+
+		/*
+		partitions paths[0, count) into opts.shards shards, weight(index) estimates the cost of a path (eg:
+		its file size) and shards are balanced by their total weight. weight is called once per index from
+		up to opts.threads threads at the same time, so it must be safe to call concurrently
+		*/
+		template<typename Weight>
+		inline std::vector<path_shard> partition_paths(const std::string_view* const paths, const size_t count,
+						const partition_options& opts, Weight&& weight)
+		{
+			const unsigned shard_count = parallel::resolve_threads(opts.shards);
+			const unsigned threads     = std::min(parallel::resolve_threads(opts.threads),
+											static_cast<unsigned>(std::min<size_t>(count / 4096 + 1, 1024)));
+
+			FILE_CPP_PROBE2(partition_begin, count, shard_count);
+
+			std::vector<detail::partition_record> records(count);
+			std::vector<uint64_t>                 weights(count);
+			parallel::run(threads, [&](unsigned t) {
+				const auto chunk = parallel::split(count, threads, t);
+				for (size_t i = chunk.first; i < chunk.last; i++) {
+					records[i] = {detail::group_key(paths[i], opts.depth), static_cast<uint32_t>(i)};
+					weights[i] = static_cast<uint64_t>(weight(i));
+				}
+			});
+
+			// order the paths so that groups are contiguous
+			if (opts.mode == partition_mode::sorted_range) {
+				// build the sort keys once rather than parsing both paths in every comparison
+				std::vector<std::string> arenas(threads);
+				std::vector<size_t>      key_end(count);
+				parallel::run(threads, [&](unsigned t) {
+					const auto chunk = parallel::split(count, threads, t);
+					for (size_t i = chunk.first; i < chunk.last; i++) {
+						detail::append_parent_order_key(arenas[t], paths[i]);
+						key_end[i] = arenas[t].size();
+					}
+				});
+				std::vector<std::string_view> keys(count);
+				for (unsigned t = 0; t < threads; t++) {
+					const auto chunk = parallel::split(count, threads, t);
+					for (size_t i = chunk.first, start = 0; i < chunk.last; start = key_end[i++]) {
+						keys[i] = std::string_view(arenas[t]).substr(start, key_end[i] - start);
+					}
+				}
+				std::sort(records.begin(), records.end(),
+								[&](const detail::partition_record& a, const detail::partition_record& b) {
+									return keys[a.index] < keys[b.index];
+								});
+			} else {
+				detail::sort_by_key(records, threads);
+			}
+
+			struct group {
+				size_t   first; // into records
+				size_t   last;
+				uint64_t weight;
+				unsigned shard;
+			};
+			std::vector<group> groups;
+			uint64_t           total = 0;
+			for (size_t i = 0; i < count;) {
+				group g = {i, i, 0, 0};
+				for (; g.last < count && records[g.last].key == records[i].key; g.last++) {
+					g.weight += weights[records[g.last].index];
+				}
+				total += g.weight;
+				groups.push_back(g);
+				i = g.last;
+			}
+
+			std::vector<uint64_t> loads(shard_count, 0);
+			if (opts.mode == partition_mode::sorted_range) {
+				// cut once the running weight passes the next shard's share, total * (shard + 1) / shard_count
+				// computed without the product, which overflows for large weights
+				const uint64_t share     = total / shard_count;
+				const uint64_t remainder = total % shard_count;
+				uint64_t       running   = 0;
+				unsigned       shard     = 0;
+				for (auto& g : groups) {
+					if (shard + 1 < shard_count &&
+									running >= share * (shard + 1) + remainder * (shard + 1) / shard_count) {
+						shard++;
+					}
+					g.shard = shard;
+					loads[shard] += g.weight;
+					running += g.weight;
+				}
+			} else {
+				// longest processing time first: heaviest group to the lightest shard
+				std::vector<uint32_t> by_weight(groups.size());
+				for (uint32_t i = 0; i < by_weight.size(); i++) {
+					by_weight[i] = i;
+				}
+				std::sort(by_weight.begin(), by_weight.end(), [&](uint32_t a, uint32_t b) {
+					return groups[a].weight != groups[b].weight ? groups[a].weight > groups[b].weight : a < b;
+				});
+				using load = std::pair<uint64_t, unsigned>;
+				std::priority_queue<load, std::vector<load>, std::greater<load>> lightest;
+				for (unsigned s = 0; s < shard_count; s++) {
+					lightest.push({0, s});
+				}
+				for (const auto i : by_weight) {
+					auto l = lightest.top();
+					lightest.pop();
+					groups[i].shard = l.second;
+					l.first += groups[i].weight;
+					loads[l.second] = l.first;
+					lightest.push(l);
+				}
+			}
+
+			// gather every shard's indices in record order, then copy the shards in parallel
+			std::vector<size_t> shard_start(shard_count + 1, 0);
+			for (const auto& g : groups) {
+				shard_start[g.shard + 1] += g.last - g.first;
+			}
+			for (unsigned s = 0; s < shard_count; s++) {
+				shard_start[s + 1] += shard_start[s];
+			}
+			std::vector<uint32_t> order(count);
+			std::vector<size_t>   next(shard_start.begin(), shard_start.end() - 1);
+			for (const auto& g : groups) {
+				for (size_t i = g.first; i < g.last; i++) {
+					order[next[g.shard]++] = records[i].index;
+				}
+			}
+			records.clear();
+			records.shrink_to_fit();
+
+			std::vector<path_shard> ret(shard_count);
+			const unsigned          fill_threads = std::min(parallel::resolve_threads(opts.threads), shard_count);
+			parallel::run(fill_threads, [&](unsigned t) {
+				for (size_t s = t; s < shard_count; s += fill_threads) {
+					detail::fill_shard(ret[s], paths, order.data() + shard_start[s], order.data() + shard_start[s + 1]);
+					ret[s].weight = loads[s];
+				}
+			});
+			FILE_CPP_PROBE2(partition_end, count, shard_count);
+			return ret;
+		}
+
+		/* partitions paths[0, count) into shards holding about as many paths each */
+		inline std::vector<path_shard> partition_paths(
+						const std::string_view* const paths, const size_t count, const partition_options& opts = {})
+		{
+			return partition_paths(paths, count, opts, [](size_t) { return uint64_t{1}; });
+		}
+	} // namespace utf8
+} // namespace util
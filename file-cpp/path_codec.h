@@ -0,0 +1,384 @@
+﻿#pragma once
+
+#include "file.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/*
+Compact encoding for streams of paths, eg: listings sent from a crawler to an indexer.
+
+	util::utf8::path_encoder encoder;
+	for (const auto p : listing)
+		encoder.add(p);
+	std::string wire;
+	encoder.flush(wire); // one block
+
+	util::utf8::path_decoder decoder;
+	std::string_view input = wire;
+	while (decoder.decode(input) == util::utf8::decode_status::ok)
+		for (const auto& p : decoder.paths())
+			use(p.path, p.filename(), p.extension());
+
+Every path is split into parent_path and the rest. The parent is sent as a reference into a
+window of the 16 most recently used directories, or front coded against the window entry it
+shares the longest prefix with. The rest is sent without its extension, which is a reference into
+a table of the 32 most recently used extensions or a literal. Lengths and references are varints.
+
+Paths are grouped into blocks, each starting with its path count and decoded size so the decoder
+can decode a block into one buffer without reallocating. Decoded paths are views into that buffer
+and stay valid until the next block is decoded. Blocks depend on the ones before them, a stream
+has to be decoded from its start (or both sides reset()).
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			constexpr uint32_t codec_directories = 16;
+			constexpr uint32_t codec_extensions  = 32;
+
+			inline void codec_put(std::string& out, uint64_t v)
+			{
+				while (v >= 0x80) {
+					out.push_back(static_cast<char>(v | 0x80));
+					v >>= 7;
+				}
+				out.push_back(static_cast<char>(v));
+			}
+
+			inline bool codec_get(const char*& p, const char* const end, uint64_t& out)
+			{
+				out = 0;
+				for (unsigned shift = 0; shift < 64 && p != end; shift += 7) {
+					const auto c = static_cast<uint8_t>(*p++);
+					out |= static_cast<uint64_t>(c & 0x7f) << shift;
+					if (!(c & 0x80)) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			/* most recently used first list of strings, shared by both ends of a stream */
+			template<size_t N> struct mru_strings {
+				std::array<std::string, N> slots;
+				std::array<uint8_t, N>     order = {}; // order[i] is the slot of the i-th most recently used
+				uint32_t                   count = 0;
+
+				const std::string& operator[](uint32_t i) const
+				{
+					return slots[order[i]];
+				}
+
+				void touch(uint32_t i)
+				{
+					// move item i to the front, the strings stay in their slots
+					std::rotate(order.begin(), order.begin() + i, order.begin() + i + 1);
+				}
+
+				void push(const std::string_view s)
+				{
+					if (count < N) {
+						order[count] = static_cast<uint8_t>(count);
+						count++;
+					}
+					touch(count - 1);
+					slots[order[0]].assign(s);
+				}
+
+				void clear()
+				{
+					count = 0;
+				}
+			};
+
+			inline size_t shared_prefix(const std::string_view a, const std::string_view b)
+			{
+				const auto n = std::min(a.size(), b.size());
+				return static_cast<size_t>(std::mismatch(a.begin(), a.begin() + n, b.begin()).first - a.begin());
+			}
+
+			/* the extension of path if it ends path, empty if path has none or it is followed by a stream name */
+			inline std::string_view trailing_extension(const std::string_view path)
+			{
+				const auto ext = extension(path);
+				return ext.data() + ext.size() == path.data() + path.size() ? ext : std::string_view();
+			}
+		} // namespace detail
+
+		class path_encoder {
+		public:
+			/* adds path to the current block */
+			void add(const std::string_view path)
+			{
+				const auto dir  = parent_path(path);
+				const auto ext  = detail::trailing_extension(path);
+				const auto rest = path.substr(dir.size(), path.size() - dir.size() - ext.size());
+				decoded += path.size();
+				count++;
+
+				// directory: 0..15 window hit, 16..31 front coded against a window entry, 32 literal
+				uint32_t best = 0;
+				for (; best < dirs.count && dirs[best] != dir; best++) {
+				}
+				if (best < dirs.count) {
+					detail::codec_put(block, best);
+					dirs.touch(best);
+				} else {
+					// the exact search above is cheap, only a miss looks for the longest shared prefix
+					size_t best_shared = 0;
+					for (uint32_t i = 0; i < dirs.count; i++) {
+						const auto shared = detail::shared_prefix(dirs[i], dir);
+						if (shared > best_shared) {
+							best        = i;
+							best_shared = shared;
+						}
+					}
+					if (best_shared) {
+						detail::codec_put(block, detail::codec_directories + best);
+						detail::codec_put(block, best_shared);
+					} else {
+						detail::codec_put(block, detail::codec_directories * 2);
+					}
+					detail::codec_put(block, dir.size() - best_shared);
+					block.append(dir.substr(best_shared));
+					dirs.push(dir);
+				}
+
+				detail::codec_put(block, rest.size());
+				block.append(rest);
+
+				// extension: 0 none, 1..32 table entry, 33 literal
+				if (ext.empty()) {
+					detail::codec_put(block, 0);
+					return;
+				}
+				for (uint32_t i = 0; i < exts.count; i++) {
+					if (exts[i] == ext) {
+						detail::codec_put(block, i + 1);
+						exts.touch(i);
+						return;
+					}
+				}
+				detail::codec_put(block, detail::codec_extensions + 1);
+				detail::codec_put(block, ext.size());
+				block.append(ext);
+				exts.push(ext);
+			}
+
+			/* paths added since the last flush */
+			size_t pending() const
+			{
+				return count;
+			}
+
+			/* appends the current block to out, if it holds any paths, and starts a new one */
+			void flush(std::string& out)
+			{
+				if (!count) {
+					return;
+				}
+				detail::codec_put(out, count);
+				detail::codec_put(out, decoded);
+				detail::codec_put(out, block.size());
+				out.append(block);
+				block.clear();
+				count   = 0;
+				decoded = 0;
+			}
+
+			/* forgets the shared state, the decoder has to be reset at the same point of the stream */
+			void reset()
+			{
+				block.clear();
+				count   = 0;
+				decoded = 0;
+				dirs.clear();
+				exts.clear();
+			}
+
+		private:
+			std::string                                    block;
+			size_t                                         count   = 0;
+			size_t                                         decoded = 0;
+			detail::mru_strings<detail::codec_directories> dirs;
+			detail::mru_strings<detail::codec_extensions>  exts;
+		};
+
+		struct decoded_path {
+			std::string_view path;
+			uint32_t         filename_offset  = 0;
+			uint32_t         extension_offset = 0;
+
+			std::string_view filename() const
+			{
+				return path.substr(filename_offset);
+			}
+
+			/* the extension, empty if there is none (as extension(), a trailing stream name is excluded) */
+			std::string_view extension() const
+			{
+				const auto ext = path.substr(extension_offset);
+				return ext.substr(0, std::min(ext.find(':'), ext.size()));
+			}
+		};
+
+		enum class decode_status {
+			ok,        // a block was decoded
+			need_more, // the input does not hold a whole block yet, nothing was consumed
+			corrupt,   // the block is malformed, the stream cannot be decoded further
+		};
+
+		class path_decoder {
+		public:
+			/* decodes the block at the start of in and consumes it */
+			decode_status decode(std::string_view& in)
+			{
+				const char* p   = in.data();
+				const auto  end = p + in.size();
+				uint64_t    n = 0, size = 0, payload = 0;
+				if (!detail::codec_get(p, end, n) || !detail::codec_get(p, end, size) ||
+								!detail::codec_get(p, end, payload)) {
+					return in.size() >= 30 ? decode_status::corrupt : decode_status::need_more;
+				}
+				if (payload > static_cast<uint64_t>(end - p)) {
+					return decode_status::need_more;
+				}
+				const auto block_end = p + payload;
+
+				// every path takes at least three bytes, and no path is longer than 64 KiB per byte it takes
+				if (n > payload / 3 || size > payload * 65536) {
+					return decode_status::corrupt;
+				}
+
+				entries.clear();
+				spans.clear();
+				buffer.clear();
+				buffer.reserve(static_cast<size_t>(size));
+				for (uint64_t i = 0; i < n; i++) {
+					span s = {buffer.size(), 0, 0};
+					if (!decode_path(p, block_end, static_cast<size_t>(size), s.ext_size)) {
+						return decode_status::corrupt;
+					}
+					s.size = buffer.size() - s.start;
+					spans.push_back(s);
+				}
+				if (p != block_end || buffer.size() != size) {
+					return decode_status::corrupt;
+				}
+
+				// the buffer never reallocated, so the views can be taken now
+				entries.resize(spans.size());
+				for (size_t i = 0; i < spans.size(); i++) {
+					const char* const data = buffer.data() + spans[i].start;
+					const auto        tail = data + spans[i].size;
+					const auto        name = find_filename(data, tail);
+					// without a coded extension there may still be one, followed by a stream name
+					const auto ext = spans[i].ext_size ? tail - spans[i].ext_size
+													   : find_extension(name, std::find(name, tail, ':'));
+					entries[i].path             = std::string_view(data, spans[i].size);
+					entries[i].filename_offset  = static_cast<uint32_t>(name - data);
+					entries[i].extension_offset = static_cast<uint32_t>(ext - data);
+				}
+				in.remove_prefix(static_cast<size_t>(block_end - in.data()));
+				return decode_status::ok;
+			}
+
+			/* the paths of the last decoded block */
+			const std::vector<decoded_path>& paths() const
+			{
+				return entries;
+			}
+
+			/* forgets the shared state, see path_encoder::reset */
+			void reset()
+			{
+				dirs.clear();
+				exts.clear();
+				entries.clear();
+				spans.clear();
+				buffer.clear();
+			}
+
+		private:
+			bool decode_path(const char*& p, const char* const end, size_t limit, size_t& ext_size)
+			{
+				uint64_t op = 0, shared = 0, size = 0;
+				if (!detail::codec_get(p, end, op) || op > detail::codec_directories * 2) {
+					return false;
+				}
+				if (op < detail::codec_directories) {
+					if (op >= dirs.count) {
+						return false;
+					}
+					dirs.touch(static_cast<uint32_t>(op));
+					buffer.append(dirs[0]);
+				} else {
+					const auto base = static_cast<uint32_t>(op - detail::codec_directories);
+					if (op != detail::codec_directories * 2 &&
+									(base >= dirs.count || !detail::codec_get(p, end, shared) ||
+													shared > dirs[base].size())) {
+						return false;
+					}
+					if (!detail::codec_get(p, end, size) || size > static_cast<uint64_t>(end - p) ||
+									buffer.size() + shared + size > limit) {
+						return false;
+					}
+					const auto start = buffer.size();
+					if (shared) {
+						buffer.append(dirs[base], 0, static_cast<size_t>(shared));
+					}
+					buffer.append(p, static_cast<size_t>(size));
+					p += size;
+					dirs.push(std::string_view(buffer).substr(start));
+				}
+
+				if (!detail::codec_get(p, end, size) || size > static_cast<uint64_t>(end - p) ||
+								buffer.size() + size > limit) {
+					return false;
+				}
+				buffer.append(p, static_cast<size_t>(size));
+				p += size;
+
+				uint64_t ext = 0;
+				if (!detail::codec_get(p, end, ext) || ext > detail::codec_extensions + 1) {
+					return false;
+				}
+				ext_size = 0;
+				if (ext == detail::codec_extensions + 1) {
+					if (!detail::codec_get(p, end, size) || size > static_cast<uint64_t>(end - p) ||
+									buffer.size() + size > limit) {
+						return false;
+					}
+					exts.push(std::string_view(p, static_cast<size_t>(size)));
+					buffer.append(p, static_cast<size_t>(size));
+					p += size;
+					ext_size = static_cast<size_t>(size);
+				} else if (ext) {
+					if (ext > exts.count) {
+						return false;
+					}
+					exts.touch(static_cast<uint32_t>(ext - 1));
+					buffer.append(exts[0]);
+					ext_size = exts[0].size();
+				}
+				return buffer.size() <= limit;
+			}
+
+			struct span {
+				size_t start;
+				size_t size;
+				size_t ext_size;
+			};
+
+			detail::mru_strings<detail::codec_directories> dirs;
+			detail::mru_strings<detail::codec_extensions>  exts;
+			std::vector<decoded_path>                      entries;
+			std::vector<span>                              spans;
+			std::string                                    buffer;
+		};
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,311 @@
+﻿#pragma once
+
+#include "file.h"
+#include "parallel.h"
+#include "trace.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Derives output paths from input paths through a pattern, compiled once and applied to many paths.
+
+	util::utf8::path_template thumb("{parent}/{stem}_thumb{ext}");
+	std::string out;
+	thumb.append(out, "/media/2024/cat.jpg"); // /media/2024/cat_thumb.jpg
+
+	// millions of paths into one buffer
+	auto names = util::utf8::format_paths(thumb, paths.data(), paths.size());
+	for (size_t i = 0; i < names.size(); i++)
+		write(names[i]);
+
+Fields are written {name} and hold the decomposition of file.h: path, root_name, root_directory,
+root_path, relative_path, parent_path (or parent), filename (or name), stem and extension (or ext).
+Everything else is copied, {{ and }} write a single brace.
+
+Compiling turns the pattern into a list of literal and field ops. Applying it decomposes the path
+once, computes the exact size of the result and writes it with one copy per op, so a result is
+never reallocated or written twice. format_paths keeps the decomposition of every path from
+sizing to writing, so a batch also decomposes each path once.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			enum class template_field : uint8_t {
+				literal,
+				path,
+				root_name,
+				root_directory,
+				root_path,
+				relative_path,
+				parent_path,
+				filename,
+				stem,
+				extension,
+			};
+
+			struct template_op {
+				template_field field;
+				uint32_t       offset; // of the literal in the template's literals
+				uint32_t       size;
+			};
+
+			inline bool parse_template_field(const std::string_view name, template_field& out)
+			{
+				struct entry {
+					std::string_view name;
+					template_field   field;
+				};
+				static constexpr entry fields[] = {
+								{"path", template_field::path},
+								{"root_name", template_field::root_name},
+								{"root_directory", template_field::root_directory},
+								{"root_path", template_field::root_path},
+								{"relative_path", template_field::relative_path},
+								{"parent_path", template_field::parent_path},
+								{"parent", template_field::parent_path},
+								{"filename", template_field::filename},
+								{"name", template_field::filename},
+								{"stem", template_field::stem},
+								{"extension", template_field::extension},
+								{"ext", template_field::extension},
+				};
+				for (const auto& f : fields) {
+					if (f.name == name) {
+						out = f.field;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			/*
+			every field of a path, from one pass over it. kept as the offsets of the cuts between the fields, small
+			enough that a batch keeps one per path between sizing and writing
+			*/
+			struct path_parts {
+				path_parts() = default;
+
+				explicit path_parts(const std::string_view path) : data(path.data())
+				{
+					const char* const tail          = data + path.size();
+					const char* const root_name_end = find_root_name_end(data, tail);
+					const char* const relative      = std::find_if_not(root_name_end, tail, is_slash);
+					const char*       name          = tail;
+					while (name != relative && !is_slash(name[-1])) {
+						--name;
+					}
+					const char* parent_end = name;
+					while (parent_end != relative && is_slash(parent_end[-1])) {
+						--parent_end;
+					}
+					// strip alternate data streams in intra-filename decomposition
+					const char* const ads = std::find(name, tail, ':');
+					const char* const ext = find_extension(name, ads);
+
+					const char* const at[] = {data, root_name_end, relative, parent_end, name, ext, ads, tail};
+					for (size_t i = 0; i < 8; i++) {
+						cuts[i] = static_cast<uint32_t>(at[i] - data);
+					}
+				}
+
+				std::string_view operator[](template_field f) const
+				{
+					// the cuts each field runs between, indexed by template_field
+					static constexpr uint8_t bounds[][2] = {
+									{0, 0}, // literal
+									{0, 7}, // path
+									{0, 1}, // root_name
+									{1, 2}, // root_directory
+									{0, 2}, // root_path
+									{2, 7}, // relative_path
+									{0, 3}, // parent_path
+									{4, 7}, // filename
+									{4, 5}, // stem
+									{5, 6}, // extension
+					};
+					const auto& b = bounds[static_cast<size_t>(f)];
+					return std::string_view(data + cuts[b[0]], cuts[b[1]] - cuts[b[0]]);
+				}
+
+			private:
+				const char* data    = nullptr;
+				uint32_t    cuts[8] = {}; // data, root_name_end, relative, parent_end, name, ext, ads, tail
+			};
+		} // namespace detail
+
+		struct formatted_paths {
+			std::string         buffer;  // the results back to back
+			std::vector<size_t> offsets; // result i is buffer[offsets[i], offsets[i + 1])
+
+			size_t size() const
+			{
+				return offsets.empty() ? 0 : offsets.size() - 1;
+			}
+
+			std::string_view operator[](size_t i) const
+			{
+				return std::string_view(buffer.data() + offsets[i], offsets[i + 1] - offsets[i]);
+			}
+		};
+
+		class path_template {
+		public:
+			path_template() = default;
+
+			/* compiles pattern, an invalid pattern leaves the template empty and false */
+			explicit path_template(const std::string_view pattern)
+			{
+				compile(pattern);
+			}
+
+			/* replaces the template with pattern, returns false (and leaves it empty) if pattern is malformed */
+			bool compile(const std::string_view pattern)
+			{
+				ops.clear();
+				literals.clear();
+				valid = false;
+				for (size_t i = 0; i < pattern.size();) {
+					const char c = pattern[i];
+					if (c == '{' && i + 1 < pattern.size() && pattern[i + 1] == '{') {
+						add_literal("{");
+						i += 2;
+					} else if (c == '}') {
+						if (i + 1 == pattern.size() || pattern[i + 1] != '}') {
+							return clear();
+						}
+						add_literal("}");
+						i += 2;
+					} else if (c == '{') {
+						const auto             close = pattern.find('}', i + 1);
+						detail::template_field field = detail::template_field::literal;
+						if (close == std::string_view::npos ||
+										!detail::parse_template_field(pattern.substr(i + 1, close - i - 1), field)) {
+							return clear();
+						}
+						ops.push_back({field, 0, 0});
+						i = close + 1;
+					} else {
+						const auto next = std::min(pattern.find_first_of("{}", i), pattern.size());
+						add_literal(pattern.substr(i, next - i));
+						i = next;
+					}
+				}
+				valid = true;
+				return true;
+			}
+
+			explicit operator bool() const
+			{
+				return valid;
+			}
+
+			/* the size of the result for path */
+			size_t size(const std::string_view path) const
+			{
+				return size(detail::path_parts(path));
+			}
+
+			/* writes the result for path to out if it fits in capacity, returns its size either way */
+			size_t format(char* const out, const size_t capacity, const std::string_view path) const
+			{
+				const detail::path_parts parts(path);
+				const size_t             n = size(parts);
+				if (n <= capacity) {
+					write(out, parts);
+				}
+				return n;
+			}
+
+			/* appends the result for path to out */
+			void append(std::string& out, const std::string_view path) const
+			{
+				const detail::path_parts parts(path);
+				const size_t             start = out.size();
+				out.resize(start + size(parts));
+				write(out.data() + start, parts);
+			}
+
+		private:
+			friend formatted_paths format_paths(const path_template& pattern, const std::string_view* const paths,
+							const size_t count, const unsigned threads);
+
+			size_t size(const detail::path_parts& parts) const
+			{
+				size_t ret = 0;
+				for (const auto& op : ops) {
+					ret += op.field == detail::template_field::literal ? op.size : parts[op.field].size();
+				}
+				return ret;
+			}
+
+			char* write(char* out, const detail::path_parts& parts) const
+			{
+				for (const auto& op : ops) {
+					const auto text = op.field == detail::template_field::literal
+											? std::string_view(literals).substr(op.offset, op.size)
+											: parts[op.field];
+					if (!text.empty()) {
+						std::memcpy(out, text.data(), text.size());
+						out += text.size();
+					}
+				}
+				return out;
+			}
+
+			void add_literal(const std::string_view text)
+			{
+				// neighbouring literals (eg: around an escaped brace) are merged into one op
+				if (!ops.empty() && ops.back().field == detail::template_field::literal) {
+					ops.back().size += static_cast<uint32_t>(text.size());
+				} else {
+					ops.push_back({detail::template_field::literal, static_cast<uint32_t>(literals.size()),
+									static_cast<uint32_t>(text.size())});
+				}
+				literals.append(text);
+			}
+
+			bool clear()
+			{
+				ops.clear();
+				literals.clear();
+				valid = false;
+				return false;
+			}
+
+			std::vector<detail::template_op> ops;
+			std::string                      literals;
+			bool                             valid = true; // the empty template is valid and writes nothing
+		};
+
+		/*
+		applies pattern to paths[0, count) into one buffer. every result is sized in a first pass and written in
+		place in a second, both split over threads (0 for one per hardware thread)
+		*/
+		inline formatted_paths format_paths(const path_template& pattern, const std::string_view* const paths,
+						const size_t count, const unsigned threads = 0)
+		{
+			const unsigned n = parallel::batch_threads(count, threads);
+
+			FILE_CPP_PROBE2(format_begin, count, n);
+
+			// every path is decomposed once, its parts are kept from sizing to writing
+			formatted_paths                 ret;
+			std::vector<detail::path_parts> parts(count);
+			const size_t total = parallel::concatenate(
+							count, n, ret.buffer, ret.offsets,
+							[&](unsigned, size_t i) {
+								parts[i] = detail::path_parts(paths[i]);
+								return pattern.size(parts[i]);
+							},
+							[&](unsigned, size_t i, char* out) { pattern.write(out, parts[i]); });
+			FILE_CPP_PROBE2(format_end, count, total);
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util
@@ -0,0 +1,343 @@
+﻿#pragma once
+
+#include "file.h"
+#include "simd.h"
+#include "parallel.h"
+#include "mount_table.h"
+#include "path_template.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+
+/*
+Translates paths between Windows and the POSIX forms of WSL (/mnt/c/x), MSYS (/c/x) and Cygwin
+(/cygdrive/c/x) in process, instead of calling out to wslpath or cygpath.
+
+	auto wsl = util::utf8::path_translator::wsl();
+	wsl.add_mount("\\\\wsl$\\Ubuntu", "/");
+	std::string out;
+	wsl.append_posix(out, "C:\\work\\x");     // /mnt/c/work/x
+	wsl.append_windows(out, "/home/me/a.txt"); // \\wsl$\Ubuntu\home\me\a.txt
+
+	auto posix = wsl.to_posix(paths.data(), paths.size()); // one buffer, see path_template.h
+
+Roots are found with find_root_name_end: drive letters map to the drive prefix followed by the
+lowercase letter, UNC roots (\\server\share) to //server/share, and the \\?\ device prefix is
+dropped in front of a drive letter or UNC. Other device paths (\\.\pipe), drive relative paths (C:x)
+and paths relative to the current drive (\x) cannot be translated, in the other direction neither
+can absolute POSIX paths outside the drive prefix. Relative paths only have their separators
+converted. Added mounts are matched by whole components as in mount_table.h, case sensitively
+except for the drive letter, and the longest prefix wins in both directions. The drive prefix with
+a letter counts as a prefix too, so with a mount on / the path /mnt/c/x is still C:\x, while a
+mount on /mnt/c itself would win over the drive.
+
+The root is rewritten and the rest of the path is copied once with its separators converted 16
+bytes at a time. Results are sized exactly before anything is written.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			/* a translated path: head, then up to three generated bytes, then rest with separators converted */
+			struct translation {
+				std::string_view head;
+				char             extra[3]   = {};
+				uint8_t          extra_size = 0;
+				std::string_view rest;
+
+				size_t size() const
+				{
+					return head.size() + extra_size + rest.size();
+				}
+			};
+
+			inline char* copy_converting_separators(const char* first, const char* const last, char* out, char to)
+			{
+				// copies [first, last) to out with every '/' and '\\' written as to, returns the end of out
+#if defined(FILE_CPP_SSE2)
+				const __m128i fill = _mm_set1_epi8(to);
+				for (; last - first >= 16; first += 16, out += 16) {
+					const __m128i v       = simd::load(first);
+					const __m128i slashes = simd::is_slash(v);
+					const __m128i mixed   = _mm_or_si128(_mm_andnot_si128(slashes, v), _mm_and_si128(slashes, fill));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out), mixed);
+				}
+#endif
+				for (; first != last; ++first, ++out) {
+					*out = is_slash(*first) ? to : *first;
+				}
+				return out;
+			}
+
+			constexpr bool is_drive_letter(char c)
+			{
+				return (uint8_t)((uint8_t)ascii_lowercase(c) - (uint8_t)'a') < 26;
+			}
+		} // namespace detail
+
+		class path_translator {
+		public:
+			static constexpr size_t untranslatable = SIZE_MAX;
+
+			/* drive_prefix is the POSIX directory holding the drive letters, eg: "/mnt/" */
+			explicit path_translator(const std::string_view drive_prefix) : drives(drive_prefix)
+			{
+				if (drives.empty() || drives.back() != '/') {
+					drives.push_back('/');
+				}
+			}
+
+			static path_translator wsl()
+			{
+				return path_translator("/mnt/");
+			}
+
+			static path_translator msys()
+			{
+				return path_translator("/");
+			}
+
+			static path_translator cygwin()
+			{
+				return path_translator("/cygdrive/");
+			}
+
+			/* maps the Windows root windows_root to posix_root and back, eg: ("\\\\nas\\media", "/media") */
+			void add_mount(const std::string_view windows_root, const std::string_view posix_root)
+			{
+				windows_mounts.insert(windows_root, std::string(posix_root));
+				if (has_drive_letter_prefix(windows_root.data(), windows_root.data() + windows_root.size())) {
+					// drive letters are case insensitive, register the other case too
+					std::string other(windows_root);
+					other[0] = ascii_lowercase(other[0]) == other[0] ? ascii_uppercase(other[0])
+																	 : ascii_lowercase(other[0]);
+					windows_mounts.insert(other, std::string(posix_root));
+				}
+				posix_mounts.insert(posix_root, std::string(windows_root));
+			}
+
+			/* writes the POSIX form of path to out if it fits in capacity, returns its size or untranslatable */
+			size_t to_posix(const std::string_view path, char* const out, const size_t capacity) const
+			{
+				detail::translation t;
+				if (!posix_translation(path, t)) {
+					return untranslatable;
+				}
+				if (t.size() <= capacity) {
+					write(t, out, '/');
+				}
+				return t.size();
+			}
+
+			/* writes the Windows form of path to out if it fits in capacity, returns its size or untranslatable */
+			size_t to_windows(const std::string_view path, char* const out, const size_t capacity) const
+			{
+				detail::translation t;
+				if (!windows_translation(path, t)) {
+					return untranslatable;
+				}
+				if (t.size() <= capacity) {
+					write(t, out, '\\');
+				}
+				return t.size();
+			}
+
+			/* appends the POSIX form of path to out, false (and nothing appended) if it cannot be translated */
+			bool append_posix(std::string& out, const std::string_view path) const
+			{
+				detail::translation t;
+				return posix_translation(path, t) && append(out, t, '/');
+			}
+
+			/* appends the Windows form of path to out, false (and nothing appended) if it cannot be translated */
+			bool append_windows(std::string& out, const std::string_view path) const
+			{
+				detail::translation t;
+				return windows_translation(path, t) && append(out, t, '\\');
+			}
+
+			/*
+			translates paths[0, count) to POSIX into one buffer. paths that cannot be translated are copied as they
+			are and their indices added to untranslated, if given
+			*/
+			formatted_paths to_posix(const std::string_view* const paths, const size_t count,
+							std::vector<uint32_t>* const untranslated = nullptr, const unsigned threads = 0) const
+			{
+				return translate_all(paths, count, untranslated, threads, true);
+			}
+
+			/* translates paths[0, count) to Windows into one buffer, as to_posix */
+			formatted_paths to_windows(const std::string_view* const paths, const size_t count,
+							std::vector<uint32_t>* const untranslated = nullptr, const unsigned threads = 0) const
+			{
+				return translate_all(paths, count, untranslated, threads, false);
+			}
+
+		private:
+			static void join(detail::translation& t, const std::string_view path, const size_t length)
+			{
+				// the mount's root replaces path[0, length), with exactly one separator before the rest of the path
+				t.rest = path.substr(length);
+				if (!t.head.empty() && is_slash(t.head.back())) {
+					while (!t.rest.empty() && is_slash(t.rest.front())) {
+						t.rest.remove_prefix(1);
+					}
+				} else if (t.rest.empty() ? length && is_slash(path[length - 1]) : !is_slash(t.rest.front())) {
+					t.extra[t.extra_size++] = '/'; // a matched root directory (/) keeps its separator
+				}
+			}
+
+			bool posix_translation(std::string_view path, detail::translation& t) const
+			{
+				const char* first = path.data();
+				const char* last  = first + path.size();
+				const char* root  = find_root_name_end(first, last);
+				if (root - first == 3 && is_slash(first[1]) && first[2] == '?') {
+					// \\?\C:\x and \\?\UNC\server\share are the same paths without the device prefix
+					path.remove_prefix(std::min<size_t>(path.size(), 4));
+					if (path.size() >= 3 && fold_letter(path[0]) == 'u' && fold_letter(path[1]) == 'n' &&
+									fold_letter(path[2]) == 'c' && (path.size() == 3 || is_slash(path[3]))) {
+						t.head = "/";
+						t.rest = path.substr(3);
+						return true;
+					}
+					first = path.data();
+					last  = first + path.size();
+					root  = find_root_name_end(first, last);
+					if (root == first || !is_drive_prefix(first)) {
+						return false;
+					}
+				}
+
+				if (const auto m = windows_mounts.find(path)) {
+					t.head = *m.value;
+					join(t, path, m.length);
+					return true;
+				}
+				if (root - first == 2 && is_drive_prefix(first)) {
+					if (root != last && !is_slash(*root)) {
+						return false; // drive relative
+					}
+					t.head                  = drives;
+					t.extra[t.extra_size++] = ascii_lowercase(first[0]);
+					t.rest                  = path.substr(2);
+					return true;
+				}
+				if (root != first) {
+					// \\server\share keeps its form, other devices (\\.\, \??\) have none
+					if (first[2] == '.' || first[2] == '?' || first[1] == '?') {
+						return false;
+					}
+					t.rest = path;
+					return true;
+				}
+				if (root != last && is_slash(*root)) {
+					return false; // relative to the current drive
+				}
+				t.rest = path;
+				return true;
+			}
+
+			bool windows_translation(const std::string_view path, detail::translation& t) const
+			{
+				// the drive prefix and letter compete with the mounts as one more mount, so /mnt/c beats a mount on /
+				const bool on_drive = path.size() > drives.size() && path.substr(0, drives.size()) == drives &&
+								detail::is_drive_letter(path[drives.size()]) &&
+								(path.size() == drives.size() + 1 || path[drives.size() + 1] == '/');
+				if (const auto m = posix_mounts.find(path); m && (!on_drive || m.length > drives.size())) {
+					t.head = *m.value;
+					join(t, path, m.length);
+					return true;
+				}
+				if (on_drive) {
+					t.extra[t.extra_size++] = ascii_uppercase(path[drives.size()]);
+					t.extra[t.extra_size++] = ':';
+					t.rest                  = path.substr(drives.size() + 1);
+					if (t.rest.empty()) {
+						t.extra[t.extra_size++] = '\\'; // /mnt/c is C:\, not the drive relative C:
+					}
+					return true;
+				}
+				if (path.size() >= 3 && path[0] == '/' && path[1] == '/' && path[2] != '/') {
+					t.rest = path; // //server/share
+					return true;
+				}
+				if (!path.empty() && path[0] == '/') {
+					return false;
+				}
+				t.rest = path;
+				return true;
+			}
+
+			static char* write(const detail::translation& t, char* out, char separator)
+			{
+				if (!t.head.empty()) {
+					std::memcpy(out, t.head.data(), t.head.size());
+					out += t.head.size();
+				}
+				for (uint8_t i = 0; i < t.extra_size; i++) {
+					*out++ = is_slash(t.extra[i]) ? separator : t.extra[i];
+				}
+				return detail::copy_converting_separators(t.rest.data(), t.rest.data() + t.rest.size(), out, separator);
+			}
+
+			static bool append(std::string& out, const detail::translation& t, char separator)
+			{
+				const size_t start = out.size();
+				out.resize(start + t.size());
+				write(t, out.data() + start, separator);
+				return true;
+			}
+
+			formatted_paths translate_all(const std::string_view* const paths, const size_t count,
+							std::vector<uint32_t>* const untranslated, const unsigned threads, const bool posix) const
+			{
+				// every path is translated once, the translation (views into the path and the mounts) is kept from
+				// sizing to writing
+				const unsigned                     n         = parallel::batch_threads(count, threads);
+				const char                         separator = posix ? '/' : '\\';
+				formatted_paths                    ret;
+				std::vector<detail::translation>   translations(count);
+				std::vector<std::vector<uint32_t>> failed(n);
+				std::vector<size_t>                next(n, 0);
+				const auto                         translate = [&](std::string_view path, detail::translation& t) {
+					return posix ? posix_translation(path, t) : windows_translation(path, t);
+				};
+				parallel::concatenate(
+								count, n, ret.buffer, ret.offsets,
+								[&](unsigned t, size_t i) {
+									auto& tr = translations[i];
+									if (!translate(paths[i], tr)) {
+										failed[t].push_back(static_cast<uint32_t>(i));
+										tr      = {};
+										tr.head = paths[i]; // copied as is
+									}
+									return tr.size();
+								},
+								[&](unsigned t, size_t i, char* out) {
+									// failed[t] is in index order, next[t] is the first one not written yet
+									if (next[t] < failed[t].size() && failed[t][next[t]] == i) {
+										std::memcpy(out, paths[i].data(), paths[i].size());
+										next[t]++;
+									} else {
+										write(translations[i], out, separator);
+									}
+								});
+				if (untranslated) {
+					for (const auto& f : failed) {
+						untranslated->insert(untranslated->end(), f.begin(), f.end());
+					}
+				}
+				return ret;
+			}
+
+			std::string              drives; // drive prefix, ends in '/'
+			mount_table<std::string> windows_mounts;
+			mount_table<std::string> posix_mounts;
+		};
+	} // namespace utf8
+} // namespace util
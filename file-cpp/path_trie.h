@@ -0,0 +1,701 @@
+﻿#pragma once
+
+#include "file.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Static succinct trie over path components, for shipping a large read only set of paths (an
+allow-list) that is queried in place from a mapped file, with nothing to load or decode first.
+
+	util::write_file_atomic("allow.trie", util::utf8::build_path_trie(paths.data(), paths.size()));
+
+	util::mapped_file file("allow.trie");
+	util::utf8::path_trie_view allow(file.view());
+	allow.contains("/usr/lib/libc.so.6");
+	allow.longest_prefix("/opt/app/bin/tool"); // bytes of the longest listed path above it, or npos
+	allow.for_each("/etc", [](std::string_view path) { ... });
+
+Paths are split into their root_path and the components of their relative_path (see components()),
+so separators are not significant and "a/b" and "a\\b" are the same path. The root compares with
+its separators as '/' ("C:\\x" and "C:/x" are the same path), components compare exactly (case
+sensitive). Listed paths get ids 0 to path_count() - 1.
+
+The shape of the trie is LOUDS: one 1 bit per child and a 0 bit per node in breadth first order,
+about 2 bits a node, navigated with select0 over a sampled rank directory. The component labels
+are deduplicated, every node keeps a bit packed label id and a node's children are in label order
+for a binary search. The label strings are tail compressed, a label that is the suffix of another
+is stored inside it. A path costs a few bytes, mostly its label ids.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			constexpr char     path_trie_magic[8] = {'F', 'P', 'T', 'R', 'I', 'E', '0', '1'};
+			constexpr uint32_t trie_block_words   = 8;   // 512 bits a rank block
+			constexpr uint32_t trie_select_sample = 512; // zeros between select hints
+
+			struct path_trie_header {
+				char     magic[8];
+				uint32_t node_count;
+				uint32_t path_count;
+				uint32_t label_count;
+				uint32_t label_size_bits; // a label is packed as offset << label_size_bits | size
+				uint64_t tail_size;       // padded to a multiple of 8
+			};
+
+			struct trie_bits_header {
+				uint64_t bits;
+				uint64_t ones;
+				uint32_t rank_count;   // blocks + 1
+				uint32_t sample_count; // select hints, the block of every 512th zero
+			};
+
+			struct trie_packed_header {
+				uint64_t count;
+				uint32_t width;
+				uint32_t word_count;
+			};
+
+			inline void trie_align(std::string& out)
+			{
+				out.resize((out.size() + 7) & ~size_t{7}, '\0');
+			}
+
+			template<typename T> inline void trie_put(std::string& out, const T* const data, const size_t count)
+			{
+				out.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+				trie_align(out);
+			}
+
+			template<typename T> inline const T* trie_get(const char*& p, const char* const end, const size_t count)
+			{
+				// count Ts at p, 8 byte aligned in the image, nullptr if they run past end
+				const size_t size = (count * sizeof(T) + 7) & ~size_t{7};
+				if (count > static_cast<size_t>(end - p) / sizeof(T) || size > static_cast<size_t>(end - p)) {
+					return nullptr;
+				}
+				const auto ret = reinterpret_cast<const T*>(p);
+				p += size;
+				return ret;
+			}
+
+			/* a bit vector being built, serialized with its rank directory and select hints */
+			struct trie_bits_builder {
+				std::vector<uint64_t> words;
+				uint64_t              size = 0;
+
+				void push(const bool bit)
+				{
+					if (size % 64 == 0) {
+						words.push_back(0);
+					}
+					words.back() |= uint64_t{bit} << (size % 64);
+					size++;
+				}
+
+				void serialize(std::string& out) const
+				{
+					// the unused bits of the last word are ones, so select0 never lands in them
+					std::vector<uint64_t> padded = words;
+					if (size % 64) {
+						padded.back() |= ~uint64_t{0} << (size % 64);
+					}
+					const size_t          blocks = (padded.size() + trie_block_words - 1) / trie_block_words;
+					std::vector<uint32_t> ranks(blocks + 1, 0);
+					std::vector<uint32_t> samples;
+					uint64_t              ones  = 0;
+					uint64_t              zeros = 0;
+					for (size_t b = 0; b < blocks; b++) {
+						ranks[b] = static_cast<uint32_t>(ones);
+						const size_t last = std::min(padded.size(), (b + 1) * trie_block_words);
+						for (size_t w = b * trie_block_words; w < last; w++) {
+							const uint64_t z = static_cast<uint64_t>(std::popcount(~padded[w]));
+							// a hint for every multiple of the sample rate among this word's zeros
+							while (samples.size() * trie_select_sample < zeros + z) {
+								samples.push_back(static_cast<uint32_t>(b));
+							}
+							zeros += z;
+							ones += static_cast<uint64_t>(std::popcount(padded[w]));
+						}
+					}
+					ranks[blocks] = static_cast<uint32_t>(ones);
+
+					const trie_bits_header header = {size, ones - (padded.size() * 64 - size),
+									static_cast<uint32_t>(ranks.size()), static_cast<uint32_t>(samples.size())};
+					trie_put(out, &header, 1);
+					trie_put(out, padded.data(), padded.size());
+					trie_put(out, ranks.data(), ranks.size());
+					trie_put(out, samples.data(), samples.size());
+				}
+			};
+
+			class trie_bits_view {
+			public:
+				bool parse(const char*& p, const char* const end)
+				{
+					const auto header = trie_get<trie_bits_header>(p, end, 1);
+					if (!header || header->bits > uint64_t{UINT32_MAX} * 64) {
+						return false;
+					}
+					const uint64_t word_count = (header->bits + 63) / 64;
+					const uint64_t blocks     = (word_count + trie_block_words - 1) / trie_block_words;
+					if (header->rank_count != blocks + 1 || header->ones > header->bits ||
+									header->sample_count != (header->bits - header->ones + trie_select_sample - 1) /
+																	  trie_select_sample) {
+						return false;
+					}
+					words   = trie_get<uint64_t>(p, end, word_count);
+					ranks   = trie_get<uint32_t>(p, end, header->rank_count);
+					samples = trie_get<uint32_t>(p, end, header->sample_count);
+					if (!words || !ranks || !samples) {
+						return false;
+					}
+					for (uint32_t i = 0; i < header->sample_count; i++) {
+						if (samples[i] >= blocks) {
+							return false;
+						}
+					}
+					// the directory is what select0 walks, so it has to be consistent
+					for (uint64_t b = 0; b < blocks; b++) {
+						if (ranks[b + 1] < ranks[b] || ranks[b + 1] - ranks[b] > 512) {
+							return false;
+						}
+					}
+					if (ranks[blocks] != header->ones + (word_count * 64 - header->bits)) {
+						return false;
+					}
+					bits         = header->bits;
+					ones_count   = header->ones;
+					blocks_count = static_cast<uint32_t>(blocks);
+					return true;
+				}
+
+				bool get(const uint64_t i) const
+				{
+					return (words[i / 64] >> (i % 64)) & 1;
+				}
+
+				/* ones in [0, i) */
+				uint64_t rank1(const uint64_t i) const
+				{
+					const uint64_t block = i / 512;
+					uint64_t       ret   = ranks[block];
+					for (uint64_t w = block * trie_block_words; w < i / 64; w++) {
+						ret += static_cast<uint64_t>(std::popcount(words[w]));
+					}
+					if (i % 64) {
+						ret += static_cast<uint64_t>(std::popcount(words[i / 64] & ((uint64_t{1} << (i % 64)) - 1)));
+					}
+					return ret;
+				}
+
+				/* position of zero k (from 0), which must exist */
+				uint64_t select0(const uint64_t k) const
+				{
+					uint32_t block = samples[k / trie_select_sample];
+					while (block + 1 < blocks_count && zeros_before(block + 1) <= k) {
+						block++;
+					}
+					uint64_t rest = k - zeros_before(block);
+					for (uint64_t w = uint64_t{block} * trie_block_words;; w++) {
+						uint64_t       zeros = ~words[w];
+						const uint64_t n     = static_cast<uint64_t>(std::popcount(zeros));
+						if (rest < n) {
+							// skip whole bytes, then clear the zeros before the one wanted
+							uint64_t shift = 0;
+							for (;;) {
+								const auto in_byte = static_cast<uint64_t>(std::popcount((zeros >> shift) & 0xff));
+								if (rest < in_byte) {
+									break;
+								}
+								rest -= in_byte;
+								shift += 8;
+							}
+							zeros >>= shift;
+							for (; rest; rest--) {
+								zeros &= zeros - 1;
+							}
+							return w * 64 + shift + static_cast<uint64_t>(std::countr_zero(zeros));
+						}
+						rest -= n;
+					}
+				}
+
+				/* position of the first zero at or after i, which must exist */
+				uint64_t next0(const uint64_t i) const
+				{
+					uint64_t w     = i / 64;
+					uint64_t zeros = ~words[w] >> (i % 64) << (i % 64);
+					while (!zeros) {
+						zeros = ~words[++w];
+					}
+					return w * 64 + static_cast<uint64_t>(std::countr_zero(zeros));
+				}
+
+				uint64_t size() const
+				{
+					return bits;
+				}
+
+				uint64_t ones() const
+				{
+					return ones_count;
+				}
+
+			private:
+				uint64_t zeros_before(const uint32_t block) const
+				{
+					return uint64_t{block} * 512 - ranks[block];
+				}
+
+				const uint64_t* words        = nullptr;
+				const uint32_t* ranks        = nullptr;
+				const uint32_t* samples      = nullptr;
+				uint64_t        bits         = 0;
+				uint64_t        ones_count   = 0;
+				uint32_t        blocks_count = 0;
+			};
+
+			inline void trie_pack(std::string& out, const std::vector<uint64_t>& values)
+			{
+				uint64_t largest = 0;
+				for (const auto v : values) {
+					largest = std::max(largest, v);
+				}
+				const uint32_t        width = static_cast<uint32_t>(std::max<uint64_t>(1, std::bit_width(largest)));
+				std::vector<uint64_t> words((values.size() * width + 63) / 64 + 1, 0); // one more, so get() reads two
+				for (size_t i = 0; i < values.size(); i++) {
+					const uint64_t bit = i * width;
+					words[bit / 64] |= values[i] << (bit % 64);
+					if (bit % 64 + width > 64) {
+						words[bit / 64 + 1] |= values[i] >> (64 - bit % 64);
+					}
+				}
+				const trie_packed_header header = {values.size(), width, static_cast<uint32_t>(words.size())};
+				trie_put(out, &header, 1);
+				trie_put(out, words.data(), words.size());
+			}
+
+			class trie_packed_view {
+			public:
+				bool parse(const char*& p, const char* const end)
+				{
+					const auto header = trie_get<trie_packed_header>(p, end, 1);
+					if (!header || header->width == 0 || header->width > 64 ||
+									header->count > (uint64_t{UINT32_MAX} * 64) / header->width ||
+									header->word_count != (header->count * header->width + 63) / 64 + 1) {
+						return false;
+					}
+					words = trie_get<uint64_t>(p, end, header->word_count);
+					count = header->count;
+					width = header->width;
+					mask  = width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1;
+					return words != nullptr;
+				}
+
+				uint64_t operator[](const uint64_t i) const
+				{
+					const uint64_t bit = i * width;
+					uint64_t       v   = words[bit / 64] >> (bit % 64);
+					if (bit % 64 + width > 64) {
+						v |= words[bit / 64 + 1] << (64 - bit % 64);
+					}
+					return v & mask;
+				}
+
+				uint64_t size() const
+				{
+					return count;
+				}
+
+			private:
+				const uint64_t* words = nullptr;
+				uint64_t        count = 0;
+				uint32_t        width = 0;
+				uint64_t        mask  = 0;
+			};
+
+			/*
+			root as a label: separators of the root-name as '/' and the root-directory as a single '/', so "C:\\",
+			"C:/" and "C://" are the same root. root itself when it already is in that form, else built in scratch
+			*/
+			inline std::string_view canonical_trie_root(const std::string_view root, std::string& scratch)
+			{
+				const char* const first         = root.data();
+				const char* const last          = first + root.size();
+				const char* const root_name_end = find_root_name_end(first, last);
+				const bool        canonical     = std::find(first, root_name_end, '\\') == root_name_end &&
+								(root_name_end == last || (last - root_name_end == 1 && *root_name_end == '/'));
+				if (canonical) {
+					return root;
+				}
+				scratch.clear();
+				for (auto it = first; it != root_name_end; ++it) {
+					scratch.push_back(is_slash(*it) ? '/' : *it);
+				}
+				if (root_name_end != last) {
+					scratch.push_back('/');
+				}
+				return scratch;
+			}
+
+			template<typename Fn>
+			inline void for_each_trie_component(const std::string_view path, std::string& scratch, Fn&& fn)
+			{
+				// the canonical root_path, then the components of relative_path as components() splits them
+				const char* const data = path.data();
+				const char* const tail = data + path.size();
+				const char*       p    = find_relative_path(data, tail);
+				if (p != data) {
+					fn(canonical_trie_root(std::string_view(data, static_cast<size_t>(p - data)), scratch),
+									static_cast<size_t>(p - data));
+				}
+				while (p != tail) {
+					while (p != tail && is_slash(*p)) {
+						++p;
+					}
+					const char* const first = p;
+					while (p != tail && !is_slash(*p)) {
+						++p;
+					}
+					if (p != first) {
+						fn(std::string_view(first, static_cast<size_t>(p - first)), static_cast<size_t>(p - data));
+					}
+				}
+			}
+		} // namespace detail
+
+		/* the image of a path_trie_view holding paths[0, count), duplicates are listed once */
+		inline std::string build_path_trie(const std::string_view* const paths, const size_t count)
+		{
+			// every path as a run of components, sorted and deduplicated
+			std::vector<std::string_view> names;
+			std::vector<size_t>           starts;
+			std::deque<std::string>       roots; // canonical roots that are not in the paths as they are
+			std::string                   scratch;
+			starts.reserve(count + 1);
+			for (size_t i = 0; i < count; i++) {
+				starts.push_back(names.size());
+				detail::for_each_trie_component(paths[i], scratch, [&](const std::string_view name, size_t) {
+					if (name.data() == scratch.data()) {
+						// consecutive paths mostly share their root, keep one copy of it for the run
+						if (roots.empty() || roots.back() != name) {
+							roots.emplace_back(name);
+						}
+						names.push_back(roots.back());
+					} else {
+						names.push_back(name);
+					}
+				});
+			}
+			starts.push_back(names.size());
+			const auto path_of = [&](const size_t i) {
+				return std::pair(names.begin() + starts[i], names.begin() + starts[i + 1]);
+			};
+			std::vector<uint32_t> order(count);
+			for (uint32_t i = 0; i < count; i++) {
+				order[i] = i;
+			}
+			const auto less = [&](const uint32_t a, const uint32_t b) {
+				const auto [a_first, a_last] = path_of(a);
+				const auto [b_first, b_last] = path_of(b);
+				return std::lexicographical_compare(a_first, a_last, b_first, b_last);
+			};
+			std::sort(order.begin(), order.end(), less);
+			order.erase(std::unique(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return !less(a, b); }),
+							order.end());
+
+			// breadth first, a node is the run of sorted paths [first, last) sharing its first depth components
+			struct pending {
+				uint32_t first;
+				uint32_t last;
+				uint32_t depth;
+			};
+			detail::trie_bits_builder     louds;
+			detail::trie_bits_builder     terminal;
+			std::vector<std::string_view> node_names;
+			std::vector<pending>          queue = {{0, static_cast<uint32_t>(order.size()), 0}};
+			louds.push(true);
+			louds.push(false);
+			for (size_t q = 0; q < queue.size(); q++) {
+				const auto node = queue[q];
+				uint32_t   i    = node.first;
+				const bool ends = i < node.last && starts[order[i] + 1] - starts[order[i]] == node.depth;
+				terminal.push(ends);
+				i += ends;
+				while (i < node.last) {
+					const auto name = names[starts[order[i]] + node.depth];
+					uint32_t   j    = i + 1;
+					while (j < node.last && names[starts[order[j]] + node.depth] == name) {
+						j++;
+					}
+					louds.push(true);
+					node_names.push_back(name);
+					queue.push_back({i, j, node.depth + 1});
+					i = j;
+				}
+				louds.push(false);
+			}
+
+			// labels sorted, so children sorted by label are sorted by label id
+			std::vector<std::string_view> labels(node_names);
+			std::sort(labels.begin(), labels.end());
+			labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+			std::vector<uint64_t> node_labels(node_names.size());
+			for (size_t i = 0; i < node_names.size(); i++) {
+				node_labels[i] = static_cast<uint64_t>(
+								std::lower_bound(labels.begin(), labels.end(), node_names[i]) - labels.begin());
+			}
+
+			// tail compression: in reverse order a label's extensions follow it, the longest of them stores it
+			std::vector<uint32_t> by_suffix(labels.size());
+			for (uint32_t i = 0; i < by_suffix.size(); i++) {
+				by_suffix[i] = i;
+			}
+			std::sort(by_suffix.begin(), by_suffix.end(), [&](uint32_t a, uint32_t b) {
+				return std::lexicographical_compare(labels[a].rbegin(), labels[a].rend(), labels[b].rbegin(),
+								labels[b].rend());
+			});
+			std::string           tail;
+			std::vector<uint64_t> label_offsets(labels.size());
+			std::vector<uint64_t> label_sizes(labels.size());
+			uint64_t              largest = 0;
+			for (size_t k = by_suffix.size(); k-- > 0;) {
+				const auto label = labels[by_suffix[k]];
+				const bool inner = k + 1 < by_suffix.size() && labels[by_suffix[k + 1]].ends_with(label);
+				// the next label in reverse order ends with this one, so does the one storing it
+				const uint64_t offset = inner ? label_offsets[by_suffix[k + 1]] + label_sizes[by_suffix[k + 1]] -
+														label.size()
+											  : tail.size();
+				if (!inner) {
+					tail.append(label);
+				}
+				label_offsets[by_suffix[k]] = offset;
+				label_sizes[by_suffix[k]]   = label.size();
+				largest                     = std::max<uint64_t>(largest, label.size());
+			}
+			// offset and size in one entry, so a label is one read
+			const auto size_bits = static_cast<uint32_t>(std::bit_width(largest));
+			for (size_t i = 0; i < labels.size(); i++) {
+				label_offsets[i] = label_offsets[i] << size_bits | label_sizes[i];
+			}
+
+			detail::path_trie_header header = {};
+			std::memcpy(header.magic, detail::path_trie_magic, sizeof(header.magic));
+			header.node_count  = static_cast<uint32_t>(queue.size());
+			header.path_count  = static_cast<uint32_t>(order.size());
+			header.label_count     = static_cast<uint32_t>(labels.size());
+			header.label_size_bits = size_bits;
+			header.tail_size   = (tail.size() + 7) & ~uint64_t{7};
+
+			std::string ret;
+			detail::trie_put(ret, &header, 1);
+			louds.serialize(ret);
+			terminal.serialize(ret);
+			detail::trie_pack(ret, node_labels);
+			detail::trie_pack(ret, label_offsets);
+			ret.append(tail);
+			detail::trie_align(ret);
+			return ret;
+		}
+
+		/* read only view of a build_path_trie image, eg: from a mapped_file */
+		class path_trie_view {
+		public:
+			static constexpr size_t npos = SIZE_MAX;
+
+			explicit path_trie_view(const std::string_view image)
+			{
+				detail::path_trie_header header = {};
+				if (image.size() < sizeof(header) || reinterpret_cast<uintptr_t>(image.data()) % 8) {
+					return;
+				}
+				std::memcpy(&header, image.data(), sizeof(header));
+				const char* p   = image.data() + sizeof(header);
+				const char* end = image.data() + image.size();
+				if (std::memcmp(header.magic, detail::path_trie_magic, sizeof(header.magic)) != 0 ||
+								!louds.parse(p, end) || !terminal.parse(p, end) || !node_labels.parse(p, end) ||
+								!label_entries.parse(p, end) || header.label_size_bits > 32 ||
+								header.tail_size != static_cast<uint64_t>(end - p)) {
+					return;
+				}
+				// node n's children are the ones between zero n and zero n + 1 of louds, so there are node_count zeros
+				const uint64_t nodes = header.node_count;
+				const uint64_t labels_count = header.label_count;
+				if (nodes == 0 || louds.size() != 2 * nodes + 1 || louds.ones() != nodes || terminal.size() != nodes ||
+								terminal.ones() != header.path_count || node_labels.size() != nodes - 1 ||
+								label_entries.size() != labels_count) {
+					return;
+				}
+				// labels are checked as they are read, so opening costs nothing per node or label
+				tail       = p;
+				tail_size  = header.tail_size;
+				size_bits  = header.label_size_bits;
+				node_count = header.node_count;
+				paths      = header.path_count;
+				labels     = header.label_count;
+			}
+
+			bool valid() const
+			{
+				return tail != nullptr;
+			}
+
+			size_t path_count() const
+			{
+				return paths;
+			}
+
+			/* the id of path, npos if it is not listed */
+			size_t find(const std::string_view path) const
+			{
+				uint32_t    node  = 0;
+				bool        found = valid();
+				std::string scratch;
+				detail::for_each_trie_component(path, scratch, [&](const std::string_view name, size_t) {
+					found = found && child(node, name, node);
+				});
+				return found && terminal.get(node) ? static_cast<size_t>(terminal.rank1(node)) : npos;
+			}
+
+			bool contains(const std::string_view path) const
+			{
+				return find(path) != npos;
+			}
+
+			/* bytes of path covered by the longest listed path that path is in (or equal to), npos if there is none */
+			size_t longest_prefix(const std::string_view path) const
+			{
+				size_t      ret   = valid() && terminal.get(0) ? 0 : npos;
+				uint32_t    node  = 0;
+				bool        found = valid();
+				std::string scratch;
+				detail::for_each_trie_component(path, scratch, [&](const std::string_view name, size_t end) {
+					found = found && child(node, name, node);
+					if (found && terminal.get(node)) {
+						ret = end;
+					}
+				});
+				return ret;
+			}
+
+			/* calls fn(std::string_view) with every listed path at or below prefix, in order, joined with '/' */
+			template<typename Fn> void for_each(const std::string_view prefix, Fn&& fn) const
+			{
+				uint32_t    node  = 0;
+				bool        found = valid();
+				std::string scratch;
+				detail::for_each_trie_component(prefix, scratch, [&](const std::string_view name, size_t) {
+					found = found && child(node, name, node);
+				});
+				if (found) {
+					std::string path = prefix_path(prefix);
+					visit(node, path, fn);
+				}
+			}
+
+		private:
+			std::string_view label(const uint64_t id) const
+			{
+				if (id >= labels) {
+					return {};
+				}
+				const uint64_t entry  = label_entries[id];
+				const uint64_t offset = entry >> size_bits;
+				const uint64_t size   = entry & ((uint64_t{1} << size_bits) - 1);
+				if (offset > tail_size || size > tail_size - offset) {
+					return {};
+				}
+				return std::string_view(tail + offset, static_cast<size_t>(size));
+			}
+
+			std::string_view node_label(const uint32_t node) const
+			{
+				return label(node_labels[node - 1]);
+			}
+
+			/* the children of node are [first, last) */
+			void children(const uint32_t node, uint32_t& first, uint32_t& last) const
+			{
+				const uint64_t start = louds.select0(node) + 1;
+				const uint64_t end   = louds.next0(start); // usually in the same word
+				first                = static_cast<uint32_t>(start - node - 1); // ones before start
+				last                 = first + static_cast<uint32_t>(end - start);
+			}
+
+			bool child(const uint32_t node, const std::string_view name, uint32_t& out) const
+			{
+				// children are sorted by label, most nodes have few so their labels are compared directly
+				uint32_t first = 0;
+				uint32_t last  = 0;
+				children(node, first, last);
+				while (first < last) {
+					const auto mid = first + (last - first) / 2;
+					const auto c   = node_label(mid).compare(name);
+					if (c == 0) {
+						out = mid;
+						return true;
+					}
+					if (c < 0) {
+						first = mid + 1;
+					} else {
+						last = mid;
+					}
+				}
+				return false;
+			}
+
+			static std::string prefix_path(const std::string_view prefix)
+			{
+				std::string ret;
+				std::string scratch;
+				detail::for_each_trie_component(prefix, scratch, [&](const std::string_view name, size_t) {
+					join(ret, name);
+				});
+				return ret;
+			}
+
+			static void join(std::string& path, const std::string_view name)
+			{
+				if (!path.empty() && !is_slash(path.back())) {
+					path.push_back('/');
+				}
+				path.append(name);
+			}
+
+			template<typename Fn> void visit(const uint32_t node, std::string& path, Fn& fn) const
+			{
+				if (terminal.get(node)) {
+					fn(std::string_view(path));
+				}
+				uint32_t first = 0;
+				uint32_t last  = 0;
+				children(node, first, last);
+				const size_t size = path.size();
+				for (uint32_t c = first; c < last; c++) {
+					join(path, node_label(c));
+					visit(c, path, fn);
+					path.resize(size);
+				}
+			}
+
+			detail::trie_bits_view   louds;
+			detail::trie_bits_view   terminal;
+			detail::trie_packed_view node_labels;
+			detail::trie_packed_view label_entries;
+			const char*              tail       = nullptr;
+			uint64_t                 tail_size  = 0;
+			uint32_t                 size_bits  = 0;
+			uint32_t                 node_count = 0;
+			uint32_t                 paths      = 0;
+			uint32_t                 labels     = 0;
+		};
+	} // namespace utf8
+} // namespace util
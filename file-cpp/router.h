@@ -0,0 +1,408 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+Matches request paths against a set of route patterns, eg:
+
+	util::utf8::router<int> routes;
+	routes.add("/assets/:bucket", 1);
+	routes.add("/img/thumb_*.png", 2);
+	routes.add("/api/v1/users/:id", 3);
+	routes.add("*rest", 4); // everything else, leading separators of a pattern are optional
+
+	auto m = routes.find("/img/thumb_cat.png?v=3");
+	// *m.value == 2, m.param(0) == "cat"
+	m = routes.find("/assets/public/css/site.css");
+	// *m.value == 4, m.param("rest") == "assets/public/css/site.css"
+
+Pattern segments are:
+* literal            matches exactly that component
+* :name              matches any one component
+* prefix*suffix      matches one component starting with prefix and ending with suffix, the part matched by
+                     the star is captured (eg: "*.png")
+* *name or *         matches the rest of the path (possibly empty), only as the last segment
+
+Patterns compile into a tree keyed by whole components. Literal children of all nodes live in a
+single hash table keyed by (node, component) so each level costs one hash probe. When several
+children can match, literals are preferred over globs, globs over parameters and parameters over
+catch-alls, backtracking if a more specific branch fails further down.
+
+Components are split like the rest of file.h: '/' and '\\' are separators and runs of them count
+as one. Anything from the first '?' or '#' is ignored. Captures are views into the request path,
+matching never allocates.
+*/
+namespace util {
+	namespace utf8 {
+		template<typename T> class router {
+		public:
+			static constexpr size_t max_params = 16;
+
+			struct match {
+				const T*      value = nullptr; // nullptr when nothing matched
+				uint32_t      route = 0;       // index of the matched route in the order they were added
+				uint32_t      count = 0;       // number of captures
+				const router* owner = nullptr;
+				const char*   base  = nullptr;
+				uint32_t      captures[max_params][2] = {}; // offset and size in the path
+
+				explicit operator bool() const
+				{
+					return value != nullptr;
+				}
+
+				/* capture i in pattern order, an empty view if there is none */
+				std::string_view param(size_t i) const
+				{
+					if (i >= count) {
+						return {};
+					}
+					return std::string_view(base + captures[i][0], captures[i][1]);
+				}
+
+				/* the capture named name in the matched pattern, an empty view if there is none */
+				std::string_view param(const std::string_view name) const
+				{
+					if (!value) {
+						return {};
+					}
+					const auto& names = owner->routes[route].names;
+					for (size_t i = 0; i < names.size() && i < count; i++) {
+						if (names[i] == name) {
+							return param(i);
+						}
+					}
+					return {};
+				}
+			};
+
+			router()
+			{
+				nodes.emplace_back();
+				slots.assign(64, 0);
+			}
+
+			/* adds pattern, returns false if it is malformed, has too many captures or is already routed */
+			bool add(const std::string_view pattern, T value)
+			{
+				// reject before creating any node, so a refused pattern leaves no dead branch behind. an already
+				// routed pattern is only found at its last node, but every node on its way existed already
+				if (!well_formed(pattern)) {
+					return false;
+				}
+				std::vector<std::string> names;
+				uint32_t                 n   = 0;
+				const auto               end = pattern.data() + pattern.size();
+				for (auto it = std::find_if_not(pattern.data(), end, is_slash); it != end;
+								it = std::find_if_not(it, end, is_slash)) {
+					const auto             segment_end = std::find_if(it, end, is_slash);
+					const std::string_view segment(it, static_cast<size_t>(segment_end - it));
+					it = segment_end;
+
+					if (segment[0] == ':') {
+						n = param_child(n);
+						names.emplace_back(segment.substr(1));
+						continue;
+					}
+
+					const auto star = segment.find('*');
+					if (star == std::string_view::npos) {
+						n = literal_child(n, segment);
+						continue;
+					}
+					names.emplace_back(segment.substr(star + 1));
+					if (star == 0 && is_capture_name(segment.substr(1))) {
+						n = catch_all_child(n);
+						continue;
+					}
+					names.back().clear(); // a glob's capture has no name
+					n = glob_child(n, segment.substr(0, star), segment.substr(star + 1));
+				}
+
+				if (nodes[n].route) {
+					return false;
+				}
+				routes.push_back({std::string(pattern), std::move(names), std::move(value)});
+				nodes[n].route = static_cast<uint32_t>(routes.size());
+				return true;
+			}
+
+			/* matches path into out, returns false (and leaves out.value null) when no route matches */
+			bool find(std::string_view path, match& out) const
+			{
+				const auto query = std::find_if(path.begin(), path.end(), [](char c) { return c == '?' || c == '#'; });
+				path             = path.substr(0, static_cast<size_t>(query - path.begin()));
+				out.value        = nullptr;
+				out.count        = 0;
+				out.owner        = this;
+				out.base         = path.data();
+				const auto end   = path.data() + path.size();
+				return match_node(0, std::find_if_not(path.data(), end, is_slash), end, out);
+			}
+
+			match find(const std::string_view path) const
+			{
+				match ret;
+				find(path, ret);
+				return ret;
+			}
+
+			size_t size() const
+			{
+				return routes.size();
+			}
+
+			/* the pattern of route index route */
+			std::string_view pattern(uint32_t route) const
+			{
+				return routes[route].pattern;
+			}
+
+		private:
+			struct glob {
+				std::string prefix;
+				std::string suffix;
+				uint32_t    child;
+			};
+
+			struct node {
+				uint32_t          parent    = 0;
+				uint32_t          param     = 0; // child for :name, 0 if none
+				uint32_t          catch_all = 0; // child for *name, 0 if none
+				uint32_t          route     = 0; // route index + 1 ending here, 0 if none
+				uint64_t          hash      = 0; // of the literal leading here
+				std::string       literal;
+				std::vector<glob> globs; // most specific (longest prefix + suffix) first
+				bool              has_literals = false;
+			};
+
+			struct route_entry {
+				std::string              pattern;
+				std::vector<std::string> names;
+				T                        value;
+			};
+
+			static bool is_capture_name(const std::string_view name)
+			{
+				for (const char c : name) {
+					if (!(fold_letter(c) >= 'a' && fold_letter(c) <= 'z') && c != '_' &&
+									(uint8_t)((uint8_t)c - (uint8_t)'0') >= 10) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			/* the checks add() makes, without touching the tree: one star per segment, a catch-all only last */
+			static bool well_formed(const std::string_view pattern)
+			{
+				size_t     captures = 0;
+				const auto end      = pattern.data() + pattern.size();
+				for (auto it = std::find_if_not(pattern.data(), end, is_slash); it != end;
+								it = std::find_if_not(it, end, is_slash)) {
+					const auto             segment_end = std::find_if(it, end, is_slash);
+					const std::string_view segment(it, static_cast<size_t>(segment_end - it));
+					it = segment_end;
+
+					const auto star = segment[0] == ':' ? 0 : segment.find('*');
+					if (star == std::string_view::npos) {
+						continue;
+					}
+					captures++;
+					if (segment[0] == ':') {
+						continue;
+					}
+					if (star == 0 && is_capture_name(segment.substr(1))) {
+						if (std::find_if_not(it, end, is_slash) != end) {
+							return false;
+						}
+					} else if (segment.find('*', star + 1) != std::string_view::npos) {
+						return false;
+					}
+				}
+				return captures <= max_params;
+			}
+
+			size_t slot_of(uint32_t parent, uint64_t h) const
+			{
+				const auto mixed = hash::mix(h ^ (parent * 0x9e3779b97f4a7c15ull));
+				return static_cast<size_t>(mixed) & (slots.size() - 1);
+			}
+
+			uint32_t find_literal(uint32_t parent, const std::string_view text, uint64_t h) const
+			{
+				for (auto i = slot_of(parent, h); slots[i]; i = (i + 1) & (slots.size() - 1)) {
+					const auto& n = nodes[slots[i]];
+					if (n.hash == h && n.parent == parent && n.literal == text) {
+						return slots[i];
+					}
+				}
+				return 0;
+			}
+
+			uint32_t new_node(uint32_t parent)
+			{
+				nodes.emplace_back();
+				nodes.back().parent = parent;
+				return static_cast<uint32_t>(nodes.size() - 1);
+			}
+
+			uint32_t literal_child(uint32_t n, const std::string_view text)
+			{
+				const auto h = hash::fnv_range(hash::fnv_offset, text.data(), text.data() + text.size());
+				if (const auto child = find_literal(n, text, h)) {
+					return child;
+				}
+				const auto child      = new_node(n);
+				nodes[child].literal  = std::string(text);
+				nodes[child].hash     = h;
+				nodes[n].has_literals = true;
+				if (++literal_count * 2 > slots.size()) {
+					slots.assign(slots.size() * 2, 0);
+					for (uint32_t i = 1; i < nodes.size(); i++) {
+						if (!nodes[i].literal.empty()) {
+							insert_slot(i);
+						}
+					}
+				} else {
+					insert_slot(child);
+				}
+				return child;
+			}
+
+			void insert_slot(uint32_t id)
+			{
+				auto i = slot_of(nodes[id].parent, nodes[id].hash);
+				while (slots[i]) {
+					i = (i + 1) & (slots.size() - 1);
+				}
+				slots[i] = id;
+			}
+
+			uint32_t param_child(uint32_t n)
+			{
+				if (!nodes[n].param) {
+					const auto child = new_node(n);
+					nodes[n].param   = child;
+				}
+				return nodes[n].param;
+			}
+
+			uint32_t catch_all_child(uint32_t n)
+			{
+				if (!nodes[n].catch_all) {
+					const auto child   = new_node(n);
+					nodes[n].catch_all = child;
+				}
+				return nodes[n].catch_all;
+			}
+
+			uint32_t glob_child(uint32_t n, const std::string_view prefix, const std::string_view suffix)
+			{
+				for (const auto& g : nodes[n].globs) {
+					if (g.prefix == prefix && g.suffix == suffix) {
+						return g.child;
+					}
+				}
+				const auto child = new_node(n);
+				auto&      globs = nodes[n].globs;
+				const auto pos   = std::find_if(globs.begin(), globs.end(), [&](const glob& g) {
+					return g.prefix.size() + g.suffix.size() < prefix.size() + suffix.size();
+				});
+				globs.insert(pos, glob{std::string(prefix), std::string(suffix), child});
+				return child;
+			}
+
+			bool finish(uint32_t n, match& m) const
+			{
+				if (!nodes[n].route) {
+					return false;
+				}
+				m.route = nodes[n].route - 1;
+				m.value = &routes[m.route].value;
+				return true;
+			}
+
+			bool capture(match& m, const char* first, const char* last) const
+			{
+				if (m.count == max_params) {
+					return false;
+				}
+				m.captures[m.count][0] = static_cast<uint32_t>(first - m.base);
+				m.captures[m.count][1] = static_cast<uint32_t>(last - first);
+				m.count++;
+				return true;
+			}
+
+			bool match_node(uint32_t n, const char* const it, const char* const end, match& m) const
+			{
+				// match the components in [it, end) below node n, it is at the start of a component
+				const auto& current = nodes[n];
+				if (it == end) {
+					if (finish(n, m)) {
+						return true;
+					}
+					// an empty remainder still satisfies a catch-all
+					if (current.catch_all && capture(m, end, end)) {
+						if (finish(current.catch_all, m)) {
+							return true;
+						}
+						m.count--;
+					}
+					return false;
+				}
+
+				const auto             segment_end = std::find_if(it, end, is_slash);
+				const auto             next        = std::find_if_not(segment_end, end, is_slash);
+				const std::string_view text(it, static_cast<size_t>(segment_end - it));
+				if (current.has_literals) {
+					const auto h = hash::fnv_range(hash::fnv_offset, it, segment_end);
+					if (const auto child = find_literal(n, text, h)) {
+						if (match_node(child, next, end, m)) {
+							return true;
+						}
+					}
+				}
+
+				for (const auto& g : current.globs) {
+					const auto fixed = g.prefix.size() + g.suffix.size();
+					if (text.size() < fixed || text.compare(0, g.prefix.size(), g.prefix) != 0 ||
+									text.compare(text.size() - g.suffix.size(), g.suffix.size(), g.suffix) != 0) {
+						continue;
+					}
+					if (capture(m, it + g.prefix.size(), segment_end - g.suffix.size())) {
+						if (match_node(g.child, next, end, m)) {
+							return true;
+						}
+						m.count--;
+					}
+				}
+
+				if (current.param && capture(m, it, segment_end)) {
+					if (match_node(current.param, next, end, m)) {
+						return true;
+					}
+					m.count--;
+				}
+
+				if (current.catch_all && capture(m, it, end)) {
+					if (finish(current.catch_all, m)) {
+						return true;
+					}
+					m.count--;
+				}
+				return false;
+			}
+
+			std::vector<node>        nodes;
+			std::vector<uint32_t>    slots; // (parent, literal) -> node, open addressing, 0 is empty
+			std::vector<route_entry> routes;
+			size_t                   literal_count = 0;
+		};
+	} // namespace utf8
+} // namespace util
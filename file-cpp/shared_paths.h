@@ -0,0 +1,508 @@
+﻿#pragma once
+
+#include "file.h"
+#include "hash.h"
+#include <string_view>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Path intern table in shared memory, so worker processes share one copy of the directory tree
+instead of building one each.
+
+	// the parent
+	util::utf8::shared_path_table table;
+	table.create("/indexer_paths", 1 << 22, 256 << 20); // nodes, name bytes
+	// every worker
+	util::utf8::shared_path_table table;
+	table.open("/indexer_paths");
+	const uint32_t id = table.intern("/src/app/main.cpp");
+	table.path(id); // "/src/app/main.cpp"
+	// the parent, once the workers are done
+	util::utf8::shared_path_table::remove("/indexer_paths");
+
+A node is keyed by its parent's node and its filename, the root_path of a path is the topmost
+node below node 0 (the empty path), as in merkle.h. Components are compared exactly.
+
+The region is a header, an open addressed hash of node ids, the nodes and their names, sized
+once by create() because a mapping shared between processes cannot move. Everything in it refers
+to everything else by index or offset, so each process may map it at a different address.
+
+Inserts are lock free: a node and its name are claimed with a fetch_add and filled in, then
+published by a compare and swap of an empty slot, which readers load with acquire. A process
+that loses the race to insert the same key finds the winner's node instead, the node it claimed
+stays unused. When the nodes or name bytes run out intern() returns npos. Processes must not be
+killed in the middle of an insert, a claimed slot is only ever published fully written, but a
+node claimed and never published is lost.
+
+With a null name create() makes an anonymous region: a memfd on Linux (pass fd() to workers and
+attach() there), shared with fork()ed children elsewhere, and an unnamed section on Windows.
+*/
+namespace util {
+	namespace utf8 {
+		namespace detail {
+			constexpr uint64_t shared_table_magic   = 0x31626174'70706366ull; // "fcpptab1"
+			constexpr uint32_t shared_table_version = 1;
+
+			struct shared_table_header {
+				uint64_t magic; // written last by create(), so open() never sees a half initialized table
+				uint32_t version;
+				uint32_t slot_count;
+				uint32_t node_capacity;
+				uint32_t reserved;
+				uint64_t name_capacity;
+				uint64_t slots_offset;
+				uint64_t nodes_offset;
+				uint64_t names_offset;
+				alignas(64) uint32_t node_count; // atomic
+				alignas(64) uint64_t name_bytes; // atomic
+			};
+
+			struct shared_node {
+				uint64_t name_offset;
+				uint32_t name_size;
+				uint32_t parent;
+				uint32_t name_hash;
+				uint32_t reserved;
+			};
+
+			static_assert(sizeof(shared_node) == 24, "the layout is shared between builds");
+
+			static_assert(std::atomic_ref<uint32_t>::is_always_lock_free, "shared tables need address free atomics");
+			static_assert(std::atomic_ref<uint64_t>::is_always_lock_free, "shared tables need address free atomics");
+
+			constexpr uint64_t shared_align(uint64_t v)
+			{
+				return (v + 63) & ~uint64_t{63};
+			}
+		} // namespace detail
+
+		class shared_path_table {
+		public:
+			static constexpr uint32_t npos = UINT32_MAX;
+
+			shared_path_table() = default;
+
+			shared_path_table(const shared_path_table&) = delete;
+			shared_path_table& operator=(const shared_path_table&) = delete;
+
+			shared_path_table(shared_path_table&& other) noexcept
+							: base(std::exchange(other.base, nullptr)), bytes(std::exchange(other.bytes, 0)),
+							  handle(std::exchange(other.handle, invalid_handle))
+			{
+			}
+
+			shared_path_table& operator=(shared_path_table&& other) noexcept
+			{
+				if (this != &other) {
+					close();
+					base   = std::exchange(other.base, nullptr);
+					bytes  = std::exchange(other.bytes, 0);
+					handle = std::exchange(other.handle, invalid_handle);
+				}
+				return *this;
+			}
+
+			~shared_path_table()
+			{
+				close();
+			}
+
+			/* bytes of the region for a table of nodes nodes and name_bytes bytes of names */
+			static uint64_t region_size(const uint32_t nodes, const uint64_t name_bytes)
+			{
+				const uint64_t slots = std::bit_ceil(uint64_t{std::max(nodes, 1u)} * 2);
+				return detail::shared_align(sizeof(detail::shared_table_header)) + detail::shared_align(slots * 4) +
+					   detail::shared_align(uint64_t{nodes} * sizeof(detail::shared_node)) + name_bytes;
+			}
+
+			/*
+			creates the region name (for shm_open, eg: "/indexer_paths") with room for nodes nodes and name_bytes
+			bytes of names, or an anonymous one for a null name. fails if name exists
+			*/
+			bool create(const char* const name, const uint32_t nodes, const uint64_t name_bytes)
+			{
+				close();
+				if (nodes < 2 || nodes == npos || uint64_t{nodes} * 2 > UINT32_MAX) {
+					return false;
+				}
+				const uint64_t size = region_size(nodes, name_bytes);
+				if (!map(name, size, true)) {
+					return false;
+				}
+				// the region comes zeroed, so only the header needs filling in
+				auto& h          = header();
+				h.version        = detail::shared_table_version;
+				h.slot_count     = static_cast<uint32_t>(std::bit_ceil(uint64_t{nodes} * 2));
+				h.node_capacity  = nodes;
+				h.name_capacity  = name_bytes;
+				h.slots_offset   = detail::shared_align(sizeof(detail::shared_table_header));
+				h.nodes_offset   = h.slots_offset + detail::shared_align(uint64_t{h.slot_count} * 4);
+				h.names_offset   = h.nodes_offset + detail::shared_align(uint64_t{nodes} * sizeof(detail::shared_node));
+				h.node_count     = 1; // node 0 is the empty path
+				std::atomic_ref<uint64_t>(h.magic).store(detail::shared_table_magic, std::memory_order_release);
+				return true;
+			}
+
+			/* maps the existing region name, false if it is missing or not (yet) a table */
+			bool open(const char* const name)
+			{
+				close();
+				return map(name, 0, false) && check();
+			}
+
+#if !defined(_WIN32)
+			/* maps the table in fd, eg: a create(nullptr, ...) region's fd() passed to a worker */
+			bool attach(const int fd)
+			{
+				close();
+				struct stat st = {};
+				if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+					return false;
+				}
+				const auto  length = static_cast<size_t>(st.st_size);
+				void* const p      = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED) {
+					return false;
+				}
+				base  = static_cast<char*>(p);
+				bytes = length;
+				return check();
+			}
+
+			/* the memfd of an anonymous region on Linux, otherwise -1 */
+			int fd() const
+			{
+				return handle;
+			}
+#endif
+
+			/* removes the name of a region, processes that mapped it keep it until they close it */
+			static bool remove(const char* const name)
+			{
+#if defined(_WIN32)
+				(void)name; // sections go away with their last handle
+				return true;
+#else
+				return ::shm_unlink(name) == 0;
+#endif
+			}
+
+			void close()
+			{
+				if (base) {
+#if defined(_WIN32)
+					UnmapViewOfFile(base);
+#else
+					::munmap(base, bytes);
+#endif
+				}
+#if defined(_WIN32)
+				if (handle) {
+					CloseHandle(handle);
+				}
+#else
+				if (handle >= 0) {
+					::close(handle);
+				}
+#endif
+				base   = nullptr;
+				bytes  = 0;
+				handle = invalid_handle;
+			}
+
+			explicit operator bool() const
+			{
+				return base != nullptr;
+			}
+
+			/* nodes in use, node 0 and nodes claimed by lost races included */
+			uint32_t size() const
+			{
+				return std::min(load(header().node_count), header().node_capacity);
+			}
+
+			/* the node of name under parent, inserting it if needed. npos if the table is full */
+			uint32_t intern(const uint32_t parent, const std::string_view name)
+			{
+				const uint32_t h     = name_hash(parent, name);
+				const uint32_t mask  = header().slot_count - 1;
+				uint32_t       fresh = npos; // a node claimed by this call, not yet published
+				for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+					uint32_t id = load(slots()[i]);
+					if (!id) {
+						if (fresh == npos && (fresh = claim(parent, name, h)) == npos) {
+							return npos;
+						}
+						if (std::atomic_ref<uint32_t>(slots()[i]).compare_exchange_strong(id, fresh,
+											std::memory_order_release, std::memory_order_acquire)) {
+							return fresh;
+						}
+						// another process took the slot first, id is its node
+					}
+					if (matches(id, parent, name, h)) {
+						return id;
+					}
+				}
+			}
+
+			/* the node of path, inserting it and its parents if needed. npos if the table is full */
+			uint32_t intern(const std::string_view path)
+			{
+				uint32_t n = 0;
+				for_each_component(path, [&](const std::string_view name) {
+					n = n == npos ? npos : intern(n, name);
+				});
+				return n;
+			}
+
+			/* the node of name under parent, npos if there is none */
+			uint32_t find(const uint32_t parent, const std::string_view name) const
+			{
+				const uint32_t h    = name_hash(parent, name);
+				const uint32_t mask = header().slot_count - 1;
+				for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+					const uint32_t id = load(slots()[i]);
+					if (!id) {
+						return npos;
+					}
+					if (matches(id, parent, name, h)) {
+						return id;
+					}
+				}
+			}
+
+			/* the node of path, npos if there is none */
+			uint32_t find(const std::string_view path) const
+			{
+				uint32_t n = 0;
+				for_each_component(path, [&](const std::string_view name) {
+					n = n == npos ? npos : find(n, name);
+				});
+				return n;
+			}
+
+			uint32_t parent(const uint32_t id) const
+			{
+				return nodes()[id].parent;
+			}
+
+			/* the filename of id, or its root_path for a topmost node */
+			std::string_view name(const uint32_t id) const
+			{
+				const auto& n = nodes()[id];
+				return std::string_view(names() + n.name_offset, n.name_size);
+			}
+
+			/* the path of id, components joined with '/' */
+			std::string path(const uint32_t id) const
+			{
+				std::string ret;
+				append_path(ret, id);
+				return ret;
+			}
+
+		private:
+#if defined(_WIN32)
+			using native_handle = HANDLE;
+			static constexpr native_handle invalid_handle = nullptr;
+#else
+			using native_handle = int;
+			static constexpr native_handle invalid_handle = -1;
+#endif
+
+			template<typename Fn> static void for_each_component(const std::string_view path, Fn&& fn)
+			{
+				const auto root = root_path(path);
+				if (!root.empty()) {
+					fn(root);
+				}
+				for (const auto name : components(path)) {
+					fn(name);
+				}
+			}
+
+			static uint32_t name_hash(const uint32_t parent, const std::string_view name)
+			{
+				const uint64_t h = hash::fnv_range(hash::fnv_offset ^ parent, name.data(), name.data() + name.size());
+				return static_cast<uint32_t>(hash::mix(h));
+			}
+
+			template<typename T> static T load(const T& v)
+			{
+				return std::atomic_ref<T>(const_cast<T&>(v)).load(std::memory_order_acquire);
+			}
+
+			uint32_t claim(const uint32_t parent, const std::string_view name, const uint32_t h)
+			{
+				auto&          head = header();
+				const uint32_t id   = std::atomic_ref<uint32_t>(head.node_count).fetch_add(1);
+				if (id >= head.node_capacity) {
+					return npos;
+				}
+				const uint64_t offset = std::atomic_ref<uint64_t>(head.name_bytes).fetch_add(name.size());
+				if (offset + name.size() > head.name_capacity) {
+					return npos;
+				}
+				std::memcpy(names() + offset, name.data(), name.size());
+				auto& n       = nodes()[id];
+				n.name_offset = offset;
+				n.name_size   = static_cast<uint32_t>(name.size());
+				n.parent      = parent;
+				n.name_hash   = h;
+				return id;
+			}
+
+			bool matches(const uint32_t id, const uint32_t parent, const std::string_view name, const uint32_t h) const
+			{
+				const auto& n = nodes()[id];
+				return n.name_hash == h && n.parent == parent && this->name(id) == name;
+			}
+
+			void append_path(std::string& out, const uint32_t id) const
+			{
+				if (id == 0) {
+					return;
+				}
+				append_path(out, parent(id));
+				if (!out.empty() && !is_slash(out.back())) {
+					out.push_back('/');
+				}
+				out.append(name(id));
+			}
+
+			bool map(const char* const name, const uint64_t size, const bool create)
+			{
+#if defined(_WIN32)
+				if (create) {
+					handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+									static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name);
+					if (handle && GetLastError() == ERROR_ALREADY_EXISTS) {
+						close();
+						return false;
+					}
+				} else {
+					handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+				}
+				if (!handle) {
+					handle = invalid_handle;
+					return false;
+				}
+				base = static_cast<char*>(MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+				MEMORY_BASIC_INFORMATION info = {};
+				if (!base || !VirtualQuery(base, &info, sizeof(info))) {
+					close();
+					return false;
+				}
+				bytes = info.RegionSize;
+				return true;
+#else
+				int fd = -1;
+				if (!name) {
+#if defined(__linux__)
+					fd = ::memfd_create("file_cpp_paths", MFD_CLOEXEC);
+#else
+					void* const p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+					base          = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+					bytes         = base ? size : 0;
+					return base != nullptr;
+#endif
+				} else {
+					fd = ::shm_open(name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+				}
+				if (fd < 0) {
+					return false;
+				}
+				struct stat st = {};
+				if (create ? ::ftruncate(fd, static_cast<off_t>(size)) != 0 : ::fstat(fd, &st) != 0) {
+					::close(fd);
+					if (create && name) {
+						::shm_unlink(name);
+					}
+					return false;
+				}
+				const size_t length = create ? static_cast<size_t>(size) : static_cast<size_t>(st.st_size);
+				void* const  p      = length ? ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+											 : MAP_FAILED;
+				if (p == MAP_FAILED) {
+					::close(fd);
+					if (create && name) {
+						::shm_unlink(name);
+					}
+					return false;
+				}
+				base  = static_cast<char*>(p);
+				bytes = length;
+				if (name) {
+					::close(fd); // the mapping keeps the region
+				} else {
+					handle = fd; // the memfd is how other processes get at an anonymous region
+				}
+				return true;
+#endif
+			}
+
+			bool check()
+			{
+				// a table that is complete, of this version, and fits in what was mapped
+				const auto& h  = header();
+				bool        ok = bytes >= sizeof(detail::shared_table_header) &&
+								load(h.magic) == detail::shared_table_magic;
+				ok             = ok && h.version == detail::shared_table_version && std::has_single_bit(h.slot_count) &&
+								h.slot_count >= uint64_t{h.node_capacity} * 2;
+				ok             = ok && h.slots_offset + uint64_t{h.slot_count} * 4 <= h.nodes_offset;
+				ok             = ok && h.nodes_offset + h.node_capacity * uint64_t{24} <= h.names_offset;
+				ok             = ok && h.names_offset + h.name_capacity <= bytes;
+				if (!ok) {
+					close();
+				}
+				return ok;
+			}
+
+			detail::shared_table_header& header() const
+			{
+				return *reinterpret_cast<detail::shared_table_header*>(base);
+			}
+
+			uint32_t* slots() const
+			{
+				return reinterpret_cast<uint32_t*>(base + header().slots_offset);
+			}
+
+			detail::shared_node* nodes() const
+			{
+				return reinterpret_cast<detail::shared_node*>(base + header().nodes_offset);
+			}
+
+			char* names() const
+			{
+				return base + header().names_offset;
+			}
+
+			char*         base   = nullptr;
+			size_t        bytes  = 0;
+			native_handle handle = invalid_handle;
+		};
+	} // namespace utf8
+} // namespace util
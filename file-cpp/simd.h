@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FILE_CPP_SSE2 1
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/*
+Small portability layer for the vectorized scanners. Everything here must have a scalar
+fallback at the call site, FILE_CPP_SSE2 is only defined when SSE2 can be used unconditionally
+(always the case on x86-64).
+*/
+namespace util {
+	namespace simd {
+		inline unsigned count_trailing_zeros(uint32_t mask)
+		{
+			// pre: mask != 0
+#if defined(_MSC_VER) && !defined(__clang__)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return static_cast<unsigned>(index);
+#else
+			return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+		}
+
+#if defined(FILE_CPP_SSE2)
+		inline __m128i load(const char* p)
+		{
+			return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		}
+
+		inline uint32_t movemask(__m128i v)
+		{
+			return static_cast<uint32_t>(_mm_movemask_epi8(v));
+		}
+
+		inline __m128i in_range(__m128i v, char lo, char hi)
+		{
+			// lanes with lo <= v <= hi, as signed chars so lo and hi must be ascii
+			return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+							_mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+		}
+
+		inline __m128i is_slash(__m128i v)
+		{
+			// lanes holding '/' or '\\'
+			return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		}
+#endif
+	} // namespace simd
+} // namespace util
@@ -0,0 +1,240 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+/*
+Publishes immutable versions of a read mostly structure (a mount_table, router, component
+index...) to readers that never block, freeing old versions with epoch based reclamation.
+
+	util::snapshot<util::utf8::mount_table<int>> tables;
+	tables.publish(build_table());
+
+	// on every reader thread, once
+	auto reader = tables.make_reader();
+	{
+		auto table = reader.read();
+		use(table->find(path));
+	} // the version read stays alive until here
+
+A read announces the current epoch in the reader's own slot and then loads the current version,
+no lock is taken and nothing is written that other readers touch. publish() swaps the version in,
+advances the epoch and retires the old one, which is freed once every reader has either left its
+read section or entered a newer epoch. Readers holding a version only delay its reclamation, they
+never delay a writer.
+
+Unlike an atomic shared_ptr a read does not touch a shared reference count, so readers on many
+cores do not contend on one cache line. mount_router in mount_table.h is built on it.
+*/
+namespace util {
+	template<typename T> class snapshot {
+		static constexpr uint64_t idle = UINT64_MAX;
+
+		struct alignas(64) slot {
+			std::atomic<uint64_t> epoch   = idle; // epoch of the read in progress
+			std::atomic<bool>     claimed = false;
+			slot*                 next    = nullptr;
+		};
+
+	public:
+		class reader;
+
+		/* a version pinned for reading, valid until the guard is destroyed */
+		class read_guard {
+		public:
+			read_guard(const read_guard&) = delete;
+			read_guard& operator=(const read_guard&) = delete;
+
+			~read_guard()
+			{
+				if (--owner->depth == 0) {
+					owner->s->epoch.store(idle, std::memory_order_release);
+				}
+			}
+
+			const T* get() const
+			{
+				return value;
+			}
+
+			const T* operator->() const
+			{
+				return value;
+			}
+
+			const T& operator*() const
+			{
+				return *value;
+			}
+
+			explicit operator bool() const
+			{
+				return value != nullptr;
+			}
+
+		private:
+			friend class reader;
+
+			read_guard(reader* r, const T* v) : owner(r), value(v)
+			{
+			}
+
+			reader*  owner;
+			const T* value;
+		};
+
+		/* a thread's registration with the snapshot, not to be shared between threads */
+		class reader {
+		public:
+			reader(reader&& other) noexcept : s(std::exchange(other.s, nullptr)), owner(other.owner)
+			{
+			}
+
+			reader(const reader&) = delete;
+			reader& operator=(const reader&) = delete;
+			reader& operator=(reader&&) = delete;
+
+			~reader()
+			{
+				if (s) {
+					s->epoch.store(idle, std::memory_order_release);
+					s->claimed.store(false, std::memory_order_release);
+				}
+			}
+
+			/* the current version (nullptr before the first publish), reads may nest */
+			read_guard read()
+			{
+				if (depth++ == 0) {
+					// the announcement has to be visible before the version is loaded, hence seq_cst
+					s->epoch.store(owner->epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+				}
+				return read_guard(this, owner->current.load(std::memory_order_seq_cst));
+			}
+
+		private:
+			friend class snapshot;
+			friend class read_guard;
+
+			reader(slot* claimed, const snapshot* o) : s(claimed), owner(o)
+			{
+			}
+
+			slot*           s;
+			const snapshot* owner;
+			uint32_t        depth = 0;
+		};
+
+		snapshot() = default;
+
+		explicit snapshot(T value)
+		{
+			publish(std::move(value));
+		}
+
+		snapshot(const snapshot&) = delete;
+		snapshot& operator=(const snapshot&) = delete;
+
+		/* no reader may outlive the snapshot */
+		~snapshot()
+		{
+			delete current.load(std::memory_order_relaxed);
+			for (const auto& r : retired) {
+				delete r.value;
+			}
+			for (slot* s = slots.load(std::memory_order_relaxed); s;) {
+				const auto next = s->next;
+				delete s;
+				s = next;
+			}
+		}
+
+		/* registers the calling thread as a reader, reusing the slot of a destroyed reader if there is one */
+		reader make_reader() const
+		{
+			for (slot* s = slots.load(std::memory_order_acquire); s; s = s->next) {
+				bool expected = false;
+				if (!s->claimed.load(std::memory_order_relaxed) &&
+								s->claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+					return reader(s, this);
+				}
+			}
+			auto s = new slot;
+			s->claimed.store(true, std::memory_order_relaxed);
+			s->next = slots.load(std::memory_order_relaxed);
+			while (!slots.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {
+			}
+			return reader(s, this);
+		}
+
+		/* makes value the current version and retires the previous one */
+		void publish(T value)
+		{
+			const T* const next = new T(std::move(value));
+
+			std::lock_guard<std::mutex> lock(writer);
+			const T* const previous = current.exchange(next, std::memory_order_seq_cst);
+			const auto     retire   = epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+			if (previous) {
+				retired.push_back({previous, retire});
+			}
+			collect();
+		}
+
+		/* frees the retired versions no reader can still see, returns how many remain */
+		size_t reclaim()
+		{
+			std::lock_guard<std::mutex> lock(writer);
+			collect();
+			return retired.size();
+		}
+
+		/* waits until every retired version has been freed, readers must not hold a read section on this thread */
+		void synchronize()
+		{
+			while (reclaim()) {
+				std::this_thread::yield();
+			}
+		}
+
+	private:
+		struct retired_version {
+			const T* value;
+			uint64_t epoch; // first epoch in which the version can no longer be loaded
+		};
+
+		void collect()
+		{
+			// pre: writer is locked
+			if (retired.empty()) {
+				return;
+			}
+			// seq_cst pairs with the announcement in read(), a reader either shows up here or loads the new version
+			uint64_t oldest = idle;
+			for (slot* s = slots.load(std::memory_order_acquire); s; s = s->next) {
+				oldest = std::min(oldest, s->epoch.load(std::memory_order_seq_cst));
+			}
+			size_t kept = 0;
+			for (const auto& r : retired) {
+				if (r.epoch <= oldest) {
+					delete r.value;
+				} else {
+					retired[kept++] = r;
+				}
+			}
+			retired.resize(kept);
+		}
+
+		std::atomic<const T*>        current = nullptr;
+		std::atomic<uint64_t>        epoch   = 0;
+		mutable std::atomic<slot*>   slots   = nullptr; // registered readers, only ever grows
+		std::mutex                   writer;
+		std::vector<retired_version> retired;
+	};
+} // namespace util
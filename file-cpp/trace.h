@@ -0,0 +1,44 @@
+﻿#pragma once
+
+/*
+Optional USDT (user statically defined tracing) probes at batch boundaries, so a stalled process
+can be looked at with bpftrace or perf without a debug build.
+
+	cmake -DFILE_CPP_USDT=ON ...   (defines FILE_CPP_USDT, needs <sys/sdt.h> from systemtap-sdt-dev)
+
+	bpftrace -e 'usdt:./indexer:file_cpp:walk_exit { printf("%s %d\n", str(arg0, arg1), arg2); }'
+
+Probes sit at the boundaries of batches and I/O, never inside the per byte loops, and take plain
+integers and pointers: paths are passed as a pointer and a length (they need not be terminated).
+Without FILE_CPP_USDT, or without <sys/sdt.h>, they compile to nothing and their arguments are not
+evaluated. An enabled probe that nothing is attached to is a single nop.
+
+	walk_enter       (path, length, directory id)       a directory is about to be listed
+	walk_exit        (path, length, entries)            a directory was listed
+	cache_hit        (path, length)                     content_cache served path from memory
+	cache_revalidate (path, length)                     content_cache stat()ed path and kept it
+	cache_miss       (path, length, bytes)              content_cache loaded path, bytes is 0 on failure
+	partition_begin  (paths, shards)
+	partition_end    (paths, shards)
+	format_begin     (paths, threads)                   format_paths
+	format_end       (paths, bytes)
+	rescan_begin     (directories, depth)               incremental_walk stats and lists a level of directories
+	rescan_end       (directories, depth)
+	bulk_stat_begin  (files, directories)               bulk_load stats the files to plan their read order
+	bulk_stat_end    (files, directories)
+*/
+#if defined(FILE_CPP_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FILE_CPP_USDT_ENABLED 1
+#endif
+#endif
+
+#if defined(FILE_CPP_USDT_ENABLED)
+#define FILE_CPP_PROBE2(name, a, b)    DTRACE_PROBE2(file_cpp, name, a, b)
+#define FILE_CPP_PROBE3(name, a, b, c) DTRACE_PROBE3(file_cpp, name, a, b, c)
+#else
+// sizeof keeps the arguments unevaluated but used, so values computed only for a probe do not warn
+#define FILE_CPP_PROBE2(name, a, b)    ((void)sizeof(a), (void)sizeof(b))
+#define FILE_CPP_PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
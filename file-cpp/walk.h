@@ -0,0 +1,433 @@
+﻿#pragma once
+
+#include "file.h"
+#include "mapped_file.h"
+#include "trace.h"
+#include <string_view>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#endif
+
+/*
+Recursive directory walk that can be stopped (or crash) and resumed where it left off.
+
+	util::utf8::walk_options opts;
+	opts.checkpoint = "crawl.ckpt";
+	auto result = util::utf8::walk("/archive", [](std::string_view path, bool directory) {
+		index(path);
+		return true; // false stops the walk, it resumes from the checkpoint next time
+	}, opts);
+
+Every entry below root is reported once, depth first. Symlinks are not followed and directories
+that cannot be read are skipped. Directories are the unit of progress: once a directory has been
+listed its children have all been reported.
+
+The checkpoint is an append only log of small records. Discovering a directory appends its id,
+its parent's id and its filename, listing one appends its id, and once everything below a
+directory has been listed a subtree record lets both the walker and a resume forget it, so memory
+and resume time follow the frontier rather than the size of the tree. Records are buffered and
+written every checkpoint_every, always at a directory boundary, which costs a few bytes per
+directory on the hot path. A resume replays the log, rewrites it compacted and continues with the
+directories that were found but not listed. Directories listed after the last write are listed
+(and their children reported) again, nothing listed before it is. A finished walk removes its
+checkpoint. When the checkpoint cannot be written the walk stops (before reporting anything if it
+cannot be started) with checkpoint_failed set, rather than going on without one.
+*/
+namespace util {
+	namespace utf8 {
+		struct walk_options {
+			std::string               checkpoint; // checkpoint log path, empty for none
+			std::chrono::milliseconds checkpoint_every = std::chrono::milliseconds(5000);
+		};
+
+		struct walk_result {
+			size_t entries           = 0; // reported by this call
+			size_t directories       = 0; // listed by this call
+			bool   complete          = false;
+			bool   resumed           = false;
+			bool   checkpoint_failed = false; // the checkpoint could not be written, the walk stopped there
+		};
+
+		namespace detail {
+			constexpr char walk_magic[8] = {'F', 'W', 'A', 'L', 'K', '0', '0', '1'};
+
+			enum walk_record : char {
+				walk_found   = 'D', // id, parent id, filename
+				walk_listed  = 'L', // id
+				walk_subtree = 'S', // id, everything below it has been listed
+			};
+
+			inline void append_varint(std::string& out, uint64_t v)
+			{
+				while (v >= 0x80) {
+					out.push_back(static_cast<char>(v | 0x80));
+					v >>= 7;
+				}
+				out.push_back(static_cast<char>(v));
+			}
+
+			inline bool read_varint(std::string_view& in, uint64_t& out)
+			{
+				out = 0;
+				for (unsigned shift = 0; shift < 64; shift += 7) {
+					if (in.empty()) {
+						return false;
+					}
+					const auto c = static_cast<uint8_t>(in[0]);
+					in.remove_prefix(1);
+					out |= static_cast<uint64_t>(c & 0x7f) << shift;
+					if (!(c & 0x80)) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			inline bool read_bytes(std::string_view& in, std::string_view& out)
+			{
+				uint64_t size = 0;
+				if (!read_varint(in, size) || size > in.size()) {
+					return false;
+				}
+				out = in.substr(0, static_cast<size_t>(size));
+				in.remove_prefix(static_cast<size_t>(size));
+				return true;
+			}
+
+			/* calls fn(name, directory) for the entries of the directory at path, false if it cannot be read */
+			template<typename Fn> inline bool list_directory(const std::string& path, Fn&& fn)
+			{
+#if defined(_WIN32)
+				WIN32_FIND_DATAA data   = {};
+				const HANDLE     handle = FindFirstFileExA((path + "\\*").c_str(), FindExInfoBasic, &data,
+								FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+				if (handle == INVALID_HANDLE_VALUE) {
+					return false;
+				}
+				do {
+					const std::string_view name = data.cFileName;
+					if (name == "." || name == "..") {
+						continue;
+					}
+					// reparse points (symlinks, junctions) are reported but not entered
+					const bool directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+									!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+					if (!fn(name, directory)) {
+						break;
+					}
+				} while (FindNextFileA(handle, &data));
+				FindClose(handle);
+				return true;
+#else
+				DIR* const dir = ::opendir(path.c_str());
+				if (!dir) {
+					return false;
+				}
+				std::string child;
+				while (const dirent* const e = ::readdir(dir)) {
+					const std::string_view name = e->d_name;
+					if (name == "." || name == "..") {
+						continue;
+					}
+					bool directory = e->d_type == DT_DIR;
+					if (e->d_type == DT_UNKNOWN) { // some filesystems do not fill in d_type
+						child.assign(path).append("/").append(name);
+						struct stat st = {};
+						directory      = ::lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+					}
+					if (!fn(name, directory)) {
+						break;
+					}
+				}
+				::closedir(dir);
+				return true;
+#endif
+			}
+
+			class walk_state {
+			public:
+				struct directory {
+					uint64_t    parent = 0;
+					std::string name;
+					uint32_t    open   = 0; // found subdirectories whose subtree is not done yet
+					bool        listed = false;
+				};
+
+				std::string                             root;
+				std::unordered_map<uint64_t, directory> dirs;    // found and not yet done, 0 is root
+				std::vector<uint64_t>                   pending; // found, not listed, walked from the back
+				uint64_t                                next_id = 1;
+				std::string                             log; // records not written yet
+
+				void start(const std::string_view root_path)
+				{
+					root.assign(root_path);
+					dirs.clear();
+					dirs[0] = {};
+					pending = {0};
+					next_id = 1;
+					log.assign(walk_magic, sizeof(walk_magic));
+					append_bytes(root);
+				}
+
+				/* replays a checkpoint of a walk of root_path, false if there is none to resume */
+				bool replay(const std::string_view root_path, std::string_view in)
+				{
+					std::string_view recorded_root;
+					if (in.size() < sizeof(walk_magic) || std::memcmp(in.data(), walk_magic, sizeof(walk_magic)) != 0) {
+						return false;
+					}
+					in.remove_prefix(sizeof(walk_magic));
+					if (!read_bytes(in, recorded_root) || recorded_root != root_path) {
+						return false;
+					}
+					root.assign(root_path);
+					dirs.clear();
+					dirs[0] = {};
+					next_id = 1;
+
+					// a torn record at the end is where the last write was cut off, replay up to it
+					while (!in.empty()) {
+						const char       tag  = in[0];
+						std::string_view rest = in.substr(1);
+						uint64_t         id   = 0;
+						if (!read_varint(rest, id)) {
+							break;
+						}
+						if (tag == walk_found) {
+							uint64_t         parent = 0;
+							std::string_view name;
+							if (!read_varint(rest, parent) || !read_bytes(rest, name)) {
+								break;
+							}
+							// ids are handed out in order, so a parent always has a smaller id than its children and
+							// path_of() cannot go around a cycle
+							if (parent >= id) {
+								return false;
+							}
+							dirs[id] = {parent, std::string(name)};
+							next_id  = std::max(next_id, id + 1);
+						} else if (tag == walk_listed) {
+							if (const auto it = dirs.find(id); it != dirs.end()) {
+								it->second.listed = true;
+							}
+						} else if (tag == walk_subtree) {
+							dirs.erase(id);
+						} else {
+							break;
+						}
+						in = rest;
+					}
+
+					std::vector<uint64_t> ids;
+					for (auto& d : dirs) {
+						ids.push_back(d.first);
+						d.second.open = 0;
+					}
+					// parents were found before their children, and ascending ids are the order they were pushed in
+					std::sort(ids.begin(), ids.end());
+
+					// directories found by a listing that was never recorded as done are found again by listing
+					// their parent again, forget them. parents go first, so whatever was below them goes too
+					size_t kept = 0;
+					for (const auto id : ids) {
+						const auto parent = dirs.find(dirs[id].parent);
+						if (id == 0 || (parent != dirs.end() && parent->second.listed)) {
+							ids[kept++] = id;
+						} else {
+							dirs.erase(id);
+						}
+					}
+					ids.resize(kept);
+
+					pending.clear();
+					log.assign(walk_magic, sizeof(walk_magic));
+					append_bytes(root);
+					for (const auto id : ids) {
+						const auto& d = dirs[id];
+						if (id != 0) {
+							dirs[d.parent].open++;
+							found_record(id, d.parent, d.name);
+						}
+					}
+					for (const auto id : ids) {
+						if (dirs[id].listed) {
+							log.push_back(walk_listed);
+							append_varint(log, id);
+						} else {
+							pending.push_back(id);
+						}
+					}
+					return true;
+				}
+
+				std::string path_of(uint64_t id) const
+				{
+					std::vector<const directory*> chain;
+					while (id != 0) {
+						const auto& d = dirs.at(id);
+						chain.push_back(&d);
+						id = d.parent;
+					}
+					std::string ret = root;
+					for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+						if (!ret.empty() && !is_slash(ret.back())) {
+							ret.push_back('/');
+						}
+						ret.append((*it)->name);
+					}
+					return ret;
+				}
+
+				uint64_t found(uint64_t parent, const std::string_view name)
+				{
+					const auto id = next_id++;
+					dirs[id]      = {parent, std::string(name)};
+					dirs[parent].open++;
+					found_record(id, parent, name);
+					pending.push_back(id);
+					return id;
+				}
+
+				void listed(uint64_t id)
+				{
+					log.push_back(walk_listed);
+					append_varint(log, id);
+					dirs[id].listed = true;
+					// close every subtree that is now done, up towards root
+					while (dirs[id].listed && dirs[id].open == 0) {
+						log.push_back(walk_subtree);
+						append_varint(log, id);
+						const auto parent = dirs[id].parent;
+						dirs.erase(id);
+						if (id == 0) {
+							break;
+						}
+						dirs[parent].open--;
+						id = parent;
+					}
+				}
+
+			private:
+				void append_bytes(const std::string_view bytes)
+				{
+					append_varint(log, bytes.size());
+					log.append(bytes);
+				}
+
+				void found_record(uint64_t id, uint64_t parent, const std::string_view name)
+				{
+					log.push_back(walk_found);
+					append_varint(log, id);
+					append_varint(log, parent);
+					append_bytes(name);
+				}
+			};
+		} // namespace detail
+
+		/*
+		calls fn(path, directory) for every entry below root, resuming from opts.checkpoint if it holds an
+		unfinished walk of the same root. fn returns false to stop, the checkpoint is then written so the
+		walk can be resumed
+		*/
+		template<typename Fn>
+		inline walk_result walk(const std::string_view root, Fn&& fn, const walk_options& opts = {})
+		{
+			using clock = std::chrono::steady_clock;
+
+			walk_result        ret = {};
+			detail::walk_state state;
+			FILE*              file = nullptr;
+			if (!opts.checkpoint.empty()) {
+				mapped_file previous(opts.checkpoint.c_str());
+				ret.resumed = previous && state.replay(root, previous.view());
+			}
+			if (!ret.resumed) {
+				state.start(root);
+			}
+			if (!opts.checkpoint.empty()) {
+				// start the log over from the replayed state, so it only grows with this walk
+				if (write_file_atomic(opts.checkpoint, state.log)) {
+					file = std::fopen(opts.checkpoint.c_str(), "ab");
+				}
+				state.log.clear();
+				if (!file) {
+					ret.checkpoint_failed = true;
+					return ret;
+				}
+			}
+
+			// false once the log cannot be appended to, a walk asked to checkpoint does not go on without one
+			const auto write = [&] {
+				bool ok = true;
+				if (file && !state.log.empty()) {
+					ok = std::fwrite(state.log.data(), 1, state.log.size(), file) == state.log.size();
+					ok = std::fflush(file) == 0 && ok;
+				}
+				state.log.clear();
+				ret.checkpoint_failed = ret.checkpoint_failed || !ok;
+				return ok;
+			};
+
+			auto last_write = clock::now();
+			bool stopped    = false;
+			while (!stopped && !state.pending.empty()) {
+				const auto id = state.pending.back();
+				state.pending.pop_back();
+				const auto   path   = state.path_of(id);
+				const size_t before = ret.entries;
+				std::string  child;
+				FILE_CPP_PROBE3(walk_enter, path.data(), path.size(), id);
+				detail::list_directory(path, [&](const std::string_view name, bool directory) {
+					child.assign(path);
+					if (!child.empty() && !is_slash(child.back())) {
+						child.push_back('/');
+					}
+					child.append(name);
+					ret.entries++;
+					if (!fn(std::string_view(child), directory)) {
+						stopped = true;
+						return false;
+					}
+					if (directory) {
+						state.found(id, filename(child));
+					}
+					return true;
+				});
+				FILE_CPP_PROBE3(walk_exit, path.data(), path.size(), ret.entries - before);
+				if (stopped) {
+					break;
+				}
+				state.listed(id);
+				ret.directories++;
+
+				if (file && clock::now() - last_write >= opts.checkpoint_every) {
+					stopped    = !write();
+					last_write = clock::now();
+				}
+			}
+
+			ret.complete = !stopped;
+			if (file) {
+				// a partial listing is written too, its records are dropped on resume as its directory was not listed
+				if (!ret.complete) {
+					write();
+				}
+				std::fclose(file);
+				if (ret.complete) {
+					std::remove(opts.checkpoint.c_str());
+				}
+			}
+			return ret;
+		}
+	} // namespace utf8
+} // namespace util